@@ -1,4 +1,7 @@
 cd /D "%~dp0"
 glslangValidator -V -o ../SPIR-V/default.fspv default.frag -H
 glslangValidator -V -o ../SPIR-V/default.vspv default.vert -H
+glslangValidator -V -o ../SPIR-V/cull.cspv cull.comp -H
+rem shader_pack is built from Source/Tools/shader_pack.c
+shader_pack ../SPIR-V/shaders.crsp ../SPIR-V/default.vspv ../SPIR-V/default.fspv ../SPIR-V/cull.cspv
 pause
\ No newline at end of file
@@ -0,0 +1,167 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+// Packs SPIR-V files into one shader pack, see crang_shader_pack_header_t.
+// Usage: shader_pack output.crsp shader.vspv shader.fspv ...
+// Entries are named after the file name of their blob, identical blobs are stored once.
+
+#include "../cranberry_gfx_backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif // _WIN32
+
+#define max_shader_count 256
+
+static unsigned long long hash_fnv1a(void const* data, size_t size)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	unsigned char const* bytes = (unsigned char const*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static char const* file_name(char const* path)
+{
+	char const* name = path;
+	for (char const* c = path; *c != '\0'; c++)
+	{
+		if (*c == '/' || *c == '\\')
+		{
+			name = c + 1;
+		}
+	}
+	return name;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		printf("Usage: shader_pack output.crsp shader.spv...\n");
+		return 1;
+	}
+
+	unsigned int entryCount = (unsigned int)(argc - 2);
+	if (entryCount > max_shader_count)
+	{
+		printf("Too many shaders, at most %u are supported.\n", max_shader_count);
+		return 1;
+	}
+
+	static crang_shader_pack_entry_t entries[max_shader_count];
+	static void* blobs[max_shader_count];
+	unsigned int offset = (unsigned int)(sizeof(crang_shader_pack_header_t) + sizeof(crang_shader_pack_entry_t) * entryCount);
+	unsigned int uniqueCount = 0;
+	unsigned int uniqueEntries[max_shader_count];
+
+	for (unsigned int i = 0; i < entryCount; i++)
+	{
+		char const* path = argv[i + 2];
+		char const* name = file_name(path);
+		if (strlen(name) >= crang_shader_pack_max_name_size)
+		{
+			printf("%s: name is too long.\n", path);
+			return 1;
+		}
+
+		FILE* file = fopen(path, "rb");
+		if (file == NULL)
+		{
+			printf("%s: can't be opened.\n", path);
+			return 1;
+		}
+
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		blobs[i] = malloc(size > 0 ? (size_t)size : 1);
+		bool read = size > 0 && fread(blobs[i], (size_t)size, 1, file) == 1;
+		fclose(file);
+		if (!read || size % 4 != 0)
+		{
+			printf("%s: isn't SPIR-V.\n", path);
+			return 1;
+		}
+
+		strcpy(entries[i].name, name);
+		entries[i].hash = hash_fnv1a(blobs[i], (size_t)size);
+		entries[i].size = (unsigned int)size;
+
+		// Blobs are all multiples of 4 bytes, offsets stay aligned.
+		bool duplicate = false;
+		for (unsigned int j = 0; j < uniqueCount && !duplicate; j++)
+		{
+			crang_shader_pack_entry_t* unique = &entries[uniqueEntries[j]];
+			if (unique->hash == entries[i].hash && unique->size == entries[i].size && memcmp(blobs[uniqueEntries[j]], blobs[i], entries[i].size) == 0)
+			{
+				entries[i].offset = unique->offset;
+				duplicate = true;
+			}
+		}
+
+		if (!duplicate)
+		{
+			entries[i].offset = offset;
+			offset += entries[i].size;
+			uniqueEntries[uniqueCount++] = i;
+		}
+	}
+
+	// Written next to the output and renamed over it, readers never see a partial pack.
+	char tempPath[1024];
+	snprintf(tempPath, sizeof(tempPath), "%s.tmp", argv[1]);
+	FILE* output = fopen(tempPath, "wb");
+	if (output == NULL)
+	{
+		printf("%s: can't be created.\n", tempPath);
+		return 1;
+	}
+
+	crang_shader_pack_header_t header =
+	{
+		.magic = crang_shader_pack_magic,
+		.version = crang_shader_pack_version,
+		.entryCount = entryCount
+	};
+
+	bool written = fwrite(&header, sizeof(header), 1, output) == 1;
+	written = written && fwrite(entries, sizeof(crang_shader_pack_entry_t), entryCount, output) == entryCount;
+	for (unsigned int i = 0; i < uniqueCount && written; i++)
+	{
+		written = fwrite(blobs[uniqueEntries[i]], entries[uniqueEntries[i]].size, 1, output) == 1;
+	}
+	written = fclose(output) == 0 && written;
+
+	if (written)
+	{
+#ifdef _WIN32
+		// rename refuses to replace an existing file on Windows.
+		written = MoveFileExA(tempPath, argv[1], MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		written = rename(tempPath, argv[1]) == 0;
+#endif // _WIN32
+	}
+
+	if (!written)
+	{
+		printf("%s: couldn't be written.\n", argv[1]);
+		remove(tempPath);
+		return 1;
+	}
+
+	printf("Packed %u shaders (%u unique) into %s, %u bytes.\n", entryCount, uniqueCount, argv[1], offset);
+	for (unsigned int i = 0; i < entryCount; i++)
+	{
+		free(blobs[i]);
+	}
+	return 0;
+}
@@ -1,6 +1,8 @@
 #ifndef __CRANBERRY_GFX_BACKEND
 #define __CRANBERRY_GFX_BACKEND
 
+#include <stdbool.h>
+
 // Assumption log:
 // - Someone is not going to bind a graphics device with an incompatible surface. That's alright for my use case where I will most likely only have
 //   one device.
@@ -9,12 +11,16 @@ typedef struct _crang_ctx_t crang_ctx_t;
 typedef struct _crang_graphics_device_t crang_graphics_device_t;
 typedef struct _crang_surface_t crang_surface_t;
 typedef struct _crang_present_t crang_present_t;
+typedef struct _crang_graph_t crang_graph_t;
 
 typedef struct { unsigned int id; } crang_shader_id_t;
+// Buffer and shader input ids are generational, once destroyed an id stays invalid even after its slot is reused.
 typedef struct { unsigned int id; } crang_buffer_id_t;
 typedef struct { unsigned int id; } crang_pipeline_id_t;
 typedef struct { unsigned int id; } crang_recording_buffer_id_t;
 typedef struct { unsigned int id; } crang_shader_input_id_t;
+typedef struct { unsigned int id; } crang_graph_pass_id_t;
+typedef struct { unsigned int id; } crang_graph_resource_id_t;
 
 typedef enum
 {
@@ -42,6 +48,7 @@ typedef enum
 {
 	crang_shader_vertex,
 	crang_shader_fragment,
+	crang_shader_compute,
 	crang_shader_max
 } crang_shader_e;
 
@@ -50,14 +57,94 @@ typedef enum
 	crang_buffer_vertex,
 	crang_buffer_index,
 	crang_buffer_shader_input,
+	crang_buffer_storage, // Storage buffers can also be used as indirect arguments since they're usually written by compute.
 	crang_buffer_max
 } crang_buffer_e;
 
+// Push constant ranges must fit in 128 bytes, the minimum guaranteed by Vulkan. Each stage can appear in only one range of a pipeline.
+typedef struct
+{
+	crang_shader_e stage;
+	unsigned int offset;
+	unsigned int size;
+} crang_push_constant_range_t;
+
+// Sets the shader's layout(constant_id = constantId) constants from data[offset, offset + size).
+typedef struct
+{
+	unsigned int constantId;
+	unsigned int offset;
+	unsigned int size;
+} crang_specialization_constant_t;
+
+// Up to 8 constants in up to 64 bytes of data per stage, pipelines that only differ in their constants are still distinct pipelines.
+typedef struct
+{
+	crang_specialization_constant_t* constants;
+	unsigned int count;
+	void* data;
+	unsigned int dataSize;
+} crang_specialization_t;
+
+// Depth requires a depth attachment, see crang_present_desc_t.depth and crang_image_format_d32.
+typedef enum
+{
+	crang_depth_mode_none,
+	crang_depth_mode_test_write, // Less or equal
+	// Position only, the fragment shader is ignored and colors aren't written.
+	// Meant to be drawn first, see crang_render_desc_t.depthPrepass, and followed by crang_depth_mode_equal pipelines.
+	crang_depth_mode_prepass,
+	crang_depth_mode_equal, // Only shades the fragments that survived the prepass, doesn't write depth.
+} crang_depth_mode_e;
+
+typedef enum
+{
+	crang_cull_mode_back,
+	crang_cull_mode_front,
+	crang_cull_mode_none,
+	crang_cull_mode_max
+} crang_cull_mode_e;
+
+typedef enum
+{
+	crang_front_face_counter_clockwise,
+	crang_front_face_clockwise,
+	crang_front_face_max
+} crang_front_face_e;
+
+// Dynamic topologies must stay in the same class as the pipeline's (triangles, lines or points).
+typedef enum
+{
+	crang_topology_triangle_list,
+	crang_topology_triangle_strip,
+	crang_topology_line_list,
+	crang_topology_line_strip,
+	crang_topology_point_list,
+	crang_topology_max
+} crang_topology_e;
+
+typedef enum
+{
+	crang_compare_less_or_equal,
+	crang_compare_less,
+	crang_compare_equal,
+	crang_compare_greater_or_equal,
+	crang_compare_greater,
+	crang_compare_always,
+	crang_compare_never,
+	crang_compare_max
+} crang_compare_e;
+
 typedef struct
 {
 	crang_present_t* presentCtx;
+	// When set, the pipeline renders in a raster pass of a compiled graph instead of the present's render pass.
+	crang_graph_t* graph;
+	crang_graph_pass_id_t graphPass;
 
 	crang_shader_id_t shaders[crang_shader_max];
+	// Indexed like shaders, lets the driver fold feature toggles and loop counts into each variant.
+	crang_specialization_t specializations[crang_shader_max];
 
 	struct
 	{
@@ -71,15 +158,192 @@ typedef struct
 		unsigned int count;
 	} vertexAttributes;
 
+	struct
+	{
+		crang_push_constant_range_t* ranges;
+		unsigned int count;
+	} pushConstants;
+
+	crang_depth_mode_e depthMode;
+	crang_cull_mode_e cullMode;
+	crang_front_face_e frontFace;
+	crang_topology_e topology;
+
+	// Cull mode, front face, topology and depth test/write/compare can then be changed with the crang_cmd_set_* commands
+	// instead of creating a pipeline per combination, see crang_extended_dynamic_state_supported.
+	// Binding the pipeline resets them to the values above.
+	bool dynamicState;
+
+	// Adds the bindless set after the shader sets (set 2, set 1 for prepass pipelines), see crang_bindless_supported.
+	bool bindless;
+
+	// Only used by crang_create_pipeline_async, bound in its place while it compiles.
+	// It must use the same shader inputs and push constants, a fallback that doesn't is rejected.
+	// Without one, binding a pipeline that's still compiling waits for it.
+	bool hasFallback;
+	crang_pipeline_id_t fallback;
 } crang_pipeline_desc_t;
 
+typedef struct
+{
+	crang_shader_id_t shader;
+	crang_specialization_t specialization;
+
+	struct
+	{
+		crang_push_constant_range_t* ranges;
+		unsigned int count;
+	} pushConstants;
+
+	// Adds the bindless set after the shader set (set 1), see crang_bindless_supported.
+	bool bindless;
+} crang_compute_pipeline_desc_t;
+
+typedef enum
+{
+	crang_present_mode_fifo, // Always supported, vsynced
+	crang_present_mode_fifo_relaxed, // Vsynced unless the frame is late, tears instead of waiting for the next vblank.
+	crang_present_mode_mailbox, // Vsynced, newer frames replace the queued one.
+	crang_present_mode_immediate, // No vsync, meant for benchmarking.
+	crang_present_mode_max
+} crang_present_mode_e;
+
+// Zero means the default of 2 for either count.
+// More frames in flight trades latency for throughput, the swapchain might also allocate more images than requested.
+typedef struct
+{
+	unsigned int framesInFlight;
+	unsigned int swapchainImageCount;
+	// Adds a depth buffer to the present's render pass, cleared to 1 every frame.
+	bool depth;
+
+	// The first supported mode is used, FIFO if none are. Leaving it empty prefers mailbox.
+	struct
+	{
+		crang_present_mode_e* modes;
+		unsigned int count;
+	} presentModes;
+
+	// When not zero, crang_render sleeps so that frames start just in time to be presented every targetFrameMs.
+	float targetFrameMs;
+
+	// Renders to offscreen rgba8 images instead of a swapchain, the surface passed to crang_create_present is ignored.
+	// The graphics device should then be created without a surface.
+	struct
+	{
+		bool enabled;
+		unsigned int width;
+		unsigned int height;
+		// Copies every frame to host memory, see crang_present_read_frame.
+		bool readback;
+	} headless;
+} crang_present_desc_t;
+
+// Latency is measured from the start of crang_render to when its frame is seen completed on the GPU,
+// it's only checked once per crang_render call and is therefore an upper bound.
+typedef struct
+{
+	float lastLatencyMs;
+	float averageLatencyMs;
+	unsigned int framesInFlight;
+	unsigned int swapchainImageCount;
+	crang_present_mode_e presentMode;
+	// Current size of the present's images, buffers recorded at another size should be re-recorded.
+	unsigned int width;
+	unsigned int height;
+} crang_present_stats_t;
+
+// Timestamps in crang_time_ms, stamp input events with it to measure input to photon latency.
+// cpuStartMs is taken after frame pacing's sleep, gpuDoneMs is when crang_render first saw the frame's timeline value reached and is an upper bound.
+typedef struct
+{
+	unsigned long long frame;
+	double cpuStartMs;
+	double submitMs;
+	double presentMs;
+	double gpuDoneMs;
+} crang_frame_timing_t;
+
+// Render graph
+// Passes declare the resources they read and write, compiling the graph orders the passes by their dependencies,
+// culls the passes that don't contribute to an output, creates the render passes and the barriers between passes
+// and lets transient attachments whose lifetimes don't overlap share memory.
+// A compiled graph is executed by crang_render before the present's render pass, which can sample the graph's outputs.
+typedef enum
+{
+	crang_image_format_rgba8,
+	crang_image_format_rgba16f,
+	crang_image_format_d32,
+	crang_image_format_max
+} crang_image_format_e;
+
+typedef struct
+{
+	crang_image_format_e format;
+	// Zero uses the present's extents when the graph is compiled.
+	unsigned int width;
+	unsigned int height;
+} crang_graph_attachment_desc_t;
+
+typedef enum
+{
+	crang_graph_pass_raster,
+	crang_graph_pass_compute,
+} crang_graph_pass_type_e;
+
+typedef enum
+{
+	crang_graph_access_attachment, // Written as a color or depth attachment of a raster pass
+	crang_graph_access_sampled, // Attachment sampled in a shader
+	crang_graph_access_storage_read,
+	crang_graph_access_storage_write,
+	crang_graph_access_indirect,
+	crang_graph_access_vertex, // Vertex or index input
+	crang_graph_access_max
+} crang_graph_access_e;
+
+typedef struct
+{
+	crang_graph_resource_id_t resource;
+	crang_graph_access_e access;
+} crang_graph_resource_use_t;
+
+typedef struct
+{
+	crang_graph_pass_type_e type;
+
+	struct
+	{
+		crang_graph_resource_use_t* uses;
+		unsigned int count;
+	} reads;
+
+	struct
+	{
+		crang_graph_resource_use_t* uses;
+		unsigned int count;
+	} writes;
+
+	// Used when the pass is the first to write an attachment
+	float clearColor[4];
+	float clearDepth;
+} crang_graph_pass_desc_t;
+
 typedef struct
 {
 	crang_graphics_device_t* graphicsDevice;
 	crang_present_t* presentCtx;
 	crang_surface_t* surface;
+	crang_graph_t* graph; // Optional, compiled graph executed before the present's render pass
 	float clearColor[3];
 
+	// Executed before the recorded buffers in the same render pass, meant for crang_depth_mode_prepass pipelines.
+	struct
+	{
+		crang_recording_buffer_id_t* buffers;
+		unsigned int count;
+	} depthPrepass;
+
 	struct
 	{
 		crang_recording_buffer_id_t* buffers;
@@ -100,6 +364,22 @@ typedef enum
 	crang_cmd_bind_to_shader_input,
 	crang_cmd_bind_shader_input,
 	crang_cmd_draw_indexed,
+	crang_cmd_dispatch,
+	crang_cmd_dispatch_indirect,
+	crang_cmd_draw_indexed_indirect,
+	crang_cmd_cull,
+	crang_cmd_copy_from_buffer,
+	crang_cmd_push_constants,
+	crang_cmd_bind_bindless,
+	crang_cmd_update_shader_input,
+	crang_cmd_bind_graph_attachment,
+	crang_cmd_set_viewport,
+	crang_cmd_set_cull_mode,
+	crang_cmd_set_front_face,
+	crang_cmd_set_topology,
+	crang_cmd_set_depth_state,
+	crang_cmd_destroy_buffer,
+	crang_cmd_destroy_shader_input,
 } crang_cmd_e;
 
 typedef struct
@@ -112,6 +392,11 @@ typedef struct
 typedef enum
 {
 	crang_shader_input_type_uniform_buffer,
+	crang_shader_input_type_storage_buffer,
+	// The offset is provided when binding the shader input, allowing a single shader input to address many elements of one buffer.
+	crang_shader_input_type_uniform_buffer_dynamic,
+	// Bound with crang_cmd_bind_graph_attachment
+	crang_shader_input_type_sampled_image,
 } crang_shader_input_type_e;
 
 typedef struct
@@ -131,28 +416,125 @@ typedef struct
 	crang_shader_id_t shaderId;
 	void* source;
 	unsigned int sourceSize;
+	// FNV-1a of the source, computed when left at 0. Shaders with the same source share their module.
+	unsigned long long sourceHash;
 } crang_cmd_create_shader_t;
 
+// Shader packs hold many SPIR-V blobs in one file, built by Source/Tools/shader_pack.c.
+// The header is followed by the table of contents and then the blobs, each 4 byte aligned.
+// Identical blobs are only stored once, their entries share an offset.
+#define crang_shader_pack_magic 0x50535243 // CRSP
+#define crang_shader_pack_version 1
+#define crang_shader_pack_max_name_size 64
+
+typedef struct
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int entryCount;
+	unsigned int reserved;
+} crang_shader_pack_header_t;
+
+typedef struct
+{
+	char name[crang_shader_pack_max_name_size]; // File name of the blob, null terminated
+	unsigned long long hash; // FNV-1a of the blob
+	unsigned int offset; // From the start of the pack
+	unsigned int size;
+} crang_shader_pack_entry_t;
+
+typedef enum
+{
+	crang_shader_input_lifetime_persistent,
+	// Only valid until the same frame in flight comes around again, meant for recordings that are re-recorded every frame.
+	// Allocated for the next frame rendered by the present the commands are recorded with.
+	crang_shader_input_lifetime_frame,
+} crang_shader_input_lifetime_e;
+
 typedef struct
 {
 	crang_shader_id_t shaderId;
 	crang_shader_input_id_t shaderInputId;
 	unsigned int size;
+	crang_shader_input_lifetime_e lifetime;
 } crang_cmd_create_shader_input_t;
 
+// Same rules as crang_cmd_destroy_buffer_t.
 typedef struct
 {
 	crang_shader_input_id_t shaderInputId;
-	unsigned int binding;
+} crang_cmd_destroy_shader_input_t;
 
-	struct
-	{
-		crang_buffer_id_t bufferId;
-		unsigned int offset;
-		unsigned int size;
-	} buffer;
+typedef struct
+{
+	crang_buffer_id_t bufferId;
+	unsigned int offset;
+	unsigned int size;
+} crang_shader_input_buffer_t;
+
+// Writes are batched and flushed before the next command that uses the shader input.
+typedef struct
+{
+	crang_shader_input_id_t shaderInputId;
+	unsigned int binding;
+	crang_shader_input_buffer_t buffer;
 } crang_cmd_bind_to_shader_input_t;
 
+// Samples a graph attachment with a linear sampler, the graph must be compiled.
+typedef struct
+{
+	crang_shader_input_id_t shaderInputId;
+	unsigned int binding;
+	crang_graph_t* graph;
+	crang_graph_resource_id_t attachment;
+} crang_cmd_bind_graph_attachment_t;
+
+// Viewport and scissor are dynamic, recorded buffers start out covering the whole render area they were recorded for.
+// The scissor matches the viewport clamped to the render area, flipped viewports with a negative height are allowed.
+typedef struct
+{
+	float x;
+	float y;
+	float width;
+	float height;
+	float minDepth;
+	float maxDepth;
+} crang_cmd_set_viewport_t;
+
+// Only for pipelines created with dynamicState.
+typedef struct
+{
+	crang_cull_mode_e cullMode;
+} crang_cmd_set_cull_mode_t;
+
+typedef struct
+{
+	crang_front_face_e frontFace;
+} crang_cmd_set_front_face_t;
+
+typedef struct
+{
+	crang_topology_e topology;
+} crang_cmd_set_topology_t;
+
+// Requires a depth attachment when testing or writing.
+typedef struct
+{
+	bool testEnable;
+	bool writeEnable;
+	crang_compare_e compare;
+} crang_cmd_set_depth_state_t;
+
+// Updates every input at once through the shader's update template.
+// Only available for shaders with buffer inputs.
+// One buffer per input, in the order the inputs were declared when creating the shader.
+typedef struct
+{
+	crang_shader_input_id_t shaderInputId;
+	crang_shader_input_buffer_t* buffers;
+	unsigned int count;
+} crang_cmd_update_shader_input_t;
+
 typedef struct
 {
 	crang_buffer_id_t bufferId;
@@ -160,6 +542,13 @@ typedef struct
 	crang_buffer_e type;
 } crang_cmd_create_buffer_t;
 
+// The id is invalid as soon as the command is executed, recordings that still use it must not be submitted again.
+// Destroyed once the frames in flight are done with it, or right away when executing immediately.
+typedef struct
+{
+	crang_buffer_id_t bufferId;
+} crang_cmd_destroy_buffer_t;
+
 typedef struct
 {
 	crang_buffer_id_t bufferId;
@@ -168,6 +557,15 @@ typedef struct
 	unsigned int offset;
 } crang_cmd_copy_to_buffer_t;
 
+// Only valid when executing immediately, data is written once the commands have completed.
+typedef struct
+{
+	crang_buffer_id_t bufferId;
+	void* data;
+	unsigned int size;
+	unsigned int offset;
+} crang_cmd_copy_from_buffer_t;
+
 typedef struct
 {
 	crang_pipeline_id_t pipelineId;
@@ -203,8 +601,33 @@ typedef struct
 {
 	crang_shader_input_id_t shaderInputId;
 	crang_pipeline_id_t pipelineId;
+
+	// One offset per dynamic input, ordered by binding.
+	// Offsets must be multiples of crang_uniform_buffer_alignment.
+	struct
+	{
+		unsigned int* offsets;
+		unsigned int count;
+	} dynamicOffsets;
 } crang_cmd_bind_shader_input_t;
 
+// The data is copied when the command is recorded.
+// The pushed bytes should be covered by ranges that share the same shader stages.
+typedef struct
+{
+	crang_pipeline_id_t pipelineId;
+	void* data;
+	unsigned int offset;
+	unsigned int size;
+} crang_cmd_push_constants_t;
+
+// Binds the bindless set of a pipeline created with bindless enabled.
+// The set only needs to be bound once per recording, buffers created afterwards are visible without rebinding.
+typedef struct
+{
+	crang_pipeline_id_t pipelineId;
+} crang_cmd_bind_bindless_t;
+
 typedef struct
 {
 	unsigned int indexCount;
@@ -213,6 +636,75 @@ typedef struct
 	unsigned int instanceCount;
 } crang_cmd_draw_indexed_t;
 
+// Matches VkDrawIndexedIndirectCommand
+typedef struct
+{
+	unsigned int indexCount;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int vertexOffset;
+	unsigned int firstInstance;
+} crang_draw_indexed_indirect_t;
+
+typedef struct
+{
+	crang_buffer_id_t bufferId;
+	unsigned int offset;
+	unsigned int drawCount; // Stride is sizeof(crang_draw_indexed_indirect_t), issued as single draws without multiDrawIndirect
+} crang_cmd_draw_indexed_indirect_t;
+
+typedef struct
+{
+	unsigned int groupCountX;
+	unsigned int groupCountY;
+	unsigned int groupCountZ;
+} crang_cmd_dispatch_t;
+
+typedef struct
+{
+	crang_buffer_id_t bufferId;
+	unsigned int offset;
+} crang_cmd_dispatch_indirect_t;
+
+// Culling
+// Instances are bounding spheres assigned to a draw group, one draw group per pipeline.
+// Every visible instance is appended to its draw group's region of the visible instance buffer starting at the group's firstInstance,
+// and the group's instanceCount is incremented. Shaders find their instance with visibleInstances[gl_InstanceIndex].
+// Culling uses Shaders/GLSL/cull.comp, its shader inputs are:
+// binding 0: uniform buffer, crang_cull_camera_t
+// binding 1: storage buffer, crang_cull_instance_t[]
+// binding 2: storage buffer, crang_draw_indexed_indirect_t[] one per draw group
+// binding 3: storage buffer, unsigned int[] visible instance indices
+
+// Matches instance_t in cull.comp (std430)
+typedef struct
+{
+	float center[3];
+	float radius;
+	unsigned int drawGroup;
+	unsigned int padding[3];
+} crang_cull_instance_t;
+
+// Matches camera_t in cull.comp (std140)
+typedef struct
+{
+	float frustumPlanes[6][4];
+	unsigned int instanceCount;
+	unsigned int padding[3];
+} crang_cull_camera_t;
+
+// Resets the draw arguments from the template buffer and culls the instances into them.
+// The template's instanceCount should be 0 and its firstInstance should leave room for every instance in the draw group.
+typedef struct
+{
+	crang_pipeline_id_t pipelineId;
+	crang_shader_input_id_t shaderInputId;
+	crang_buffer_id_t drawArgsBuffer;
+	crang_buffer_id_t drawArgsTemplateBuffer;
+	unsigned int drawGroupCount;
+	unsigned int instanceCount;
+} crang_cmd_cull_t;
+
 typedef void(*crang_callback_t)(void* data);
 typedef struct
 {
@@ -220,39 +712,139 @@ typedef struct
 	void* data;
 } crang_cmd_callback_t;
 
+// How much the device can hold at once, its tables are sized from these and live in the device's buffer.
+// Zeros pick the defaults, a NULL description picks all of them.
+typedef struct
+{
+	unsigned int shaderCount;
+	unsigned int shaderInputCount;
+	// Also the size of the bindless buffer array, clamped to the device's limit on update after bind storage buffers.
+	// Storage buffers in slots past it aren't visible to bindless shaders.
+	unsigned int bufferCount;
+	unsigned int pipelineCount;
+	unsigned int pipelineLayoutCount;
+	unsigned int recordingBufferCount;
+	unsigned int memoryBlockCount;
+	// Bytes of shader source kept to compare modules against, zero defaults to 16KB per shader.
+	unsigned int shaderSourceSize;
+
+	// Descriptors of each type shared by every shader input, zeros default to one per shader input.
+	unsigned int uniformBufferCount;
+	unsigned int storageBufferCount;
+	unsigned int dynamicUniformBufferCount;
+	unsigned int imageSamplerCount;
+} crang_device_capacities_t;
+
 unsigned int crang_ctx_size(void);
 // buffer must be at least the size returned by crang_ctx_size
 crang_ctx_t* crang_create_ctx(void* buffer);
 void crang_destroy_ctx(crang_ctx_t* ctx);
 
+#ifdef _WIN32
 unsigned int crang_win32_surface_size(void);
 // buffer must be at least the size returned by crang_win32_surface_size
 crang_surface_t* crang_win32_create_surface(void* buffer, crang_ctx_t* ctx, void* hinstance, void* window);
 void crang_win32_destroy_surface(crang_ctx_t* ctx, crang_surface_t* surface);
+#endif // _WIN32
 
-unsigned int crang_graphics_device_size(void);
-// buffer must be at least the size returned by crang_graphics_device_size
-crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t* ctx, crang_surface_t* surface);
+unsigned int crang_graphics_device_size(crang_device_capacities_t const* capacities);
+// buffer must be at least the size returned by crang_graphics_device_size for the same capacities
+// Returns NULL when no device has graphics and present queues, supports Vulkan 1.1 and VK_KHR_timeline_semaphore.
+crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t* ctx, crang_surface_t* surface, crang_device_capacities_t const* capacities);
 void crang_destroy_graphics_device(crang_ctx_t* ctx, crang_graphics_device_t* device);
 
+// Pipeline cache blobs are stamped with the device's vendor, device, driver and cache UUID and checksummed.
+// Load before creating pipelines; a blob from another device or driver, or a corrupted one, is rejected and false is returned.
+bool crang_load_pipeline_cache(crang_graphics_device_t* device, void const* data, unsigned int size);
+// Upper bound of the bytes crang_save_pipeline_cache writes, creating pipelines in between grows it.
+unsigned int crang_pipeline_cache_size(crang_graphics_device_t* device);
+// Returns the bytes written, 0 if size was too small. Write it out to a temporary file and rename it over the old one
+// so that a crash never leaves a torn cache behind.
+unsigned int crang_save_pipeline_cache(crang_graphics_device_t* device, void* data, unsigned int size);
+
+// Alignment required for the offsets of dynamic uniform buffers.
+unsigned int crang_uniform_buffer_alignment(crang_graphics_device_t* device);
+
+// Bindless mode is available when the device supports VK_EXT_descriptor_indexing.
+// Storage buffers are then also written to one large update after bind set, binding 0 is an array of storage buffers
+// indexed by crang_bindless_index, shaders declare it as: layout(set = N, binding = 0) buffer b { ... } buffers[];
+bool crang_bindless_supported(crang_graphics_device_t* device);
+// The slot of the buffer in the bindless array, slots are reused once their buffer is destroyed.
+unsigned int crang_bindless_index(crang_buffer_id_t bufferId);
+
+// Dynamic pipeline state is available when the device supports VK_EXT_extended_dynamic_state.
+bool crang_extended_dynamic_state_supported(crang_graphics_device_t* device);
+
+// Every submission signals the device's timeline with the next value, values complete in submission order.
+// Waiting on the submitted value waits on everything submitted so far.
+unsigned long long crang_get_submitted_value(crang_graphics_device_t* device);
+unsigned long long crang_get_completed_value(crang_graphics_device_t* device);
+void crang_wait_value(crang_graphics_device_t* device, unsigned long long value);
+
 unsigned int crang_present_size(void);
 // buffer must be at least the size returned by crang_present_ctx_size
-crang_present_t* crang_create_present(void* buffer, crang_graphics_device_t* device, crang_surface_t* surface);
+crang_present_t* crang_create_present(void* buffer, crang_graphics_device_t* device, crang_surface_t* surface, crang_present_desc_t* presentDesc);
 void crang_destroy_present(crang_graphics_device_t* device, crang_present_t* presentCtx);
-
+void crang_present_stats(crang_present_t* presentCtx, crang_present_stats_t* stats);
+// Copies the timings of the frames that completed since the last call, oldest first. Returns how many were copied.
+// Only the most recent ones are kept if it isn't called often enough.
+unsigned int crang_present_pop_frame_timings(crang_present_t* presentCtx, crang_frame_timing_t* timings, unsigned int maxCount);
+// Monotonic clock used by the frame timings.
+double crang_time_ms(void);
+// Headless presents with readback only. Waits for the last rendered frame and copies it to data as tightly packed rgba8 rows.
+// Returns false if nothing was rendered yet.
+bool crang_present_read_frame(crang_graphics_device_t* device, crang_present_t* presentCtx, void* data);
+
+unsigned int crang_graph_size(void);
+// buffer must be at least the size returned by crang_graph_size
+crang_graph_t* crang_create_graph(void* buffer, crang_present_t* present);
+void crang_destroy_graph(crang_graphics_device_t* device, crang_graph_t* graph);
+crang_graph_resource_id_t crang_graph_add_attachment(crang_graph_t* graph, crang_graph_attachment_desc_t* attachmentDesc);
+crang_graph_resource_id_t crang_graph_import_buffer(crang_graph_t* graph, crang_buffer_id_t buffer);
+crang_graph_pass_id_t crang_graph_add_pass(crang_graph_t* graph, crang_graph_pass_desc_t* passDesc);
+// Outputs are kept alive and made visible to the present's render pass.
+void crang_graph_mark_output(crang_graph_t* graph, crang_graph_resource_id_t resource);
+// Passes and resources can't be added once compiled.
+void crang_compile_graph(crang_graphics_device_t* device, crang_graph_t* graph);
+bool crang_graph_pass_culled(crang_graph_t* graph, crang_graph_pass_id_t pass);
+
+// Requesting a pipeline identical to an existing one returns the existing ID, pipelines with the same shader inputs
+// and push constants also share their layout.
 crang_pipeline_id_t crang_create_pipeline(crang_graphics_device_t* device, crang_pipeline_desc_t* pipelineDesc);
+// Returns immediately, the pipeline compiles on a pool of worker threads sharing the pipeline cache.
+// The desc's present, graph and shaders must outlive the compilation. Binds are resolved when recording,
+// re-record the commands once crang_pipeline_ready returns true to switch from the fallback.
+crang_pipeline_id_t crang_create_pipeline_async(crang_graphics_device_t* device, crang_pipeline_desc_t* pipelineDesc);
+bool crang_pipeline_ready(crang_graphics_device_t* device, crang_pipeline_id_t pipelineId);
+// Waits for every pipeline compiling asynchronously, before saving the pipeline cache for example.
+void crang_wait_pipelines(crang_graphics_device_t* device);
+crang_pipeline_id_t crang_create_compute_pipeline(crang_graphics_device_t* device, crang_compute_pipeline_desc_t* pipelineDesc);
 
 crang_shader_id_t crang_request_shader_id(crang_graphics_device_t* device, crang_shader_e type);
 crang_shader_input_id_t crang_request_shader_input_id(crang_graphics_device_t* device);
 crang_buffer_id_t crang_request_buffer_id(crang_graphics_device_t* device);
 crang_recording_buffer_id_t crang_request_recording_buffer_id(crang_graphics_device_t* device);
 
+// Matrices are row major, laid out like the camera uniforms.
+void crang_cull_build_camera(float const viewMatrix[16], float const projectionMatrix[16], unsigned int instanceCount, crang_cull_camera_t* cullCamera);
+// CPU reference for crang_cmd_cull. drawArgs should be a copy of the template, visibleInstances is sized like the GPU buffer.
+void crang_cull_instances_cpu(crang_cull_camera_t const* cullCamera, crang_cull_instance_t const* instances, crang_draw_indexed_indirect_t* drawArgs, unsigned int drawGroupCount, unsigned int* visibleInstances);
+
+// Points createShader's source at the named blob of a shader pack and fills in its hash, returns false if it isn't there.
+// The pack is read in place, map the file and keep it mapped until the shader has been created.
+bool crang_shader_pack_find(void const* pack, unsigned int packSize, char const* name, crang_cmd_create_shader_t* createShader);
+
 // Execute a command stream immediately. Blocking call!
 void crang_execute_commands_immediate(crang_graphics_device_t* device, crang_cmd_buffer_t* cmdBuffer);
 
 // Record a command stream, some commands might be executed in the process such as callbacks.
 // Allows you to provide recorded commands to rendering.
+// Commands that can't live in a render pass (dispatches, copies) are recorded separately and executed before the render pass,
+// a barrier between the compute work and the graphics work is inserted automatically.
 void crang_record_commands(crang_graphics_device_t* device, crang_present_t* present, crang_recording_buffer_id_t recordingBuffer, crang_cmd_buffer_t* cmdBuffer);
+// Record the commands of a graph pass, raster passes can't dispatch and compute passes can't draw.
+// Culled passes can be recorded but won't be executed.
+void crang_graph_record_pass(crang_graphics_device_t* device, crang_graph_t* graph, crang_graph_pass_id_t pass, crang_cmd_buffer_t* cmdBuffer);
 void crang_render(crang_render_desc_t* renderDesc);
 
 #endif // __CRANBERRY_BACKEND_GFX
@@ -261,12 +853,23 @@ void crang_render(crang_render_desc_t* renderDesc);
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#define VK_USE_PLATFORM_WIN32_KHR
+#define cranvk_debug_break() __debugbreak()
+#else
+#include <threads.h>
+#include <unistd.h>
+#define cranvk_debug_break() __builtin_trap()
+#endif // _WIN32
 
 #define VK_PROTOTYPES
-#define VK_USE_PLATFORM_WIN32_KHR
 #include <vulkan/vulkan.h>
 
 #define cranvk_debug_enabled
@@ -279,7 +882,7 @@ void crang_render(crang_render_desc_t* renderDesc);
 	{ \
 		if(VK_SUCCESS != (call)) \
 		{ \
-			__debugbreak(); \
+			cranvk_debug_break(); \
 		} \
 	} while(0)
 
@@ -288,14 +891,14 @@ void crang_render(crang_render_desc_t* renderDesc);
 	{ \
 		if (!(call)) \
 		{ \
-			__debugbreak(); \
+			cranvk_debug_break(); \
 		} \
 	} while (0)
 
 #define cranvk_error() \
 	do \
 	{ \
-		__debugbreak(); \
+		cranvk_debug_break(); \
 	} while(0)
 #else
 #define cranvk_check(call) call
@@ -305,53 +908,238 @@ void crang_render(crang_render_desc_t* renderDesc);
 
 #define cranvk_unused(a) (void)a
 
-// Allocator
-
-#define cranvk_max_allocator_pools 10
-#define cranvk_max_memory_blocks 1000
-#define cranvk_allocator_pool_size (1024 * 1024)
+uint64_t cranvk_hash(uint64_t hash, void const* data, size_t size)
+{
+	// FNV-1a
+	uint8_t const* bytes = (uint8_t const*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+#define cranvk_hash_seed 14695981039346656037ull
 
-typedef struct
+double cranvk_time_ms(void)
 {
-	VkDeviceSize size;
-	VkDeviceSize offset;
-	uint32_t id;
-	uint32_t nextIndex;
-	bool allocated;
-} cranvk_memory_block_t;
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+#endif // _WIN32
+}
 
-typedef struct
+// OS sleeps overshoot, sleep coarsely until close to the deadline then spin the rest.
+void cranvk_sleep_until_ms(double deadlineMs)
 {
-	VkDeviceMemory memory;
-	VkDeviceSize size;
-	uint32_t headIndex;
-	uint32_t nextId;
-	uint32_t memoryType;
-} cranvk_memory_pool_t;
+	double const spinMs = 1.5;
+	double remainingMs = deadlineMs - cranvk_time_ms();
+	if (remainingMs > spinMs)
+	{
+		double sleepMs = remainingMs - spinMs;
+#ifdef _WIN32
+		Sleep((DWORD)sleepMs);
+#else
+		struct timespec duration = { .tv_sec = (time_t)(sleepMs / 1000.0), .tv_nsec = (long)(fmod(sleepMs, 1000.0) * 1000000.0) };
+		thrd_sleep(&duration, NULL);
+#endif // _WIN32
+	}
 
-typedef struct
+	while (cranvk_time_ms() < deadlineMs)
+	{
+	}
+}
+
+// Threading
+#ifdef _WIN32
+typedef HANDLE cranvk_thread_t;
+typedef CRITICAL_SECTION cranvk_mutex_t;
+typedef CONDITION_VARIABLE cranvk_condition_t;
+#define cranvk_thread_entry(name) DWORD WINAPI name(LPVOID data)
+
+void cranvk_mutex_init(cranvk_mutex_t* mutex)
 {
-	VkDeviceMemory memory;
-	VkDeviceSize offset;
-	uint32_t id;
-	uint32_t poolIndex;
-} cranvk_allocation_t;
+	InitializeCriticalSection(mutex);
+}
 
-typedef struct
+void cranvk_mutex_destroy(cranvk_mutex_t* mutex)
 {
-	cranvk_memory_pool_t memoryPools[cranvk_max_allocator_pools];
-	cranvk_memory_block_t blockPool[cranvk_max_memory_blocks];
-	uint32_t freeBlocks[cranvk_max_memory_blocks];
-	uint32_t freeBlockCount;
-} cranvk_allocator_t;
+	DeleteCriticalSection(mutex);
+}
 
-uint32_t cranvk_find_memory_index(VkPhysicalDevice physicalDevice, uint32_t typeBits, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferedFlags)
+void cranvk_mutex_lock(cranvk_mutex_t* mutex)
 {
-	uint32_t preferedMemoryIndex = UINT32_MAX;
-	VkPhysicalDeviceMemoryProperties physicalDeviceProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &physicalDeviceProperties);
+	EnterCriticalSection(mutex);
+}
 
-	VkMemoryType* types = physicalDeviceProperties.memoryTypes;
+void cranvk_mutex_unlock(cranvk_mutex_t* mutex)
+{
+	LeaveCriticalSection(mutex);
+}
+
+void cranvk_condition_init(cranvk_condition_t* condition)
+{
+	InitializeConditionVariable(condition);
+}
+
+void cranvk_condition_destroy(cranvk_condition_t* condition)
+{
+	cranvk_unused(condition);
+}
+
+void cranvk_condition_wait(cranvk_condition_t* condition, cranvk_mutex_t* mutex)
+{
+	SleepConditionVariableCS(condition, mutex, INFINITE);
+}
+
+void cranvk_condition_broadcast(cranvk_condition_t* condition)
+{
+	WakeAllConditionVariable(condition);
+}
+
+void cranvk_thread_create(cranvk_thread_t* thread, LPTHREAD_START_ROUTINE entry, void* data)
+{
+	*thread = CreateThread(NULL, 0, entry, data, 0, NULL);
+	cranvk_assert(*thread != NULL);
+}
+
+void cranvk_thread_join(cranvk_thread_t thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+uint32_t cranvk_processor_count(void)
+{
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return systemInfo.dwNumberOfProcessors;
+}
+#else
+typedef thrd_t cranvk_thread_t;
+typedef mtx_t cranvk_mutex_t;
+typedef cnd_t cranvk_condition_t;
+#define cranvk_thread_entry(name) int name(void* data)
+
+void cranvk_mutex_init(cranvk_mutex_t* mutex)
+{
+	int result = mtx_init(mutex, mtx_plain);
+	cranvk_assert(result == thrd_success);
+	cranvk_unused(result);
+}
+
+void cranvk_mutex_destroy(cranvk_mutex_t* mutex)
+{
+	mtx_destroy(mutex);
+}
+
+void cranvk_mutex_lock(cranvk_mutex_t* mutex)
+{
+	mtx_lock(mutex);
+}
+
+void cranvk_mutex_unlock(cranvk_mutex_t* mutex)
+{
+	mtx_unlock(mutex);
+}
+
+void cranvk_condition_init(cranvk_condition_t* condition)
+{
+	int result = cnd_init(condition);
+	cranvk_assert(result == thrd_success);
+	cranvk_unused(result);
+}
+
+void cranvk_condition_destroy(cranvk_condition_t* condition)
+{
+	cnd_destroy(condition);
+}
+
+void cranvk_condition_wait(cranvk_condition_t* condition, cranvk_mutex_t* mutex)
+{
+	cnd_wait(condition, mutex);
+}
+
+void cranvk_condition_broadcast(cranvk_condition_t* condition)
+{
+	cnd_broadcast(condition);
+}
+
+void cranvk_thread_create(cranvk_thread_t* thread, thrd_start_t entry, void* data)
+{
+	int result = thrd_create(thread, entry, data);
+	cranvk_assert(result == thrd_success);
+	cranvk_unused(result);
+}
+
+void cranvk_thread_join(cranvk_thread_t thread)
+{
+	thrd_join(thread, NULL);
+}
+
+uint32_t cranvk_processor_count(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+}
+#endif // _WIN32
+
+// Allocator
+
+#define cranvk_max_allocator_pools 10
+#define cranvk_default_memory_block_count 1000
+#define cranvk_allocator_pool_size (1024 * 1024)
+
+typedef struct
+{
+	VkDeviceSize size;
+	VkDeviceSize offset;
+	uint32_t id;
+	uint32_t nextIndex;
+	bool allocated;
+} cranvk_memory_block_t;
+
+typedef struct
+{
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	uint32_t headIndex;
+	uint32_t nextId;
+	uint32_t memoryType;
+} cranvk_memory_pool_t;
+
+typedef struct
+{
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	uint32_t id;
+	uint32_t poolIndex;
+} cranvk_allocation_t;
+
+typedef struct
+{
+	cranvk_memory_pool_t memoryPools[cranvk_max_allocator_pools];
+	// Sized by the device capacities, blockCount entries each.
+	cranvk_memory_block_t* blockPool;
+	uint32_t* freeBlocks;
+	uint32_t blockCount;
+	uint32_t freeBlockCount;
+} cranvk_allocator_t;
+
+uint32_t cranvk_find_memory_index(VkPhysicalDevice physicalDevice, uint32_t typeBits, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferedFlags)
+{
+	uint32_t preferedMemoryIndex = UINT32_MAX;
+	VkPhysicalDeviceMemoryProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &physicalDeviceProperties);
+
+	VkMemoryType* types = physicalDeviceProperties.memoryTypes;
 
 	for (uint32_t i = 0; i < physicalDeviceProperties.memoryTypeCount; ++i)
 	{
@@ -377,10 +1165,10 @@ uint32_t cranvk_find_memory_index(VkPhysicalDevice physicalDevice, uint32_t type
 
 void cranvk_create_allocator(cranvk_allocator_t* allocator)
 {
-	memset(allocator->blockPool, 0xFF, sizeof(cranvk_memory_block_t) * cranvk_max_memory_blocks);
+	memset(allocator->blockPool, 0xFF, sizeof(cranvk_memory_block_t) * allocator->blockCount);
 	memset(allocator->memoryPools, 0xFF, sizeof(cranvk_memory_pool_t) * cranvk_max_allocator_pools);
 
-	allocator->freeBlockCount = cranvk_max_memory_blocks;
+	allocator->freeBlockCount = allocator->blockCount;
 	for (uint32_t freeBlockIndex = 0; freeBlockIndex < allocator->freeBlockCount; freeBlockIndex++)
 	{
 		allocator->freeBlocks[freeBlockIndex] = freeBlockIndex;
@@ -612,17 +1400,21 @@ void cranvk_allocator_free(cranvk_allocator_t* allocator, cranvk_allocation_t al
 
 // Main Rendering
 
-// TODO: Reference to Windows, if we want multiplatform we'll have to change this.
-#ifdef cranvk_debug_enabled
-#define cranvk_instance_extension_count 3
-const char* cranvk_instance_extensions[cranvk_instance_extension_count] = { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_EXTENSION_NAME, VK_EXT_DEBUG_REPORT_EXTENSION_NAME };
+// Other platforms only support headless presents for now.
+#ifdef _WIN32
+#define cranvk_platform_extension_count 2
+const char* cranvk_platform_extensions[cranvk_platform_extension_count] = { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_EXTENSION_NAME };
 #else
-#define cranvk_instance_extension_count 2
-const char* cranvk_instance_extensions[cranvk_instance_extension_count] = { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_EXTENSION_NAME };
-#endif // cranvk_debug_enabled
+#define cranvk_platform_extension_count 0
+const char* cranvk_platform_extensions[1] = { NULL };
+#endif // _WIN32
+#define cranvk_max_instance_extension_count (cranvk_platform_extension_count + 1)
+#define cranvk_max_layer_property_count 64
 
 #define cranvk_device_extension_count 1
 const char* cranvk_device_extensions[cranvk_device_extension_count] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+#define cranvk_max_device_extension_count 4
+#define cranvk_max_extension_property_count 512
 
 #ifdef cranvk_debug_enabled
 #define cranvk_validation_count 1
@@ -632,26 +1424,130 @@ const char* cranvk_validation_layers[cranvk_validation_count] = { "VK_LAYER_LUNA
 const char* cranvk_validation_layers[cranvk_validation_count] = {};
 #endif
 
-#define cranvk_render_buffer_count 2
+#define cranvk_max_frames_in_flight 4
+#define cranvk_default_frames_in_flight 2
+#define cranvk_default_swapchain_image_count 2
 #define cranvk_max_physical_device_count 8
 #define cranvk_max_physical_device_property_count 50
 #define cranvk_max_physical_image_count 10
-#define cranvk_max_uniform_buffer_count 1000
-#define cranvk_max_image_sampler_count 1000
-#define cranvk_max_descriptor_set_count 1000
-#define cranvk_max_shader_count 100
-#define cranvk_max_buffer_count 100
+#define cranvk_max_retired_swapchain_count 4
+#define cranvk_max_deferred_destroy_count 256
+#define cranvk_max_frame_timing_count 64
+#define cranvk_no_bindless_set UINT32_MAX
+#define cranvk_max_transient_descriptor_pool_count 8
+#define cranvk_transient_descriptor_set_count 256
+#define cranvk_max_descriptor_writes 64
+#define cranvk_max_tracked_buffer_count 64
+#define cranvk_max_batched_barrier_count 64
+#define cranvk_default_shader_input_count 1000
+#define cranvk_default_shader_count 100
+#define cranvk_default_buffer_count 100
 #define cranvk_max_framebuffer_count 100
 #define cranvk_max_single_use_resource_count 10
-#define cranvk_max_pipeline_count 10
-#define cranvk_max_command_buffer_count 1000
+#define cranvk_max_recorded_destroy_count 16
+#define cranvk_default_pipeline_count 1024
+#define cranvk_default_pipeline_layout_count 256
+#define cranvk_max_pipeline_set_layouts (cranvk_graphics_shader_count + 1) // Shader sets and the bindless set
+#define cranvk_max_pipeline_compile_threads 16
+#define cranvk_default_recording_buffer_count 1000
+#define cranvk_default_shader_source_size_per_shader (16 * 1024)
+#define cranvk_table_alignment 16
 #define cranvk_max_shader_inputs 32
 #define cranvk_max_vertex_inputs 32
 #define cranvk_max_vertex_attributes 32
+#define cranvk_max_push_constant_ranges 4
+#define cranvk_max_push_constant_size 128
+#define cranvk_max_specialization_constants 8
+#define cranvk_max_specialization_data_size 64
+#define cranvk_graphics_shader_count 2
+#define cranvk_cull_group_size 64 // Matches local_size_x in cull.comp
+#define cranvk_max_graph_passes 32
+#define cranvk_max_graph_resources 64
+#define cranvk_max_graph_pass_uses 16
+#define cranvk_max_graph_color_attachments 4
+#define cranvk_max_graph_attachments (cranvk_max_graph_color_attachments + 1)
+#define cranvk_handle_index_bits 20
+#define cranvk_handle_index_mask ((1u << cranvk_handle_index_bits) - 1)
+#define cranvk_handle_generation_mask ((1u << (32 - cranvk_handle_index_bits)) - 1)
+
+// Handles are a slot index in their low bits and the slot's generation in their high bits.
+// Retiring a handle bumps its slot's generation, the slot is only reused once it's freed.
+typedef struct
+{
+	uint32_t* generations;
+	uint32_t* freeSlots;
+	uint32_t freeCount;
+	uint32_t slotCount;
+	uint32_t capacity;
+} cranvk_handle_pool_t;
+
+void cranvk_init_handle_pool(cranvk_handle_pool_t* pool, uint32_t* generations, uint32_t* freeSlots, uint32_t capacity)
+{
+	*pool = (cranvk_handle_pool_t)
+	{
+		.generations = generations,
+		.freeSlots = freeSlots,
+		.capacity = capacity
+	};
+}
+
+uint32_t cranvk_allocate_handle(cranvk_handle_pool_t* pool)
+{
+	uint32_t index;
+	if (pool->freeCount > 0)
+	{
+		index = pool->freeSlots[--pool->freeCount];
+	}
+	else
+	{
+		cranvk_assert(pool->slotCount < pool->capacity);
+		index = pool->slotCount++;
+	}
+
+	return (pool->generations[index] << cranvk_handle_index_bits) | index;
+}
+
+uint32_t cranvk_resolve_handle(cranvk_handle_pool_t const* pool, uint32_t handle)
+{
+	uint32_t index = handle & cranvk_handle_index_mask;
+	cranvk_assert(index < pool->slotCount);
+	cranvk_assert(pool->generations[index] == handle >> cranvk_handle_index_bits); // Stale handle, its resource was destroyed.
+	return index;
+}
+
+uint32_t cranvk_retire_handle(cranvk_handle_pool_t* pool, uint32_t handle)
+{
+	uint32_t index = cranvk_resolve_handle(pool, handle);
+	pool->generations[index] = (pool->generations[index] + 1) & cranvk_handle_generation_mask;
+	return index;
+}
+
+void cranvk_free_handle_slot(cranvk_handle_pool_t* pool, uint32_t index)
+{
+	cranvk_assert(pool->freeCount < pool->capacity);
+	pool->freeSlots[pool->freeCount++] = index;
+}
+
+typedef enum
+{
+	cranvk_deferred_buffer,
+	cranvk_deferred_shader_input,
+} cranvk_deferred_e;
+
+// A destroyed resource that in flight frames might still be using, its slot is freed along with it.
+typedef struct
+{
+	cranvk_deferred_e type;
+	uint32_t index;
+
+	// Submissions up to this timeline value might reference the resource.
+	uint64_t value;
+} cranvk_deferred_destroy_t;
 
 typedef struct
 {
 	VkInstance instance;
+	uint32_t layerCount;
 } cranvk_ctx_t;
 
 typedef struct
@@ -665,8 +1561,121 @@ typedef struct
 	uint32_t bufferCount;
 	cranvk_allocation_t allocations[cranvk_max_single_use_resource_count];
 	uint32_t allocationCount;
+
+	// Destroys recorded by the commands, queued on the device when they're submitted.
+	cranvk_deferred_destroy_t destroys[cranvk_max_recorded_destroy_count];
+	uint32_t destroyCount;
 } cranvk_transient_resources_t;
 
+typedef struct
+{
+	cranvk_allocation_t allocations[cranvk_max_single_use_resource_count];
+	void* datas[cranvk_max_single_use_resource_count];
+	uint32_t sizes[cranvk_max_single_use_resource_count];
+	uint32_t count;
+} cranvk_readbacks_t;
+
+// What a buffer was last used for in an execution context, see cranvk_access_buffer.
+typedef struct
+{
+	VkPipelineStageFlags writeStages;
+	VkAccessFlags writeAccess;
+	VkPipelineStageFlags readStages;
+
+	// Reads in these stages and of these types already wait on the last write.
+	VkPipelineStageFlags visibleStages;
+	VkAccessFlags visibleAccess;
+	// Writes in these stages and of these types already wait on every access above.
+	VkPipelineStageFlags syncedStages;
+	VkAccessFlags syncedAccess;
+} cranvk_buffer_access_t;
+
+typedef struct
+{
+	VkCullModeFlags cullMode;
+	VkFrontFace frontFace;
+	VkPrimitiveTopology topology;
+	VkBool32 depthTestEnable;
+	VkBool32 depthWriteEnable;
+	VkCompareOp depthCompareOp;
+} cranvk_dynamic_state_t;
+
+// The complete state of a pipeline, copied out of its desc so that it can compile later.
+// Also the key pipelines are deduplicated by, it's zeroed before being filled in so it can be hashed and compared as bytes.
+typedef struct
+{
+	VkPipelineBindPoint bindPoint;
+	VkPipelineLayout layout;
+	cranvk_dynamic_state_t state;
+	VkVertexInputBindingDescription inputBindings[cranvk_max_vertex_inputs];
+	uint32_t inputBindingCount;
+	VkVertexInputAttributeDescription inputAttributes[cranvk_max_vertex_attributes];
+	uint32_t inputAttributeCount;
+	VkShaderModule vertexShader;
+	VkShaderModule fragmentShader;
+	VkShaderModule computeShader;
+	// Indexed by crang_shader_e, entry offsets are into the stage's specializationData.
+	VkSpecializationMapEntry specializationEntries[crang_shader_max][cranvk_max_specialization_constants];
+	uint32_t specializationEntryCounts[crang_shader_max];
+	uint8_t specializationData[crang_shader_max][cranvk_max_specialization_data_size];
+	uint32_t specializationDataSizes[crang_shader_max];
+	VkRenderPass renderPass;
+	// Destroyed render passes' handles can be reused, the ID keeps pipelines from matching a new pass that got an old handle.
+	uint32_t renderPassId;
+	uint32_t colorAttachmentCount;
+	bool isPrepass;
+	bool dynamicState;
+} cranvk_pipeline_job_t;
+
+typedef struct
+{
+	VkDescriptorSetLayout setLayouts[cranvk_max_pipeline_set_layouts];
+	uint32_t setLayoutCount;
+	VkPushConstantRange pushConstantRanges[cranvk_max_push_constant_ranges];
+	uint32_t pushConstantRangeCount;
+} cranvk_pipeline_layout_key_t;
+
+const VkCullModeFlags cranvk_cull_mode_conversion_table[crang_cull_mode_max] =
+{
+	[crang_cull_mode_back] = VK_CULL_MODE_BACK_BIT,
+	[crang_cull_mode_front] = VK_CULL_MODE_FRONT_BIT,
+	[crang_cull_mode_none] = VK_CULL_MODE_NONE
+};
+
+const VkFrontFace cranvk_front_face_conversion_table[crang_front_face_max] =
+{
+	[crang_front_face_counter_clockwise] = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+	[crang_front_face_clockwise] = VK_FRONT_FACE_CLOCKWISE
+};
+
+const VkPrimitiveTopology cranvk_topology_conversion_table[crang_topology_max] =
+{
+	[crang_topology_triangle_list] = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	[crang_topology_triangle_strip] = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+	[crang_topology_line_list] = VK_PRIMITIVE_TOPOLOGY_LINE_LIST,
+	[crang_topology_line_strip] = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP,
+	[crang_topology_point_list] = VK_PRIMITIVE_TOPOLOGY_POINT_LIST
+};
+
+const VkCompareOp cranvk_compare_conversion_table[crang_compare_max] =
+{
+	[crang_compare_less_or_equal] = VK_COMPARE_OP_LESS_OR_EQUAL,
+	[crang_compare_less] = VK_COMPARE_OP_LESS,
+	[crang_compare_equal] = VK_COMPARE_OP_EQUAL,
+	[crang_compare_greater_or_equal] = VK_COMPARE_OP_GREATER_OR_EQUAL,
+	[crang_compare_greater] = VK_COMPARE_OP_GREATER,
+	[crang_compare_always] = VK_COMPARE_OP_ALWAYS,
+	[crang_compare_never] = VK_COMPARE_OP_NEVER
+};
+
+const VkPresentModeKHR cranvk_present_mode_conversion_table[crang_present_mode_max] =
+{
+	[crang_present_mode_fifo] = VK_PRESENT_MODE_FIFO_KHR,
+	[crang_present_mode_fifo_relaxed] = VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+	[crang_present_mode_mailbox] = VK_PRESENT_MODE_MAILBOX_KHR,
+	[crang_present_mode_immediate] = VK_PRESENT_MODE_IMMEDIATE_KHR
+};
+
 typedef struct
 {
 	struct
@@ -683,47 +1692,181 @@ typedef struct
 		VkQueue graphicsQueue;
 	} queues;
 
+	// Resolved capacities, every table below points into the device's buffer and is sized from them.
+	crang_device_capacities_t capacities;
+
 	struct
 	{
-		crang_shader_e types[cranvk_max_shader_count];
-		VkShaderModule shaders[cranvk_max_shader_count];
-		VkDescriptorSetLayout descriptorSetLayouts[cranvk_max_shader_count];
+		crang_shader_e* types;
+		VkShaderModule* shaders;
+		VkDescriptorSetLayout* descriptorSetLayouts;
+		// Indexed by binding, lets us know what type of descriptor to write when binding to a shader input.
+		crang_shader_input_type_e (*inputTypes)[cranvk_max_shader_inputs];
+		uint32_t* inputCounts;
+		// Takes VkDescriptorBufferInfo[inputCount] in declaration order, VK_NULL_HANDLE if the shader has no inputs.
+		VkDescriptorUpdateTemplate* updateTemplates;
 
 		struct
 		{
-			VkDescriptorSet sets[cranvk_max_descriptor_set_count];
-			uint32_t count;
+			VkDescriptorSet* sets;
+			uint32_t* shaderIds;
+			bool* transient;
+			uint32_t* generations;
+			uint32_t* freeSlots;
+			cranvk_handle_pool_t pool;
 		} descriptorSets;
 
 		uint32_t shaderCount;
 	} shaders;
 
+	// Owns the modules that shaders point to, deduplicated by their source.
+	// The hash finds candidates, the copy of the source they were created from confirms them.
 	struct
 	{
-		VkBuffer buffers[cranvk_max_buffer_count];
-		cranvk_allocation_t allocations[cranvk_max_buffer_count];
-		uint32_t bufferCount;
+		VkShaderModule* modules;
+		uint64_t* hashes;
+		uint32_t* sizes;
+		uint32_t* sourceOffsets;
+		uint32_t moduleCount;
+
+		uint8_t* sources;
+		uint32_t sourceSize;
+	} shaderModules;
+
+	struct
+	{
+		VkBuffer* buffers;
+		cranvk_allocation_t* allocations;
+		uint32_t* generations;
+		uint32_t* freeSlots;
+		cranvk_handle_pool_t pool;
 	} buffers;
 
 	struct
 	{
-		VkPipeline pipelines[cranvk_max_pipeline_count];
-		VkPipelineLayout layouts[cranvk_max_pipeline_count];
+		VkPipeline* pipelines;
+		VkPipelineLayout* layouts;
+		VkPipelineBindPoint* bindPoints;
+		VkPushConstantRange (*pushConstantRanges)[cranvk_max_push_constant_ranges];
+		uint32_t* pushConstantRangeCounts;
+		uint32_t* bindlessSetIndices;
+		// Applied when binding pipelines created with dynamic state.
+		bool* hasDynamicState;
+		cranvk_dynamic_state_t* dynamicStates;
+		// Async pipelines are compiled by the pipeline compiler, pending is guarded by its mutex.
+		bool* async;
+		bool* pending;
+		bool* hasFallback;
+		crang_pipeline_id_t* fallbacks;
+		// Identical requests return the existing pipeline, lookup holds pipeline indices plus one.
+		cranvk_pipeline_job_t* jobs;
+		uint64_t* hashes;
+		uint32_t* lookup;
+		uint32_t lookupSize; // Power of two, kept at most half full
 		uint32_t pipelineCount;
 	} pipelines;
 
+	// Shared by every pipeline with the same set layouts and push constants.
+	struct
+	{
+		VkPipelineLayout* layouts;
+		cranvk_pipeline_layout_key_t* keys;
+		uint64_t* hashes;
+		uint32_t layoutCount;
+	} pipelineLayouts;
+
+	// Workers compiling crang_create_pipeline_async requests, started by the first request.
+	struct
+	{
+		cranvk_thread_t threads[cranvk_max_pipeline_compile_threads];
+		uint32_t threadCount;
+		cranvk_mutex_t mutex;
+		cranvk_condition_t jobAvailable;
+		cranvk_condition_t jobDone;
+		uint32_t* queue;
+		uint32_t queueStart;
+		uint32_t queueCount;
+		uint32_t pendingCount;
+		bool shutdown;
+	} pipelineCompiler;
+
 	struct
 	{
 		// Recording buffers keep track of their single use resources until they're reset.
-		cranvk_transient_resources_t singleUseResources[cranvk_max_command_buffer_count];
-		VkCommandBuffer recordingBuffers[cranvk_max_command_buffer_count];
+		cranvk_transient_resources_t* singleUseResources;
+		VkCommandBuffer* recordingBuffers;
+		// Commands that can't be executed in a render pass are recorded here and executed before the render pass.
+		VkCommandBuffer* computeBuffers;
+		bool* hasComputeCommands;
+		// Bumped every time a buffer is recorded, lets the present know its cached primary buffers are stale.
+		uint32_t* recordVersions;
+		// Timeline value of the last frame that executed the buffer, re-recording waits for it.
+		uint64_t* submitValues;
 		uint32_t bufferCount;
+		// Scratch for crang_render, a render can't submit more buffers than the device can record.
+		uint32_t* renderIds;
+		VkCommandBuffer* renderBuffers;
 	} commandBuffers;
 
 	VkDescriptorPool descriptorPool;
 	VkPipelineCache pipelineCache;
+	// Saved caches are only valid for the exact device and driver that wrote them.
+	struct
+	{
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t uuid[VK_UUID_SIZE];
+	} pipelineCacheIdentity;
 	VkCommandPool graphicsCommandPool;
-	VkFence immediateFence;
+
+	// Signaled by every submission with the next value, all CPU waits go through it.
+	struct
+	{
+		VkSemaphore semaphore;
+		uint64_t submittedValue;
+		PFN_vkGetSemaphoreCounterValueKHR getCounterValue;
+		PFN_vkWaitSemaphoresKHR waitSemaphores;
+	} timeline;
+
+	// Destroyed resources waiting on the timeline, in the order they were destroyed.
+	struct
+	{
+		cranvk_deferred_destroy_t destroys[cranvk_max_deferred_destroy_count];
+		uint32_t count;
+	} deferred;
+
+	// Every render pass created by the device gets a new ID, pipelines are deduplicated by it.
+	uint32_t nextRenderPassId;
+
+	VkPhysicalDeviceLimits limits;
+	// Without multiDrawIndirect, indirect draws are issued one at a time.
+	bool multiDrawIndirect;
+
+	// Used to sample graph attachments.
+	VkSampler linearSampler;
+
+	// Only valid if VK_EXT_extended_dynamic_state is supported, the commands are loaded from the device.
+	struct
+	{
+		bool supported;
+		PFN_vkCmdSetCullModeEXT setCullMode;
+		PFN_vkCmdSetFrontFaceEXT setFrontFace;
+		PFN_vkCmdSetPrimitiveTopologyEXT setPrimitiveTopology;
+		PFN_vkCmdSetDepthTestEnableEXT setDepthTestEnable;
+		PFN_vkCmdSetDepthWriteEnableEXT setDepthWriteEnable;
+		PFN_vkCmdSetDepthCompareOpEXT setDepthCompareOp;
+	} extendedDynamicState;
+
+	// Only valid if VK_EXT_descriptor_indexing is supported.
+	struct
+	{
+		bool supported;
+		VkDescriptorPool pool;
+		VkDescriptorSetLayout layout;
+		VkDescriptorSet set;
+		uint32_t descriptorCount;
+	} bindless;
 
 	cranvk_allocator_t allocator;
 } cranvk_graphics_device_t;
@@ -731,23 +1874,78 @@ typedef struct
 typedef struct
 {
 	VkRenderPass renderPass;
-	uint32_t framebufferIndices[cranvk_render_buffer_count];
+	uint32_t renderPassId;
+	uint32_t framebufferIndices[cranvk_max_physical_image_count]; // Indexed by swapchain image
 } cranvk_render_pass_t;
 
+// Everything that depends on a swapchain that was replaced, in flight frames might still be using it.
+typedef struct
+{
+	VkSwapchainKHR swapchain;
+	VkImageView imageViews[cranvk_max_physical_image_count];
+	uint32_t imageViewCount;
+	VkFramebuffer framebuffers[cranvk_max_framebuffer_count];
+	uint32_t framebufferCount;
+
+	bool hasDepth;
+	VkImage depthImage;
+	VkImageView depthView;
+	VkDeviceMemory depthMemory;
+
+	// Submissions up to this timeline value might reference the resources.
+	uint64_t value;
+} cranvk_retired_swapchain_t;
+
 typedef struct
 {
 	VkSurfaceFormatKHR surfaceFormat;
 	VkExtent2D surfaceExtents;
 	VkPresentModeKHR presentMode;
+	crang_present_mode_e presentModeId;
 
-	VkSemaphore acquireSemaphores[cranvk_render_buffer_count];
-	VkSemaphore presentSemaphores[cranvk_render_buffer_count];
-	VkFence presentFences[cranvk_render_buffer_count];
+	uint32_t framesInFlight;
+	uint32_t requestedImageCount;
+
+	// Only one depth buffer, frames in flight are ordered by the render pass' dependency.
+	bool depthEnabled;
+	struct
+	{
+		VkImage image;
+		VkImageView view;
+		VkDeviceMemory memory;
+	} depth;
+
+	// Headless presents render to these instead of swapchain images, the views live in swapchainData.
+	bool headless;
+	bool readback;
+	struct
+	{
+		VkImage images[cranvk_max_physical_image_count];
+		VkDeviceMemory memories[cranvk_max_physical_image_count];
+		VkBuffer readbackBuffers[cranvk_max_physical_image_count];
+		VkDeviceMemory readbackMemories[cranvk_max_physical_image_count];
+		void* readbackData[cranvk_max_physical_image_count];
+
+		uint32_t lastImage;
+		uint64_t lastValue;
+		bool hasFrame;
+	} offscreen;
+
+	// Indexed by frame in flight
+	VkSemaphore acquireSemaphores[cranvk_max_frames_in_flight];
+	VkSemaphore presentSemaphores[cranvk_max_frames_in_flight];
+	// Timeline value signaled by the last frame rendered in the slot, 0 if there wasn't one.
+	uint64_t frameValues[cranvk_max_frames_in_flight];
 
 	struct
 	{
 		VkSwapchainKHR swapchain;
-		VkImageView imageViews[cranvk_render_buffer_count];
+		VkImageView imageViews[cranvk_max_physical_image_count];
+		uint32_t imageCount;
+
+		// Timeline value of the frame last rendered to each image, the image might be acquired again before that frame's slot comes around.
+		// They also guard the primary buffers.
+		uint64_t imageValues[cranvk_max_physical_image_count];
 
 		// Tells us the framebuffers that need to be recreated on window resize
 		struct
@@ -759,62 +1957,264 @@ typedef struct
 	} swapchainData;
 	
 	// Keeps track of all our framebuffers and allows us to reconstruct them
+	// Framebuffers are created the first time they're rendered to, recreating the swapchain only clears them.
 	struct
 	{
 		VkFramebuffer framebuffers[cranvk_max_framebuffer_count];
 		VkRenderPass renderPasses_weak[cranvk_max_framebuffer_count];
+		uint32_t imageIndices[cranvk_max_framebuffer_count];
 		uint32_t count;
 	} framebufferData;
 
+	struct
+	{
+		cranvk_retired_swapchain_t swapchains[cranvk_max_retired_swapchain_count];
+		uint32_t count;
+	} retired;
+
 	uint32_t backBufferIndex;
 
-	VkCommandBuffer primaryRenderBuffers[cranvk_render_buffer_count];
+	// One primary buffer per swapchain image, only re-recorded when the key of what it executes changes.
+	struct
+	{
+		VkCommandBuffer buffers[cranvk_max_physical_image_count];
+		uint64_t keys[cranvk_max_physical_image_count];
+		bool valid[cranvk_max_physical_image_count];
+	} primaryBuffers;
 
 	cranvk_render_pass_t presentRenderPass;
+
+	// Frame lifetime shader inputs are allocated from the pools of the frame they're recorded for.
+	// The pools are reset wholesale the first time they're used once that frame has completed,
+	// a new pool is chained when the current one runs out.
+	struct
+	{
+		VkDescriptorPool pools[cranvk_max_transient_descriptor_pool_count];
+		uint32_t poolCount;
+		uint32_t activePool;
+		uint64_t resetFrame;
+	} transientDescriptors[cranvk_max_frames_in_flight];
+	uint64_t frameCount;
+
+	struct
+	{
+		crang_frame_timing_t inFlight[cranvk_max_frames_in_flight];
+		bool pending[cranvk_max_frames_in_flight];
+		float lastLatencyMs;
+		float averageLatencyMs;
+
+		// Ring of completed frames waiting to be popped.
+		crang_frame_timing_t completed[cranvk_max_frame_timing_count];
+		uint32_t completedStart;
+		uint32_t completedCount;
+	} latency;
+
+	// Frame start is delayed so that the CPU work ends right when the next present is due.
+	struct
+	{
+		double targetFrameMs;
+		double nextPresentMs;
+		double cpuWorkMs; // Smoothed crang_render start to present
+	} pacing;
 } cranvk_present_t;
 
 typedef struct
 {
-	VkCommandBuffer commandBuffer;
-	
-	// Temp resources are deallocated when an execution context is closed
-	cranvk_transient_resources_t singleUseResources;
-} cranvk_execution_ctx_t;
+	VkPipelineStageFlags srcStages;
+	VkPipelineStageFlags dstStages;
+	VkAccessFlags srcAccess;
+	VkAccessFlags dstAccess;
+} cranvk_graph_barrier_t;
 
-unsigned int crang_ctx_size(void)
+typedef struct
 {
-	return sizeof(cranvk_ctx_t);
-}
+	cranvk_present_t* present;
+	bool compiled;
 
-crang_ctx_t* crang_create_ctx(void* buffer)
-{
-	cranvk_ctx_t* vkCtx = (cranvk_ctx_t*)buffer;
+	struct
+	{
+		// Attachments are owned by the graph, buffers are imported from the device.
+		bool isBuffer[cranvk_max_graph_resources];
+		uint32_t bufferIds[cranvk_max_graph_resources];
+		crang_graph_attachment_desc_t attachmentDescs[cranvk_max_graph_resources];
+		bool isOutput[cranvk_max_graph_resources];
+
+		// Filled when compiled, only attachments used by live passes get an image.
+		VkImage images[cranvk_max_graph_resources];
+		VkImageView imageViews[cranvk_max_graph_resources];
+		VkExtent2D extents[cranvk_max_graph_resources];
+		uint32_t memorySlots[cranvk_max_graph_resources];
+		uint32_t count;
+	} resources;
 
-	VkApplicationInfo appInfo =
+	// Attachments with disjoint lifetimes share a slot.
+	struct
 	{
-		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-		.pNext = NULL,
-		.pApplicationName = "CranberryGfx",
-		.applicationVersion = 1,
-		.pEngineName = "CranberryGfx",
-		.engineVersion = 1,
-		.apiVersion = VK_MAKE_VERSION(1, 0, VK_HEADER_VERSION)
-	};
+		VkDeviceMemory memories[cranvk_max_graph_resources];
+		uint32_t count;
+	} memorySlots;
 
-	VkInstanceCreateInfo createInfo =
+	struct
 	{
-		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-		.pNext = NULL,
-		.pApplicationInfo = &appInfo,
-		.enabledExtensionCount = cranvk_instance_extension_count,
-		.ppEnabledExtensionNames = cranvk_instance_extensions,
-		.enabledLayerCount = cranvk_validation_count,
-		.ppEnabledLayerNames = cranvk_validation_layers
-	};
+		crang_graph_pass_type_e types[cranvk_max_graph_passes];
+		crang_graph_resource_use_t reads[cranvk_max_graph_passes][cranvk_max_graph_pass_uses];
+		uint32_t readCounts[cranvk_max_graph_passes];
+		crang_graph_resource_use_t writes[cranvk_max_graph_passes][cranvk_max_graph_pass_uses];
+		uint32_t writeCounts[cranvk_max_graph_passes];
+		float clearColors[cranvk_max_graph_passes][4];
+		float clearDepths[cranvk_max_graph_passes];
+		bool culled[cranvk_max_graph_passes];
+
+		// Raster passes only, culled passes get a compatible render pass but no framebuffer.
+		VkRenderPass renderPasses[cranvk_max_graph_passes];
+		uint32_t renderPassIds[cranvk_max_graph_passes];
+		VkFramebuffer framebuffers[cranvk_max_graph_passes];
+		VkExtent2D extents[cranvk_max_graph_passes];
+		VkClearValue clearValues[cranvk_max_graph_passes][cranvk_max_graph_attachments];
+		uint32_t attachmentCounts[cranvk_max_graph_passes];
+		uint32_t colorAttachmentCounts[cranvk_max_graph_passes];
+		bool hasDepth[cranvk_max_graph_passes];
+
+		// Executed before the pass
+		cranvk_graph_barrier_t barriers[cranvk_max_graph_passes];
+
+		VkCommandBuffer commandBuffers[cranvk_max_graph_passes];
+		cranvk_transient_resources_t singleUseResources[cranvk_max_graph_passes];
+		uint32_t recordVersions[cranvk_max_graph_passes];
+		uint32_t count;
+	} passes;
 
-	cranvk_check(vkCreateInstance(&createInfo, cranvk_no_allocator, &vkCtx->instance));
-	return (crang_ctx_t*)vkCtx;
-}
+	// Timeline value of the last frame that executed the graph, re-recording a pass waits for it.
+	uint64_t submitValue;
+
+	// Live passes in execution order
+	uint32_t executionOrder[cranvk_max_graph_passes];
+	uint32_t executionCount;
+
+	// Makes the outputs visible to the present's render pass.
+	cranvk_graph_barrier_t outputBarrier;
+} cranvk_graph_t;
+
+typedef struct
+{
+	VkCommandBuffer commandBuffer;
+
+	// NULL when executing immediately.
+	cranvk_present_t* present;
+
+	// Render area of the buffer being recorded, zero outside of render passes.
+	VkExtent2D extents;
+
+	// Dispatches and copies go here, they can't be recorded in a render pass.
+	// When executing immediately, this is the same buffer as commandBuffer.
+	VkCommandBuffer computeCommandBuffer;
+	bool computeCommandsBegun;
+
+	// Copies name their buffers, only commands using the same buffers wait on them.
+	// Dispatches go through descriptors, what they touch is tracked in untracked and waits on every buffer.
+	struct
+	{
+		VkBuffer buffers[cranvk_max_tracked_buffer_count];
+		cranvk_buffer_access_t accesses[cranvk_max_tracked_buffer_count];
+		uint32_t count;
+		cranvk_buffer_access_t untracked;
+		// Copies into readback staging buffers, nothing else uses them, only the final wait on all accesses does.
+		cranvk_buffer_access_t readbacks;
+	} bufferAccesses;
+
+	// Barriers needed by the next command, recorded together by cranvk_flush_barriers.
+	struct
+	{
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+		VkBufferMemoryBarrier buffers[cranvk_max_batched_barrier_count];
+		uint32_t bufferCount;
+	} barriers;
+	
+	// Temp resources are deallocated when an execution context is closed
+	cranvk_transient_resources_t singleUseResources;
+
+	// Copied back to the host once an immediate execution has completed
+	cranvk_readbacks_t readbacks;
+
+	// Descriptor writes waiting for the next command that depends on them.
+	struct
+	{
+		VkWriteDescriptorSet writes[cranvk_max_descriptor_writes];
+		VkDescriptorBufferInfo bufferInfos[cranvk_max_descriptor_writes];
+		VkDescriptorImageInfo imageInfos[cranvk_max_descriptor_writes];
+		uint32_t count;
+	} descriptorWrites;
+} cranvk_execution_ctx_t;
+
+unsigned int crang_ctx_size(void)
+{
+	return sizeof(cranvk_ctx_t);
+}
+
+crang_ctx_t* crang_create_ctx(void* buffer)
+{
+	cranvk_ctx_t* vkCtx = (cranvk_ctx_t*)buffer;
+
+	VkApplicationInfo appInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pNext = NULL,
+		.pApplicationName = "CranberryGfx",
+		.applicationVersion = 1,
+		.pEngineName = "CranberryGfx",
+		.engineVersion = 1,
+		.apiVersion = VK_MAKE_VERSION(1, 1, VK_HEADER_VERSION) // 1.1 for vkGetPhysicalDeviceFeatures2 and maintenance3 which descriptor indexing depends on
+	};
+
+	const char* extensions[cranvk_max_instance_extension_count];
+	uint32_t extensionCount = 0;
+	for (uint32_t i = 0; i < cranvk_platform_extension_count; i++)
+	{
+		extensions[extensionCount++] = cranvk_platform_extensions[i];
+	}
+
+	// Validation is optional, build agents and software drivers usually don't have the layers installed.
+	vkCtx->layerCount = 0;
+	if (cranvk_validation_count > 0)
+	{
+		static VkLayerProperties layerProperties[cranvk_max_layer_property_count];
+		uint32_t layerPropertyCount = cranvk_max_layer_property_count;
+		vkEnumerateInstanceLayerProperties(&layerPropertyCount, layerProperties);
+
+		bool hasValidation = false;
+		for (uint32_t i = 0; i < layerPropertyCount; i++)
+		{
+			if (strcmp(layerProperties[i].layerName, cranvk_validation_layers[0]) == 0)
+			{
+				hasValidation = true;
+				break;
+			}
+		}
+
+		if (hasValidation)
+		{
+			vkCtx->layerCount = cranvk_validation_count;
+			extensions[extensionCount++] = VK_EXT_DEBUG_REPORT_EXTENSION_NAME;
+		}
+	}
+
+	VkInstanceCreateInfo createInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+		.pNext = NULL,
+		.pApplicationInfo = &appInfo,
+		.enabledExtensionCount = extensionCount,
+		.ppEnabledExtensionNames = extensions,
+		.enabledLayerCount = vkCtx->layerCount,
+		.ppEnabledLayerNames = cranvk_validation_layers
+	};
+
+	cranvk_check(vkCreateInstance(&createInfo, cranvk_no_allocator, &vkCtx->instance));
+	return (crang_ctx_t*)vkCtx;
+}
 
 void crang_destroy_ctx(crang_ctx_t* ctx)
 {
@@ -822,6 +2222,7 @@ void crang_destroy_ctx(crang_ctx_t* ctx)
 	vkDestroyInstance(vkCtx->instance, cranvk_no_allocator);
 }
 
+#ifdef _WIN32
 unsigned int crang_win32_surface_size(void)
 {
 	return sizeof(cranvk_surface_t);
@@ -849,19 +2250,172 @@ void crang_win32_destroy_surface(crang_ctx_t* ctx, crang_surface_t* surface)
 	cranvk_surface_t* vkSurface = (cranvk_surface_t*)surface;
 	vkDestroySurfaceKHR(vkCtx->instance, vkSurface->surface, cranvk_no_allocator);
 }
+#endif // _WIN32
+
+crang_device_capacities_t cranvk_resolve_capacities(crang_device_capacities_t const* capacities)
+{
+	crang_device_capacities_t resolved = capacities != NULL ? *capacities : (crang_device_capacities_t) { 0 };
+	resolved.shaderCount = resolved.shaderCount != 0 ? resolved.shaderCount : cranvk_default_shader_count;
+	resolved.shaderInputCount = resolved.shaderInputCount != 0 ? resolved.shaderInputCount : cranvk_default_shader_input_count;
+	resolved.bufferCount = resolved.bufferCount != 0 ? resolved.bufferCount : cranvk_default_buffer_count;
+	resolved.pipelineCount = resolved.pipelineCount != 0 ? resolved.pipelineCount : cranvk_default_pipeline_count;
+	resolved.pipelineLayoutCount = resolved.pipelineLayoutCount != 0 ? resolved.pipelineLayoutCount : cranvk_default_pipeline_layout_count;
+	resolved.recordingBufferCount = resolved.recordingBufferCount != 0 ? resolved.recordingBufferCount : cranvk_default_recording_buffer_count;
+	resolved.memoryBlockCount = resolved.memoryBlockCount != 0 ? resolved.memoryBlockCount : cranvk_default_memory_block_count;
+	resolved.shaderSourceSize = resolved.shaderSourceSize != 0 ? resolved.shaderSourceSize : resolved.shaderCount * cranvk_default_shader_source_size_per_shader;
+	resolved.uniformBufferCount = resolved.uniformBufferCount != 0 ? resolved.uniformBufferCount : resolved.shaderInputCount;
+	resolved.storageBufferCount = resolved.storageBufferCount != 0 ? resolved.storageBufferCount : resolved.shaderInputCount;
+	resolved.dynamicUniformBufferCount = resolved.dynamicUniformBufferCount != 0 ? resolved.dynamicUniformBufferCount : resolved.shaderInputCount;
+	resolved.imageSamplerCount = resolved.imageSamplerCount != 0 ? resolved.imageSamplerCount : resolved.shaderInputCount;
+
+	// Generational handles only have room for so many slots.
+	cranvk_assert(resolved.bufferCount <= cranvk_handle_index_mask + 1);
+	cranvk_assert(resolved.shaderInputCount <= cranvk_handle_index_mask + 1);
+	return resolved;
+}
+
+// Tables are laid out one after the other, offsets are relative to the start of the buffer.
+typedef struct
+{
+	uint8_t* base; // NULL when only measuring.
+	size_t offset;
+} cranvk_arena_t;
+
+void* cranvk_arena_push(cranvk_arena_t* arena, size_t size)
+{
+	arena->offset = (arena->offset + cranvk_table_alignment - 1) & ~(size_t)(cranvk_table_alignment - 1);
+	void* table = arena->base != NULL ? arena->base + arena->offset : NULL;
+	arena->offset += size;
+	return table;
+}
+
+#define cranvk_arena_table(arena, table, count) ((table) = cranvk_arena_push((arena), sizeof(*(table)) * (count)))
+
+// Points the device's tables after the device itself, returns the size of the whole thing.
+size_t cranvk_layout_device(cranvk_graphics_device_t* vkDevice, uint8_t* buffer, crang_device_capacities_t const* capacities)
+{
+	cranvk_arena_t arena = { .base = buffer, .offset = sizeof(cranvk_graphics_device_t) };
+
+	uint32_t shaderCount = capacities->shaderCount;
+	cranvk_arena_table(&arena, vkDevice->shaders.types, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.shaders, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.descriptorSetLayouts, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.inputTypes, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.inputCounts, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.updateTemplates, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaderModules.modules, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaderModules.hashes, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaderModules.sizes, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaderModules.sourceOffsets, shaderCount);
+	cranvk_arena_table(&arena, vkDevice->shaderModules.sources, capacities->shaderSourceSize);
+
+	uint32_t shaderInputCount = capacities->shaderInputCount;
+	cranvk_arena_table(&arena, vkDevice->shaders.descriptorSets.sets, shaderInputCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.descriptorSets.shaderIds, shaderInputCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.descriptorSets.transient, shaderInputCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.descriptorSets.generations, shaderInputCount);
+	cranvk_arena_table(&arena, vkDevice->shaders.descriptorSets.freeSlots, shaderInputCount);
+
+	uint32_t bufferCount = capacities->bufferCount;
+	cranvk_arena_table(&arena, vkDevice->buffers.buffers, bufferCount);
+	cranvk_arena_table(&arena, vkDevice->buffers.allocations, bufferCount);
+	cranvk_arena_table(&arena, vkDevice->buffers.generations, bufferCount);
+	cranvk_arena_table(&arena, vkDevice->buffers.freeSlots, bufferCount);
+
+	uint32_t pipelineCount = capacities->pipelineCount;
+	vkDevice->pipelines.lookupSize = 1;
+	while (vkDevice->pipelines.lookupSize < pipelineCount * 2)
+	{
+		vkDevice->pipelines.lookupSize *= 2;
+	}
+	cranvk_arena_table(&arena, vkDevice->pipelines.pipelines, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.layouts, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.bindPoints, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.pushConstantRanges, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.pushConstantRangeCounts, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.bindlessSetIndices, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.hasDynamicState, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.dynamicStates, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.async, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.pending, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.hasFallback, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.fallbacks, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.jobs, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.hashes, pipelineCount);
+	cranvk_arena_table(&arena, vkDevice->pipelines.lookup, vkDevice->pipelines.lookupSize);
+	cranvk_arena_table(&arena, vkDevice->pipelineCompiler.queue, pipelineCount);
+
+	uint32_t pipelineLayoutCount = capacities->pipelineLayoutCount;
+	cranvk_arena_table(&arena, vkDevice->pipelineLayouts.layouts, pipelineLayoutCount);
+	cranvk_arena_table(&arena, vkDevice->pipelineLayouts.keys, pipelineLayoutCount);
+	cranvk_arena_table(&arena, vkDevice->pipelineLayouts.hashes, pipelineLayoutCount);
+
+	uint32_t recordingBufferCount = capacities->recordingBufferCount;
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.singleUseResources, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.recordingBuffers, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.computeBuffers, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.hasComputeCommands, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.recordVersions, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.submitValues, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.renderIds, recordingBufferCount);
+	cranvk_arena_table(&arena, vkDevice->commandBuffers.renderBuffers, recordingBufferCount);
+
+	vkDevice->allocator.blockCount = capacities->memoryBlockCount;
+	cranvk_arena_table(&arena, vkDevice->allocator.blockPool, capacities->memoryBlockCount);
+	cranvk_arena_table(&arena, vkDevice->allocator.freeBlocks, capacities->memoryBlockCount);
+
+	vkDevice->capacities = *capacities;
+	return arena.offset;
+}
+
+unsigned int crang_graphics_device_size(crang_device_capacities_t const* capacities)
+{
+	crang_device_capacities_t resolved = cranvk_resolve_capacities(capacities);
+
+	cranvk_graphics_device_t measure;
+	return (unsigned int)cranvk_layout_device(&measure, NULL, &resolved);
+}
 
-unsigned int crang_graphics_device_size(void)
+// All of our synchronization goes through the timeline, devices without it can't be used.
+bool cranvk_supports_timeline_semaphore(VkPhysicalDevice physicalDevice)
 {
-	return sizeof(cranvk_graphics_device_t);
+	static VkExtensionProperties extensionProperties[cranvk_max_extension_property_count];
+	uint32_t extensionCount = cranvk_max_extension_property_count;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, extensionProperties);
+
+	bool hasExtension = false;
+	for (uint32_t i = 0; i < extensionCount && !hasExtension; i++)
+	{
+		hasExtension = strcmp(extensionProperties[i].extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0;
+	}
+
+	if (!hasExtension)
+	{
+		return false;
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures =
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR
+	};
+	VkPhysicalDeviceFeatures2 features2 =
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &timelineSemaphoreFeatures
+	};
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+	return timelineSemaphoreFeatures.timelineSemaphore;
 }
 
-crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t* ctx, crang_surface_t* surface)
+crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t* ctx, crang_surface_t* surface, crang_device_capacities_t const* capacities)
 {
 	cranvk_ctx_t* vkCtx = (cranvk_ctx_t*)ctx;
 	cranvk_surface_t* vkSurface = (cranvk_surface_t*)surface;
 
+	crang_device_capacities_t resolved = cranvk_resolve_capacities(capacities);
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)buffer;
-	memset(buffer, 0, sizeof(cranvk_graphics_device_t));
+	memset(buffer, 0, crang_graphics_device_size(&resolved));
+	cranvk_layout_device(vkDevice, (uint8_t*)buffer, &resolved);
 
 	uint32_t physicalDeviceCount;
 	VkPhysicalDevice physicalDevices[cranvk_max_physical_device_count];
@@ -891,6 +2445,14 @@ crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t*
 	{
 		for (uint32_t deviceIndex = 0; deviceIndex < physicalDeviceCount; deviceIndex++)
 		{
+			// Descriptor update templates and vkGetPhysicalDeviceFeatures2 are core in 1.1.
+			VkPhysicalDeviceProperties deviceProperties;
+			vkGetPhysicalDeviceProperties(physicalDevices[deviceIndex], &deviceProperties);
+			if (deviceProperties.apiVersion < VK_API_VERSION_1_1 || !cranvk_supports_timeline_semaphore(physicalDevices[deviceIndex]))
+			{
+				continue;
+			}
+
 			uint32_t graphicsQueue = UINT32_MAX;
 			uint32_t presentQueue = UINT32_MAX;
 
@@ -915,8 +2477,16 @@ crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t*
 					continue;
 				}
 
+				// Headless devices have no surface, they present from the graphics queue.
 				VkBool32 supportsPresent = VK_FALSE;
-				cranvk_check(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevices[deviceIndex], propIndex, vkSurface->surface, &supportsPresent));
+				if (vkSurface != NULL)
+				{
+					cranvk_check(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevices[deviceIndex], propIndex, vkSurface->surface, &supportsPresent));
+				}
+				else
+				{
+					supportsPresent = propIndex == graphicsQueue;
+				}
 
 				if (supportsPresent)
 				{
@@ -935,7 +2505,10 @@ crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t*
 			}
 		}
 
-		cranvk_assert(physicalDeviceIndex != UINT32_MAX);
+		if (physicalDeviceIndex == UINT32_MAX)
+		{
+			return NULL;
+		}
 	}
 
 	// Create the logical device
@@ -972,46 +2545,258 @@ crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t*
 			queueCreateInfoCount++;
 		}
 
-		VkPhysicalDeviceFeatures physicalDeviceFeatures = { 0 };
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevices[physicalDeviceIndex], &supportedFeatures);
+
+		// Culling uses firstInstance to place draw groups in the visible instance buffer.
+		cranvk_assert(supportedFeatures.drawIndirectFirstInstance);
+		VkPhysicalDeviceFeatures physicalDeviceFeatures =
+		{
+			.drawIndirectFirstInstance = VK_TRUE,
+			.multiDrawIndirect = supportedFeatures.multiDrawIndirect
+		};
+		vkDevice->multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+
+		const char* deviceExtensions[cranvk_max_device_extension_count];
+		uint32_t deviceExtensionCount = 0;
+		for (uint32_t i = 0; i < cranvk_device_extension_count && vkSurface != NULL; i++)
+		{
+			deviceExtensions[deviceExtensionCount++] = cranvk_device_extensions[i];
+		}
+
+		// Bindless is optional, enable it if the extension and the features we use are all there.
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures =
+		{
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT
+		};
+		VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures =
+		{
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT
+		};
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures =
+		{
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR
+		};
+		void* enabledFeatures = NULL;
+		{
+			static VkExtensionProperties extensionProperties[cranvk_max_extension_property_count];
+			uint32_t extensionCount = cranvk_max_extension_property_count;
+			vkEnumerateDeviceExtensionProperties(physicalDevices[physicalDeviceIndex], NULL, &extensionCount, extensionProperties);
+
+			bool hasDescriptorIndexing = false;
+			bool hasExtendedDynamicState = false;
+			for (uint32_t i = 0; i < extensionCount; i++)
+			{
+				if (strcmp(extensionProperties[i].extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+				{
+					hasDescriptorIndexing = true;
+				}
+				else if (strcmp(extensionProperties[i].extensionName, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) == 0)
+				{
+					hasExtendedDynamicState = true;
+				}
+			}
+
+			if (hasDescriptorIndexing)
+			{
+				VkPhysicalDeviceFeatures2 features2 =
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+					.pNext = &descriptorIndexingFeatures
+				};
+				vkGetPhysicalDeviceFeatures2(physicalDevices[physicalDeviceIndex], &features2);
+
+				vkDevice->bindless.supported =
+					descriptorIndexingFeatures.runtimeDescriptorArray &&
+					descriptorIndexingFeatures.descriptorBindingPartiallyBound &&
+					descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+					descriptorIndexingFeatures.shaderStorageBufferArrayNonUniformIndexing;
+
+				VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties =
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT
+				};
+				VkPhysicalDeviceProperties2 properties2 =
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+					.pNext = &descriptorIndexingProperties
+				};
+				vkGetPhysicalDeviceProperties2(physicalDevices[physicalDeviceIndex], &properties2);
+
+				// The array is visible to every stage, both limits apply.
+				uint32_t descriptorCount = vkDevice->capacities.bufferCount;
+				descriptorCount = descriptorCount < descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers ? descriptorCount : descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers;
+				descriptorCount = descriptorCount < descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers ? descriptorCount : descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers;
+				vkDevice->bindless.descriptorCount = descriptorCount;
+			}
+
+			if (vkDevice->bindless.supported)
+			{
+				// Only enable what we use.
+				descriptorIndexingFeatures = (VkPhysicalDeviceDescriptorIndexingFeaturesEXT)
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+					.runtimeDescriptorArray = VK_TRUE,
+					.descriptorBindingPartiallyBound = VK_TRUE,
+					.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+					.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE,
+					.pNext = enabledFeatures
+				};
+				enabledFeatures = &descriptorIndexingFeatures;
+				deviceExtensions[deviceExtensionCount++] = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+			}
+
+			// Extended dynamic state is optional as well, pipelines that ask for it assert it's there.
+			if (hasExtendedDynamicState)
+			{
+				VkPhysicalDeviceFeatures2 features2 =
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+					.pNext = &extendedDynamicStateFeatures
+				};
+				vkGetPhysicalDeviceFeatures2(physicalDevices[physicalDeviceIndex], &features2);
+				vkDevice->extendedDynamicState.supported = extendedDynamicStateFeatures.extendedDynamicState;
+			}
+
+			if (vkDevice->extendedDynamicState.supported)
+			{
+				extendedDynamicStateFeatures = (VkPhysicalDeviceExtendedDynamicStateFeaturesEXT)
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+					.extendedDynamicState = VK_TRUE,
+					.pNext = enabledFeatures
+				};
+				enabledFeatures = &extendedDynamicStateFeatures;
+				deviceExtensions[deviceExtensionCount++] = VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME;
+			}
+
+			// Device selection only picks devices with timeline semaphores.
+			{
+				timelineSemaphoreFeatures = (VkPhysicalDeviceTimelineSemaphoreFeaturesKHR)
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+					.timelineSemaphore = VK_TRUE,
+					.pNext = enabledFeatures
+				};
+				enabledFeatures = &timelineSemaphoreFeatures;
+				deviceExtensions[deviceExtensionCount++] = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+			}
+		}
+
 		VkDeviceCreateInfo deviceCreateInfo =
 		{
 			.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-			.enabledExtensionCount = cranvk_device_extension_count,
+			.pNext = enabledFeatures,
+			.enabledExtensionCount = deviceExtensionCount,
 			.queueCreateInfoCount = queueCreateInfoCount,
 			.pQueueCreateInfos = queueCreateInfo,
 			.pEnabledFeatures = &physicalDeviceFeatures,
-			.ppEnabledExtensionNames = cranvk_device_extensions,
-			.enabledLayerCount = cranvk_validation_count,
+			.ppEnabledExtensionNames = deviceExtensions,
+			.enabledLayerCount = vkCtx->layerCount,
 			.ppEnabledLayerNames = cranvk_validation_layers
 		};
 
 		vkDevice->devices.physicalDevice = physicalDevices[physicalDeviceIndex];
+
+		VkPhysicalDeviceProperties physicalDeviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevices[physicalDeviceIndex], &physicalDeviceProperties);
+		vkDevice->limits = physicalDeviceProperties.limits;
+		vkDevice->pipelineCacheIdentity.vendorID = physicalDeviceProperties.vendorID;
+		vkDevice->pipelineCacheIdentity.deviceID = physicalDeviceProperties.deviceID;
+		vkDevice->pipelineCacheIdentity.driverVersion = physicalDeviceProperties.driverVersion;
+		memcpy(vkDevice->pipelineCacheIdentity.uuid, physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
 		cranvk_check(vkCreateDevice(physicalDevices[physicalDeviceIndex], &deviceCreateInfo, cranvk_no_allocator, &vkDevice->devices.logicalDevice));
 
 		vkGetDeviceQueue(vkDevice->devices.logicalDevice, vkDevice->queues.graphicsQueueIndex, 0, &vkDevice->queues.graphicsQueue);
 		vkGetDeviceQueue(vkDevice->devices.logicalDevice, vkDevice->queues.presentQueueIndex, 0, &vkDevice->queues.presentQueue);
+
+		vkDevice->timeline.getCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(vkDevice->devices.logicalDevice, "vkGetSemaphoreCounterValueKHR");
+		vkDevice->timeline.waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(vkDevice->devices.logicalDevice, "vkWaitSemaphoresKHR");
+
+		if (vkDevice->extendedDynamicState.supported)
+		{
+			VkDevice logicalDevice = vkDevice->devices.logicalDevice;
+			vkDevice->extendedDynamicState.setCullMode = (PFN_vkCmdSetCullModeEXT)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetCullModeEXT");
+			vkDevice->extendedDynamicState.setFrontFace = (PFN_vkCmdSetFrontFaceEXT)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetFrontFaceEXT");
+			vkDevice->extendedDynamicState.setPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetPrimitiveTopologyEXT");
+			vkDevice->extendedDynamicState.setDepthTestEnable = (PFN_vkCmdSetDepthTestEnableEXT)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetDepthTestEnableEXT");
+			vkDevice->extendedDynamicState.setDepthWriteEnable = (PFN_vkCmdSetDepthWriteEnableEXT)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetDepthWriteEnableEXT");
+			vkDevice->extendedDynamicState.setDepthCompareOp = (PFN_vkCmdSetDepthCompareOpEXT)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetDepthCompareOpEXT");
+		}
 	}
 
 	// Create the descriptor pools
 	{
-		VkDescriptorPoolSize descriptorPoolSizes[2] =
+		VkDescriptorPoolSize descriptorPoolSizes[4] =
 		{
-			{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,.descriptorCount = cranvk_max_uniform_buffer_count },
-			{ .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = cranvk_max_image_sampler_count }
+			{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,.descriptorCount = vkDevice->capacities.uniformBufferCount },
+			{ .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,.descriptorCount = vkDevice->capacities.storageBufferCount },
+			{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,.descriptorCount = vkDevice->capacities.dynamicUniformBufferCount },
+			{ .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = vkDevice->capacities.imageSamplerCount }
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolCreate =
 		{
 			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-			.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-			.maxSets = cranvk_max_descriptor_set_count,
-			.poolSizeCount = 2,
+			.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, // Destroyed shader inputs give their set back.
+			.maxSets = vkDevice->capacities.shaderInputCount,
+			.poolSizeCount = 4,
 			.pPoolSizes = descriptorPoolSizes
 		};
 
 		cranvk_check(vkCreateDescriptorPool(vkDevice->devices.logicalDevice, &descriptorPoolCreate, cranvk_no_allocator, &vkDevice->descriptorPool));
 	}
 
+	// Create the bindless set
+	if (vkDevice->bindless.supported)
+	{
+		VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+			.bindingCount = 1,
+			.pBindingFlags = &bindingFlags
+		};
+
+		VkDescriptorSetLayoutBinding layoutBinding =
+		{
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = vkDevice->bindless.descriptorCount,
+			.stageFlags = VK_SHADER_STAGE_ALL
+		};
+
+		VkDescriptorSetLayoutCreateInfo layoutCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+			.pNext = &bindingFlagsCreate,
+			.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+			.bindingCount = 1,
+			.pBindings = &layoutBinding
+		};
+		cranvk_check(vkCreateDescriptorSetLayout(vkDevice->devices.logicalDevice, &layoutCreate, cranvk_no_allocator, &vkDevice->bindless.layout));
+
+		VkDescriptorPoolSize poolSize = { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = vkDevice->bindless.descriptorCount };
+		VkDescriptorPoolCreateInfo poolCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+			.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+			.maxSets = 1,
+			.poolSizeCount = 1,
+			.pPoolSizes = &poolSize
+		};
+		cranvk_check(vkCreateDescriptorPool(vkDevice->devices.logicalDevice, &poolCreate, cranvk_no_allocator, &vkDevice->bindless.pool));
+
+		VkDescriptorSetAllocateInfo setAllocate =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = vkDevice->bindless.pool,
+			.descriptorSetCount = 1,
+			.pSetLayouts = &vkDevice->bindless.layout
+		};
+		cranvk_check(vkAllocateDescriptorSets(vkDevice->devices.logicalDevice, &setAllocate, &vkDevice->bindless.set));
+	}
+
 	{
 		VkPipelineCacheCreateInfo pipelineCacheCreate =
 		{
@@ -1032,73 +2817,479 @@ crang_graphics_device_t* crang_create_graphics_device(void* buffer, crang_ctx_t*
 		cranvk_check(vkCreateCommandPool(vkDevice->devices.logicalDevice, &commandPoolCreateInfo, cranvk_no_allocator, &vkDevice->graphicsCommandPool));
 	}
 
-	VkFenceCreateInfo fenceCreateInfo =
 	{
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-		.flags = 0
-	};
-	cranvk_check(vkCreateFence(vkDevice->devices.logicalDevice, &fenceCreateInfo, cranvk_no_allocator, &vkDevice->immediateFence));
+		VkSemaphoreTypeCreateInfoKHR semaphoreTypeCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+			.initialValue = 0
+		};
+
+		VkSemaphoreCreateInfo semaphoreCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &semaphoreTypeCreate
+		};
+		cranvk_check(vkCreateSemaphore(vkDevice->devices.logicalDevice, &semaphoreCreate, cranvk_no_allocator, &vkDevice->timeline.semaphore));
+	}
+
+	{
+		VkSamplerCreateInfo samplerCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+			.magFilter = VK_FILTER_LINEAR,
+			.minFilter = VK_FILTER_LINEAR,
+			.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.maxLod = 0.0f
+		};
+
+		cranvk_check(vkCreateSampler(vkDevice->devices.logicalDevice, &samplerCreate, cranvk_no_allocator, &vkDevice->linearSampler));
+	}
+
+	cranvk_mutex_init(&vkDevice->pipelineCompiler.mutex);
+	cranvk_condition_init(&vkDevice->pipelineCompiler.jobAvailable);
+	cranvk_condition_init(&vkDevice->pipelineCompiler.jobDone);
+
+	cranvk_init_handle_pool(&vkDevice->buffers.pool, vkDevice->buffers.generations, vkDevice->buffers.freeSlots, vkDevice->capacities.bufferCount);
+	cranvk_init_handle_pool(
+		&vkDevice->shaders.descriptorSets.pool, vkDevice->shaders.descriptorSets.generations,
+		vkDevice->shaders.descriptorSets.freeSlots, vkDevice->capacities.shaderInputCount);
 
 	cranvk_create_allocator(&vkDevice->allocator);
 	return (crang_graphics_device_t*)vkDevice;
 }
 
-void crang_destroy_graphics_device(crang_ctx_t* ctx, crang_graphics_device_t* device)
+uint32_t cranvk_buffer_index(cranvk_graphics_device_t* vkDevice, crang_buffer_id_t bufferId)
 {
-	cranvk_ctx_t* vkCtx = (cranvk_ctx_t*)ctx;
-	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	return cranvk_resolve_handle(&vkDevice->buffers.pool, bufferId.id);
+}
 
-	vkDeviceWaitIdle(vkDevice->devices.logicalDevice);
+uint32_t cranvk_shader_input_index(cranvk_graphics_device_t* vkDevice, crang_shader_input_id_t shaderInputId)
+{
+	return cranvk_resolve_handle(&vkDevice->shaders.descriptorSets.pool, shaderInputId.id);
+}
 
-	for (uint32_t i = 0; i < vkDevice->shaders.shaderCount; i++)
+void cranvk_destroy_deferred(cranvk_graphics_device_t* vkDevice, cranvk_deferred_destroy_t const* deferred)
+{
+	if (deferred->type == cranvk_deferred_buffer)
 	{
-		vkDestroyShaderModule(vkDevice->devices.logicalDevice, vkDevice->shaders.shaders[i], cranvk_no_allocator);
-		vkDestroyDescriptorSetLayout(vkDevice->devices.logicalDevice, vkDevice->shaders.descriptorSetLayouts[i], cranvk_no_allocator);
+		VkBuffer* buffer = &vkDevice->buffers.buffers[deferred->index];
+		if (*buffer != VK_NULL_HANDLE)
+		{
+			vkDestroyBuffer(vkDevice->devices.logicalDevice, *buffer, cranvk_no_allocator);
+			cranvk_allocator_free(&vkDevice->allocator, vkDevice->buffers.allocations[deferred->index]);
+			*buffer = VK_NULL_HANDLE;
+		}
+		cranvk_free_handle_slot(&vkDevice->buffers.pool, deferred->index);
 	}
-
-	for (uint32_t i = 0; i < vkDevice->buffers.bufferCount; i++)
+	else
 	{
-		vkDestroyBuffer(vkDevice->devices.logicalDevice, vkDevice->buffers.buffers[i], cranvk_no_allocator);
-		cranvk_allocator_free(&vkDevice->allocator, vkDevice->buffers.allocations[i]);
+		// Frame sets belong to their transient pools, those are reset on their own.
+		VkDescriptorSet* set = &vkDevice->shaders.descriptorSets.sets[deferred->index];
+		if (*set != VK_NULL_HANDLE && !vkDevice->shaders.descriptorSets.transient[deferred->index])
+		{
+			cranvk_check(vkFreeDescriptorSets(vkDevice->devices.logicalDevice, vkDevice->descriptorPool, 1, set));
+		}
+		*set = VK_NULL_HANDLE;
+		cranvk_free_handle_slot(&vkDevice->shaders.descriptorSets.pool, deferred->index);
 	}
+}
 
-	for (uint32_t i = 0; i < vkDevice->pipelines.pipelineCount; i++)
-	{
-		vkDestroyPipeline(vkDevice->devices.logicalDevice, vkDevice->pipelines.pipelines[i], cranvk_no_allocator);
-		vkDestroyPipelineLayout(vkDevice->devices.logicalDevice, vkDevice->pipelines.layouts[i], cranvk_no_allocator);
-	}
+uint64_t cranvk_completed_value(cranvk_graphics_device_t* vkDevice)
+{
+	uint64_t value;
+	cranvk_check(vkDevice->timeline.getCounterValue(vkDevice->devices.logicalDevice, vkDevice->timeline.semaphore, &value));
+	return value;
+}
 
-	vkDestroyFence(vkDevice->devices.logicalDevice, vkDevice->immediateFence, cranvk_no_allocator);
-	cranvk_destroy_allocator(vkDevice->devices.logicalDevice, &vkDevice->allocator);
-	vkDestroyDescriptorPool(vkDevice->devices.logicalDevice, vkDevice->descriptorPool, cranvk_no_allocator);
-	vkDestroyCommandPool(vkDevice->devices.logicalDevice, vkDevice->graphicsCommandPool, cranvk_no_allocator);
-	vkDestroyPipelineCache(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, cranvk_no_allocator);
-	vkDestroyDevice(vkDevice->devices.logicalDevice, cranvk_no_allocator);
+void cranvk_wait_value(cranvk_graphics_device_t* vkDevice, uint64_t value)
+{
+	// Nothing signals values that weren't submitted, we'd wait forever.
+	cranvk_assert(value <= vkDevice->timeline.submittedValue);
+
+	VkSemaphoreWaitInfoKHR waitInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+		.semaphoreCount = 1,
+		.pSemaphores = &vkDevice->timeline.semaphore,
+		.pValues = &value
+	};
+	cranvk_check(vkDevice->timeline.waitSemaphores(vkDevice->devices.logicalDevice, &waitInfo, UINT64_MAX));
 }
 
-uint32_t cranvk_allocate_framebuffer_from_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent, VkRenderPass renderPass, uint32_t swapchainImageIndex)
+// Releases what the timeline is done with, or everything after waiting on it.
+void cranvk_collect_deferred_destroys(cranvk_graphics_device_t* vkDevice, bool waitAll)
 {
-	// Create the framebuffer
-	uint32_t framebufferIndex;
+	if (waitAll)
 	{
-		framebufferIndex = vkPresent->framebufferData.count++;
-		vkPresent->framebufferData.renderPasses_weak[framebufferIndex] = renderPass;
+		cranvk_wait_value(vkDevice, vkDevice->timeline.submittedValue);
+	}
 
-		VkFramebufferCreateInfo framebufferCreate =
+	uint64_t completedValue = cranvk_completed_value(vkDevice);
+	uint32_t keptCount = 0;
+	for (uint32_t i = 0; i < vkDevice->deferred.count; i++)
+	{
+		cranvk_deferred_destroy_t* deferred = &vkDevice->deferred.destroys[i];
+		if (deferred->value <= completedValue)
 		{
-			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-			.attachmentCount = 1,
-			.width = vkPresent->surfaceExtents.width,
-			.height = vkPresent->surfaceExtents.height,
-			.layers = 1,
-			.renderPass = renderPass,
-			.pAttachments = &vkPresent->swapchainData.imageViews[swapchainImageIndex]
-		};
-
-		cranvk_check(vkCreateFramebuffer(vkDevice->devices.logicalDevice, &framebufferCreate, cranvk_no_allocator, &vkPresent->framebufferData.framebuffers[framebufferIndex]));
+			cranvk_destroy_deferred(vkDevice, deferred);
+		}
+		else
+		{
+			vkDevice->deferred.destroys[keptCount++] = *deferred;
+		}
 	}
+	vkDevice->deferred.count = keptCount;
+}
 
-	// Tell the swapchain a framebuffer was allocated
+// Queues the recorded destroys, they're released once the timeline reaches value.
+void cranvk_queue_destroys(cranvk_graphics_device_t* vkDevice, cranvk_transient_resources_t* resources, uint64_t value)
+{
+	for (uint32_t i = 0; i < resources->destroyCount; i++)
+	{
+		// Only what was already submitted can be waited on, value always is.
+		if (vkDevice->deferred.count == cranvk_max_deferred_destroy_count)
+		{
+			cranvk_wait_value(vkDevice, vkDevice->timeline.submittedValue);
+			cranvk_collect_deferred_destroys(vkDevice, false);
+			cranvk_assert(vkDevice->deferred.count < cranvk_max_deferred_destroy_count);
+		}
+
+		cranvk_deferred_destroy_t deferred = resources->destroys[i];
+		deferred.value = value;
+		vkDevice->deferred.destroys[vkDevice->deferred.count++] = deferred;
+	}
+	resources->destroyCount = 0;
+}
+
+void cranvk_release_transient_resources(cranvk_graphics_device_t* vkDevice, cranvk_transient_resources_t* resources)
+{
+	// Destroys that were never submitted still wait on whatever else might be using their resources.
+	cranvk_queue_destroys(vkDevice, resources, vkDevice->timeline.submittedValue);
+
+	for (uint32_t i = 0; i < resources->bufferCount; i++)
+	{
+		vkDestroyBuffer(vkDevice->devices.logicalDevice, resources->buffers[i], cranvk_no_allocator);
+	}
+
+	for (uint32_t i = 0; i < resources->allocationCount; i++)
+	{
+		cranvk_allocator_free(&vkDevice->allocator, resources->allocations[i]);
+	}
+
+	resources->bufferCount = 0;
+	resources->allocationCount = 0;
+}
+
+void crang_destroy_graphics_device(crang_ctx_t* ctx, crang_graphics_device_t* device)
+{
+	cranvk_ctx_t* vkCtx = (cranvk_ctx_t*)ctx;
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	// Waits on everything that was submitted.
+	cranvk_collect_deferred_destroys(vkDevice, true);
+
+	for (uint32_t i = 0; i < vkDevice->commandBuffers.bufferCount; i++)
+	{
+		cranvk_release_transient_resources(vkDevice, &vkDevice->commandBuffers.singleUseResources[i]);
+	}
+	cranvk_collect_deferred_destroys(vkDevice, false);
+
+	cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+	vkDevice->pipelineCompiler.shutdown = true;
+	cranvk_condition_broadcast(&vkDevice->pipelineCompiler.jobAvailable);
+	cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+	for (uint32_t i = 0; i < vkDevice->pipelineCompiler.threadCount; i++)
+	{
+		cranvk_thread_join(vkDevice->pipelineCompiler.threads[i]);
+	}
+	cranvk_condition_destroy(&vkDevice->pipelineCompiler.jobDone);
+	cranvk_condition_destroy(&vkDevice->pipelineCompiler.jobAvailable);
+	cranvk_mutex_destroy(&vkDevice->pipelineCompiler.mutex);
+
+	for (uint32_t i = 0; i < vkDevice->shaderModules.moduleCount; i++)
+	{
+		vkDestroyShaderModule(vkDevice->devices.logicalDevice, vkDevice->shaderModules.modules[i], cranvk_no_allocator);
+	}
+
+	for (uint32_t i = 0; i < vkDevice->shaders.shaderCount; i++)
+	{
+		vkDestroyDescriptorSetLayout(vkDevice->devices.logicalDevice, vkDevice->shaders.descriptorSetLayouts[i], cranvk_no_allocator);
+		if (vkDevice->shaders.updateTemplates[i] != VK_NULL_HANDLE)
+		{
+			vkDestroyDescriptorUpdateTemplate(vkDevice->devices.logicalDevice, vkDevice->shaders.updateTemplates[i], cranvk_no_allocator);
+		}
+	}
+
+	// Destroyed and never created slots are left as null handles.
+	for (uint32_t i = 0; i < vkDevice->buffers.pool.slotCount; i++)
+	{
+		if (vkDevice->buffers.buffers[i] != VK_NULL_HANDLE)
+		{
+			vkDestroyBuffer(vkDevice->devices.logicalDevice, vkDevice->buffers.buffers[i], cranvk_no_allocator);
+			cranvk_allocator_free(&vkDevice->allocator, vkDevice->buffers.allocations[i]);
+		}
+	}
+
+	for (uint32_t i = 0; i < vkDevice->pipelines.pipelineCount; i++)
+	{
+		vkDestroyPipeline(vkDevice->devices.logicalDevice, vkDevice->pipelines.pipelines[i], cranvk_no_allocator);
+	}
+
+	for (uint32_t i = 0; i < vkDevice->pipelineLayouts.layoutCount; i++)
+	{
+		vkDestroyPipelineLayout(vkDevice->devices.logicalDevice, vkDevice->pipelineLayouts.layouts[i], cranvk_no_allocator);
+	}
+
+	vkDestroySemaphore(vkDevice->devices.logicalDevice, vkDevice->timeline.semaphore, cranvk_no_allocator);
+	vkDestroySampler(vkDevice->devices.logicalDevice, vkDevice->linearSampler, cranvk_no_allocator);
+	cranvk_destroy_allocator(vkDevice->devices.logicalDevice, &vkDevice->allocator);
+	vkDestroyDescriptorPool(vkDevice->devices.logicalDevice, vkDevice->descriptorPool, cranvk_no_allocator);
+	if (vkDevice->bindless.supported)
+	{
+		vkDestroyDescriptorPool(vkDevice->devices.logicalDevice, vkDevice->bindless.pool, cranvk_no_allocator);
+		vkDestroyDescriptorSetLayout(vkDevice->devices.logicalDevice, vkDevice->bindless.layout, cranvk_no_allocator);
+	}
+	vkDestroyCommandPool(vkDevice->devices.logicalDevice, vkDevice->graphicsCommandPool, cranvk_no_allocator);
+	vkDestroyPipelineCache(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, cranvk_no_allocator);
+	vkDestroyDevice(vkDevice->devices.logicalDevice, cranvk_no_allocator);
+}
+
+#define cranvk_pipeline_cache_magic 0x43505243 // CRPC
+#define cranvk_pipeline_cache_version 1
+
+// Our own header in front of the driver's blob. The driver validates its own header too,
+// but not all of them check the driver version or catch truncated and corrupted data.
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t uuid[VK_UUID_SIZE];
+	uint64_t dataSize;
+	uint64_t dataHash;
+} cranvk_pipeline_cache_header_t;
+
+bool crang_load_pipeline_cache(crang_graphics_device_t* device, void const* data, unsigned int size)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	cranvk_pipeline_cache_header_t header;
+	if (size < sizeof(cranvk_pipeline_cache_header_t))
+	{
+		return false;
+	}
+	memcpy(&header, data, sizeof(cranvk_pipeline_cache_header_t));
+
+	uint8_t const* cacheData = (uint8_t const*)data + sizeof(cranvk_pipeline_cache_header_t);
+	if (header.magic != cranvk_pipeline_cache_magic
+		|| header.version != cranvk_pipeline_cache_version
+		|| header.vendorID != vkDevice->pipelineCacheIdentity.vendorID
+		|| header.deviceID != vkDevice->pipelineCacheIdentity.deviceID
+		|| header.driverVersion != vkDevice->pipelineCacheIdentity.driverVersion
+		|| memcmp(header.uuid, vkDevice->pipelineCacheIdentity.uuid, VK_UUID_SIZE) != 0
+		|| header.dataSize != size - sizeof(cranvk_pipeline_cache_header_t)
+		|| header.dataHash != cranvk_hash(cranvk_hash_seed, cacheData, (size_t)header.dataSize))
+	{
+		return false;
+	}
+
+	// The driver's header has to agree as well, it would silently start from an empty cache otherwise.
+	VkPipelineCacheHeaderVersionOne driverHeader;
+	if (header.dataSize < sizeof(VkPipelineCacheHeaderVersionOne))
+	{
+		return false;
+	}
+	memcpy(&driverHeader, cacheData, sizeof(VkPipelineCacheHeaderVersionOne));
+	if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		|| driverHeader.vendorID != vkDevice->pipelineCacheIdentity.vendorID
+		|| driverHeader.deviceID != vkDevice->pipelineCacheIdentity.deviceID
+		|| memcmp(driverHeader.pipelineCacheUUID, vkDevice->pipelineCacheIdentity.uuid, VK_UUID_SIZE) != 0)
+	{
+		return false;
+	}
+
+	VkPipelineCacheCreateInfo pipelineCacheCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = (size_t)header.dataSize,
+		.pInitialData = cacheData
+	};
+
+	VkPipelineCache loadedCache;
+	cranvk_check(vkCreatePipelineCache(vkDevice->devices.logicalDevice, &pipelineCacheCreate, cranvk_no_allocator, &loadedCache));
+	cranvk_check(vkMergePipelineCaches(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, 1, &loadedCache));
+	vkDestroyPipelineCache(vkDevice->devices.logicalDevice, loadedCache, cranvk_no_allocator);
+	return true;
+}
+
+unsigned int crang_pipeline_cache_size(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	size_t dataSize;
+	cranvk_check(vkGetPipelineCacheData(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, &dataSize, NULL));
+	return (unsigned int)(sizeof(cranvk_pipeline_cache_header_t) + dataSize);
+}
+
+unsigned int crang_save_pipeline_cache(crang_graphics_device_t* device, void* data, unsigned int size)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	if (size < sizeof(cranvk_pipeline_cache_header_t))
+	{
+		return 0;
+	}
+
+	uint8_t* cacheData = (uint8_t*)data + sizeof(cranvk_pipeline_cache_header_t);
+	size_t dataSize = size - sizeof(cranvk_pipeline_cache_header_t);
+	// VK_INCOMPLETE still writes a valid prefix, but a partial cache isn't worth saving.
+	if (vkGetPipelineCacheData(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, &dataSize, cacheData) != VK_SUCCESS)
+	{
+		return 0;
+	}
+
+	cranvk_pipeline_cache_header_t header =
+	{
+		.magic = cranvk_pipeline_cache_magic,
+		.version = cranvk_pipeline_cache_version,
+		.vendorID = vkDevice->pipelineCacheIdentity.vendorID,
+		.deviceID = vkDevice->pipelineCacheIdentity.deviceID,
+		.driverVersion = vkDevice->pipelineCacheIdentity.driverVersion,
+		.dataSize = dataSize,
+		.dataHash = cranvk_hash(cranvk_hash_seed, cacheData, dataSize)
+	};
+	memcpy(header.uuid, vkDevice->pipelineCacheIdentity.uuid, VK_UUID_SIZE);
+	memcpy(data, &header, sizeof(cranvk_pipeline_cache_header_t));
+
+	return (unsigned int)(sizeof(cranvk_pipeline_cache_header_t) + dataSize);
+}
+
+unsigned int crang_uniform_buffer_alignment(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	return (unsigned int)vkDevice->limits.minUniformBufferOffsetAlignment;
+}
+
+bool crang_bindless_supported(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	return vkDevice->bindless.supported;
+}
+
+unsigned int crang_bindless_index(crang_buffer_id_t bufferId)
+{
+	return bufferId.id & cranvk_handle_index_mask;
+}
+
+bool crang_extended_dynamic_state_supported(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	return vkDevice->extendedDynamicState.supported;
+}
+
+unsigned long long crang_get_submitted_value(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	return vkDevice->timeline.submittedValue;
+}
+
+unsigned long long crang_get_completed_value(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	return cranvk_completed_value(vkDevice);
+}
+
+void crang_wait_value(crang_graphics_device_t* device, unsigned long long value)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_wait_value(vkDevice, value);
+}
+
+void cranvk_create_depth_buffer(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent)
+{
+	VkImageCreateInfo imageCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = VK_FORMAT_D32_SFLOAT,
+		.extent = { .width = vkPresent->surfaceExtents.width, .height = vkPresent->surfaceExtents.height, .depth = 1 },
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+	};
+	cranvk_check(vkCreateImage(vkDevice->devices.logicalDevice, &imageCreate, cranvk_no_allocator, &vkPresent->depth.image));
+
+	// Screen sized, bigger than our allocator's pools.
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(vkDevice->devices.logicalDevice, vkPresent->depth.image, &memoryRequirements);
+
+	uint32_t memoryIndex = cranvk_find_memory_index(vkDevice->devices.physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+	cranvk_assert(memoryIndex != UINT32_MAX);
+
+	VkMemoryAllocateInfo memoryAllocate =
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = memoryRequirements.size,
+		.memoryTypeIndex = memoryIndex
+	};
+	cranvk_check(vkAllocateMemory(vkDevice->devices.logicalDevice, &memoryAllocate, cranvk_no_allocator, &vkPresent->depth.memory));
+	cranvk_check(vkBindImageMemory(vkDevice->devices.logicalDevice, vkPresent->depth.image, vkPresent->depth.memory, 0));
+
+	VkImageViewCreateInfo imageViewCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+		.subresourceRange.baseMipLevel = 0,
+		.subresourceRange.levelCount = 1,
+		.subresourceRange.baseArrayLayer = 0,
+		.subresourceRange.layerCount = 1,
+		.image = vkPresent->depth.image,
+		.format = VK_FORMAT_D32_SFLOAT
+	};
+	cranvk_check(vkCreateImageView(vkDevice->devices.logicalDevice, &imageViewCreate, cranvk_no_allocator, &vkPresent->depth.view));
+}
+
+void cranvk_destroy_depth_buffer(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent)
+{
+	vkDestroyImageView(vkDevice->devices.logicalDevice, vkPresent->depth.view, cranvk_no_allocator);
+	vkDestroyImage(vkDevice->devices.logicalDevice, vkPresent->depth.image, cranvk_no_allocator);
+	vkFreeMemory(vkDevice->devices.logicalDevice, vkPresent->depth.memory, cranvk_no_allocator);
+}
+
+// Returns the attachment count, the swapchain image followed by the depth buffer if we have one.
+uint32_t cranvk_get_framebuffer_attachments(cranvk_present_t* vkPresent, uint32_t swapchainImageIndex, VkImageView attachments[2])
+{
+	attachments[0] = vkPresent->swapchainData.imageViews[swapchainImageIndex];
+	attachments[1] = vkPresent->depth.view;
+	return vkPresent->depthEnabled ? 2 : 1;
+}
+
+uint32_t cranvk_allocate_framebuffer_from_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent, VkRenderPass renderPass, uint32_t swapchainImageIndex)
+{
+	cranvk_unused(vkDevice);
+	cranvk_assert(vkPresent->framebufferData.count < cranvk_max_framebuffer_count);
+
+	// The framebuffer itself is created by cranvk_get_framebuffer
+	uint32_t framebufferIndex;
+	{
+		framebufferIndex = vkPresent->framebufferData.count++;
+		vkPresent->framebufferData.renderPasses_weak[framebufferIndex] = renderPass;
+		vkPresent->framebufferData.imageIndices[framebufferIndex] = swapchainImageIndex;
+		vkPresent->framebufferData.framebuffers[framebufferIndex] = VK_NULL_HANDLE;
+	}
+
+	// Tell the swapchain a framebuffer was allocated
 	{
 		uint32_t nextSwapchainFramebuffer = vkPresent->swapchainData.allocatedFramebuffers.count++;
 		vkPresent->swapchainData.allocatedFramebuffers.framebufferIndices[nextSwapchainFramebuffer] = framebufferIndex;
@@ -1108,48 +3299,140 @@ uint32_t cranvk_allocate_framebuffer_from_swapchain(cranvk_graphics_device_t* vk
 	return framebufferIndex;
 }
 
+VkFramebuffer cranvk_get_framebuffer(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent, uint32_t framebufferIndex)
+{
+	VkFramebuffer* framebuffer = &vkPresent->framebufferData.framebuffers[framebufferIndex];
+	if (*framebuffer == VK_NULL_HANDLE)
+	{
+		VkImageView attachments[2];
+		VkFramebufferCreateInfo framebufferCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+			.attachmentCount = cranvk_get_framebuffer_attachments(vkPresent, vkPresent->framebufferData.imageIndices[framebufferIndex], attachments),
+			.width = vkPresent->surfaceExtents.width,
+			.height = vkPresent->surfaceExtents.height,
+			.layers = 1,
+			.renderPass = vkPresent->framebufferData.renderPasses_weak[framebufferIndex],
+			.pAttachments = attachments
+		};
+
+		cranvk_check(vkCreateFramebuffer(vkDevice->devices.logicalDevice, &framebufferCreate, cranvk_no_allocator, framebuffer));
+	}
+
+	return *framebuffer;
+}
+
 void cranvk_create_render_pass(cranvk_render_pass_t* vkRenderPass, cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent)
 {
 	// TODO: We'll want to be able to define our render pass here.
 	{
+		// Headless images are never presented, they're left ready for the readback copy instead.
+		VkImageLayout colorFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		if (vkPresent->headless)
+		{
+			colorFinalLayout = vkPresent->readback ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+
 		VkAttachmentDescription colorAttachment =
 		{
 			.samples = VK_SAMPLE_COUNT_1_BIT,
 			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
 			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
 			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-			.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			.finalLayout = colorFinalLayout,
 			.format = vkPresent->surfaceFormat.format
 		};
 
+		// Depth is only needed while rendering, it isn't stored.
+		VkAttachmentDescription depthAttachment =
+		{
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			.format = VK_FORMAT_D32_SFLOAT
+		};
+		VkAttachmentDescription attachments[2] = { colorAttachment, depthAttachment };
+
 		VkAttachmentReference colorReference =
 		{
 			.attachment = 0,
 			.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
 		};
 
+		VkAttachmentReference depthReference =
+		{
+			.attachment = 1,
+			.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		};
+
 		VkSubpassDescription subpass =
 		{
 			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
 			.colorAttachmentCount = 1,
-			.pColorAttachments = &colorReference
+			.pColorAttachments = &colorReference,
+			.pDepthStencilAttachment = vkPresent->depthEnabled ? &depthReference : NULL
+		};
+
+		// The color attachment's transition and clear have to wait for the acquire, which waits on color output.
+		VkSubpassDependency externalDependency =
+		{
+			.srcSubpass = VK_SUBPASS_EXTERNAL,
+			.dstSubpass = 0,
+			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		};
+
+		// Every frame shares the depth buffer, the previous frame's depth tests need to be done before we clear it.
+		if (vkPresent->depthEnabled)
+		{
+			externalDependency.srcStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			externalDependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			externalDependency.srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			externalDependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		}
+
+		// The readback copy is recorded right after the render pass.
+		VkSubpassDependency readbackDependency =
+		{
+			.srcSubpass = 0,
+			.dstSubpass = VK_SUBPASS_EXTERNAL,
+			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
 		};
 
+		VkSubpassDependency dependencies[2];
+		uint32_t dependencyCount = 0;
+		dependencies[dependencyCount++] = externalDependency;
+
+		if (vkPresent->readback)
+		{
+			dependencies[dependencyCount++] = readbackDependency;
+		}
+
 		VkRenderPassCreateInfo createRenderPass =
 		{
 			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-			.attachmentCount = 1,
+			.attachmentCount = vkPresent->depthEnabled ? 2 : 1,
 			.subpassCount = 1,
-			.dependencyCount = 0,
-			.pDependencies = NULL,
-			.pAttachments = &colorAttachment,
+			.dependencyCount = dependencyCount,
+			.pDependencies = dependencies,
+			.pAttachments = attachments,
 			.pSubpasses = &subpass
 		};
 
 		cranvk_check(vkCreateRenderPass(vkDevice->devices.logicalDevice, &createRenderPass, cranvk_no_allocator, &vkRenderPass->renderPass));
+		vkRenderPass->renderPassId = vkDevice->nextRenderPassId++;
 	}
 
-	for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
+	for (uint32_t i = 0; i < vkPresent->swapchainData.imageCount; i++)
 	{
 		vkRenderPass->framebufferIndices[i] = cranvk_allocate_framebuffer_from_swapchain(vkDevice, vkPresent, vkRenderPass->renderPass, i);
 	}
@@ -1162,13 +3445,106 @@ void cranvk_destroy_render_pass(cranvk_graphics_device_t* device, cranvk_render_
 	vkDestroyRenderPass(vkDevice->devices.logicalDevice, vkRenderPass->renderPass, cranvk_no_allocator);
 }
 
+void cranvk_destroy_retired_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_retired_swapchain_t* retired)
+{
+	for (uint32_t i = 0; i < retired->framebufferCount; i++)
+	{
+		vkDestroyFramebuffer(vkDevice->devices.logicalDevice, retired->framebuffers[i], cranvk_no_allocator);
+	}
+
+	for (uint32_t i = 0; i < retired->imageViewCount; i++)
+	{
+		vkDestroyImageView(vkDevice->devices.logicalDevice, retired->imageViews[i], cranvk_no_allocator);
+	}
+
+	if (retired->hasDepth)
+	{
+		vkDestroyImageView(vkDevice->devices.logicalDevice, retired->depthView, cranvk_no_allocator);
+		vkDestroyImage(vkDevice->devices.logicalDevice, retired->depthImage, cranvk_no_allocator);
+		vkFreeMemory(vkDevice->devices.logicalDevice, retired->depthMemory, cranvk_no_allocator);
+	}
+
+	vkDestroySwapchainKHR(vkDevice->devices.logicalDevice, retired->swapchain, cranvk_no_allocator);
+}
+
+// Destroys the retired swapchains that no frame in flight can reference anymore, or all of them after waiting on the timeline.
+void cranvk_collect_retired_swapchains(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent, bool waitAll)
+{
+	if (waitAll)
+	{
+		cranvk_wait_value(vkDevice, vkDevice->timeline.submittedValue);
+	}
+
+	uint64_t completedValue = cranvk_completed_value(vkDevice);
+	uint32_t keptCount = 0;
+	for (uint32_t i = 0; i < vkPresent->retired.count; i++)
+	{
+		cranvk_retired_swapchain_t* retired = &vkPresent->retired.swapchains[i];
+		if (retired->value <= completedValue)
+		{
+			cranvk_destroy_retired_swapchain(vkDevice, retired);
+		}
+		else
+		{
+			vkPresent->retired.swapchains[keptCount++] = *retired;
+		}
+	}
+	vkPresent->retired.count = keptCount;
+}
+
+// Moves everything tied to the old swapchain to the retired list, the framebuffers are recreated on their next use.
+void cranvk_retire_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent, VkSwapchainKHR oldSwapchain)
+{
+	// Resizing every frame could outpace the frames in flight, only then do we wait.
+	if (vkPresent->retired.count == cranvk_max_retired_swapchain_count)
+	{
+		cranvk_collect_retired_swapchains(vkDevice, vkPresent, true);
+	}
+
+	cranvk_retired_swapchain_t* retired = &vkPresent->retired.swapchains[vkPresent->retired.count++];
+	*retired = (cranvk_retired_swapchain_t)
+	{
+		.swapchain = oldSwapchain,
+		.imageViewCount = vkPresent->swapchainData.imageCount,
+		.hasDepth = vkPresent->depthEnabled,
+		.depthImage = vkPresent->depth.image,
+		.depthView = vkPresent->depth.view,
+		.depthMemory = vkPresent->depth.memory,
+		.value = vkDevice->timeline.submittedValue
+	};
+	memcpy(retired->imageViews, vkPresent->swapchainData.imageViews, sizeof(VkImageView) * vkPresent->swapchainData.imageCount);
+
+	for (uint32_t i = 0; i < vkPresent->swapchainData.allocatedFramebuffers.count; i++)
+	{
+		uint32_t framebufferIndex = vkPresent->swapchainData.allocatedFramebuffers.framebufferIndices[i];
+		if (vkPresent->framebufferData.framebuffers[framebufferIndex] != VK_NULL_HANDLE)
+		{
+			retired->framebuffers[retired->framebufferCount++] = vkPresent->framebufferData.framebuffers[framebufferIndex];
+			vkPresent->framebufferData.framebuffers[framebufferIndex] = VK_NULL_HANDLE;
+		}
+	}
+}
+
 void cranvk_create_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_surface_t* vkSurface, cranvk_present_t* vkPresent, VkSwapchainKHR oldSwapchain)
 {
+	uint32_t minImageCount = vkPresent->requestedImageCount;
+	{
+		VkSurfaceCapabilitiesKHR surfaceCapabilities;
+		cranvk_check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceCapabilities));
+
+		minImageCount = minImageCount > surfaceCapabilities.minImageCount ? minImageCount : surfaceCapabilities.minImageCount;
+		// A max of 0 means there's no limit
+		if (surfaceCapabilities.maxImageCount > 0)
+		{
+			minImageCount = minImageCount < surfaceCapabilities.maxImageCount ? minImageCount : surfaceCapabilities.maxImageCount;
+		}
+	}
+
 	VkSwapchainCreateInfoKHR swapchainCreate =
 	{
 		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
 		.pNext = NULL,
-		.minImageCount = cranvk_render_buffer_count,
+		.minImageCount = minImageCount,
 		.imageArrayLayers = 1,
 		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
 		.surface = vkSurface->surface,
@@ -1204,18 +3580,7 @@ void cranvk_create_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_surface_
 
 	if (oldSwapchain != VK_NULL_HANDLE)
 	{
-		vkDestroySwapchainKHR(vkDevice->devices.logicalDevice, oldSwapchain, cranvk_no_allocator);
-
-		for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
-		{
-			vkDestroyImageView(vkDevice->devices.logicalDevice, vkPresent->swapchainData.imageViews[i], cranvk_no_allocator);
-		}
-
-		for (uint32_t i = 0; i < vkPresent->swapchainData.allocatedFramebuffers.count; i++)
-		{
-			uint32_t framebufferIndex = vkPresent->swapchainData.allocatedFramebuffers.framebufferIndices[i];
-			vkDestroyFramebuffer(vkDevice->devices.logicalDevice, vkPresent->framebufferData.framebuffers[framebufferIndex], cranvk_no_allocator);
-		}
+		cranvk_retire_swapchain(vkDevice, vkPresent, oldSwapchain);
 	}
 
 	uint32_t imageCount = 0;
@@ -1225,7 +3590,15 @@ void cranvk_create_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_surface_
 	imageCount = imageCount < cranvk_max_physical_image_count ? imageCount : cranvk_max_physical_image_count;
 	cranvk_check(vkGetSwapchainImagesKHR(vkDevice->devices.logicalDevice, vkPresent->swapchainData.swapchain, &imageCount, swapchainPhysicalImages));
 
-	for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
+	// Framebuffers and primary buffers are per image, we rely on getting the same number of images back.
+	cranvk_assert(oldSwapchain == VK_NULL_HANDLE || imageCount == vkPresent->swapchainData.imageCount);
+	vkPresent->swapchainData.imageCount = imageCount;
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		vkPresent->primaryBuffers.valid[i] = false;
+	}
+
+	for (uint32_t i = 0; i < imageCount; i++)
 	{
 		VkImageViewCreateInfo imageViewCreate =
 		{
@@ -1249,26 +3622,115 @@ void cranvk_create_swapchain(cranvk_graphics_device_t* vkDevice, cranvk_surface_
 		cranvk_check(vkCreateImageView(vkDevice->devices.logicalDevice, &imageViewCreate, cranvk_no_allocator, &vkPresent->swapchainData.imageViews[i]));
 	}
 
-	// Recreate the framebuffers that we already had
-	for (uint32_t i = 0; i < vkPresent->swapchainData.allocatedFramebuffers.count; i++)
+	if (vkPresent->depthEnabled)
 	{
-		uint32_t framebufferIndex = vkPresent->swapchainData.allocatedFramebuffers.framebufferIndices[i];
-		uint32_t imageViewIndex = vkPresent->swapchainData.allocatedFramebuffers.imageViewIndices[i];
+		cranvk_create_depth_buffer(vkDevice, vkPresent);
+	}
+}
+
+// Headless presents own their images, they're created once and never resized.
+void cranvk_create_offscreen_targets(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent)
+{
+	vkPresent->swapchainData.imageCount = vkPresent->requestedImageCount;
+	for (uint32_t i = 0; i < vkPresent->swapchainData.imageCount; i++)
+	{
+		VkImageCreateInfo imageCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = vkPresent->surfaceFormat.format,
+			.extent = { .width = vkPresent->surfaceExtents.width, .height = vkPresent->surfaceExtents.height, .depth = 1 },
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+		};
+		cranvk_check(vkCreateImage(vkDevice->devices.logicalDevice, &imageCreate, cranvk_no_allocator, &vkPresent->offscreen.images[i]));
 
-		cranvk_assert(imageViewIndex < cranvk_render_buffer_count);
+		VkMemoryRequirements memoryRequirements;
+		vkGetImageMemoryRequirements(vkDevice->devices.logicalDevice, vkPresent->offscreen.images[i], &memoryRequirements);
 
-		VkFramebufferCreateInfo framebufferCreate =
+		uint32_t memoryIndex = cranvk_find_memory_index(vkDevice->devices.physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+		cranvk_assert(memoryIndex != UINT32_MAX);
+
+		VkMemoryAllocateInfo memoryAllocate =
 		{
-			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-			.attachmentCount = 1,
-			.width = vkPresent->surfaceExtents.width,
-			.height = vkPresent->surfaceExtents.height,
-			.layers = 1,
-			.renderPass = vkPresent->framebufferData.renderPasses_weak[framebufferIndex],
-			.pAttachments = &vkPresent->swapchainData.imageViews[imageViewIndex]
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = memoryRequirements.size,
+			.memoryTypeIndex = memoryIndex
+		};
+		cranvk_check(vkAllocateMemory(vkDevice->devices.logicalDevice, &memoryAllocate, cranvk_no_allocator, &vkPresent->offscreen.memories[i]));
+		cranvk_check(vkBindImageMemory(vkDevice->devices.logicalDevice, vkPresent->offscreen.images[i], vkPresent->offscreen.memories[i], 0));
+
+		VkImageViewCreateInfo imageViewCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.subresourceRange.baseMipLevel = 0,
+			.subresourceRange.levelCount = 1,
+			.subresourceRange.baseArrayLayer = 0,
+			.subresourceRange.layerCount = 1,
+			.image = vkPresent->offscreen.images[i],
+			.format = vkPresent->surfaceFormat.format
 		};
+		cranvk_check(vkCreateImageView(vkDevice->devices.logicalDevice, &imageViewCreate, cranvk_no_allocator, &vkPresent->swapchainData.imageViews[i]));
+
+		vkPresent->swapchainData.imageValues[i] = 0;
+		vkPresent->primaryBuffers.valid[i] = false;
 
-		cranvk_check(vkCreateFramebuffer(vkDevice->devices.logicalDevice, &framebufferCreate, cranvk_no_allocator, &vkPresent->framebufferData.framebuffers[framebufferIndex]));
+		if (vkPresent->readback)
+		{
+			VkBufferCreateInfo bufferCreate =
+			{
+				.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+				.size = (VkDeviceSize)vkPresent->surfaceExtents.width * vkPresent->surfaceExtents.height * 4,
+				.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				.sharingMode = VK_SHARING_MODE_EXCLUSIVE
+			};
+			cranvk_check(vkCreateBuffer(vkDevice->devices.logicalDevice, &bufferCreate, cranvk_no_allocator, &vkPresent->offscreen.readbackBuffers[i]));
+
+			VkMemoryRequirements bufferRequirements;
+			vkGetBufferMemoryRequirements(vkDevice->devices.logicalDevice, vkPresent->offscreen.readbackBuffers[i], &bufferRequirements);
+
+			// Cached memory makes the host reads a lot cheaper when available.
+			uint32_t bufferMemoryIndex = cranvk_find_memory_index(vkDevice->devices.physicalDevice, bufferRequirements.memoryTypeBits,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+			cranvk_assert(bufferMemoryIndex != UINT32_MAX);
+
+			VkMemoryAllocateInfo bufferAllocate =
+			{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				.allocationSize = bufferRequirements.size,
+				.memoryTypeIndex = bufferMemoryIndex
+			};
+			cranvk_check(vkAllocateMemory(vkDevice->devices.logicalDevice, &bufferAllocate, cranvk_no_allocator, &vkPresent->offscreen.readbackMemories[i]));
+			cranvk_check(vkBindBufferMemory(vkDevice->devices.logicalDevice, vkPresent->offscreen.readbackBuffers[i], vkPresent->offscreen.readbackMemories[i], 0));
+			cranvk_check(vkMapMemory(vkDevice->devices.logicalDevice, vkPresent->offscreen.readbackMemories[i], 0, VK_WHOLE_SIZE, 0, &vkPresent->offscreen.readbackData[i]));
+		}
+	}
+
+	if (vkPresent->depthEnabled)
+	{
+		cranvk_create_depth_buffer(vkDevice, vkPresent);
+	}
+}
+
+void cranvk_destroy_offscreen_targets(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent)
+{
+	for (uint32_t i = 0; i < vkPresent->swapchainData.imageCount; i++)
+	{
+		vkDestroyImage(vkDevice->devices.logicalDevice, vkPresent->offscreen.images[i], cranvk_no_allocator);
+		vkFreeMemory(vkDevice->devices.logicalDevice, vkPresent->offscreen.memories[i], cranvk_no_allocator);
+
+		if (vkPresent->readback)
+		{
+			vkDestroyBuffer(vkDevice->devices.logicalDevice, vkPresent->offscreen.readbackBuffers[i], cranvk_no_allocator);
+			vkFreeMemory(vkDevice->devices.logicalDevice, vkPresent->offscreen.readbackMemories[i], cranvk_no_allocator);
+		}
 	}
 }
 
@@ -1277,7 +3739,7 @@ unsigned int crang_present_size(void)
 	return sizeof(cranvk_present_t);
 }
 
-crang_present_t* crang_create_present(void* buffer, crang_graphics_device_t* device, crang_surface_t* surface)
+crang_present_t* crang_create_present(void* buffer, crang_graphics_device_t* device, crang_surface_t* surface, crang_present_desc_t* presentDesc)
 {
 	cranvk_present_t* vkPresent = (cranvk_present_t*)buffer;
 	memset(vkPresent, 0, sizeof(cranvk_present_t));
@@ -1285,100 +3747,122 @@ crang_present_t* crang_create_present(void* buffer, crang_graphics_device_t* dev
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
 	cranvk_surface_t* vkSurface = (cranvk_surface_t*)surface;
 
+	vkPresent->framesInFlight = presentDesc->framesInFlight != 0 ? presentDesc->framesInFlight : cranvk_default_frames_in_flight;
+	vkPresent->requestedImageCount = presentDesc->swapchainImageCount != 0 ? presentDesc->swapchainImageCount : cranvk_default_swapchain_image_count;
+	cranvk_assert(vkPresent->framesInFlight <= cranvk_max_frames_in_flight);
+	cranvk_assert(vkPresent->requestedImageCount <= cranvk_max_physical_image_count);
+	vkPresent->depthEnabled = presentDesc->depth;
+	vkPresent->headless = presentDesc->headless.enabled;
+	vkPresent->pacing.targetFrameMs = presentDesc->targetFrameMs;
+	vkPresent->readback = presentDesc->headless.enabled && presentDesc->headless.readback;
+
 	{
 		VkSemaphoreCreateInfo semaphoreCreateInfo =
 		{
 			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
 		};
 
-		for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
+		for (uint32_t i = 0; i < vkPresent->framesInFlight; i++)
 		{
 			cranvk_check(vkCreateSemaphore(vkDevice->devices.logicalDevice, &semaphoreCreateInfo, cranvk_no_allocator, &vkPresent->acquireSemaphores[i]));
 			cranvk_check(vkCreateSemaphore(vkDevice->devices.logicalDevice, &semaphoreCreateInfo, cranvk_no_allocator, &vkPresent->presentSemaphores[i]));
 		}
 	}
 
+	if (vkPresent->headless)
 	{
-		VkFenceCreateInfo fenceCreateInfo =
-		{
-			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-			.flags = VK_FENCE_CREATE_SIGNALED_BIT
-		};
-
-		for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
-		{
-			cranvk_check(vkCreateFence(vkDevice->devices.logicalDevice, &fenceCreateInfo, cranvk_no_allocator, &vkPresent->presentFences[i]));
-		}
+		cranvk_assert(presentDesc->headless.width > 0 && presentDesc->headless.height > 0);
+		vkPresent->surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
+		vkPresent->surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+		vkPresent->surfaceExtents = (VkExtent2D) { .width = presentDesc->headless.width, .height = presentDesc->headless.height };
+		vkPresent->presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+		vkPresent->presentModeId = crang_present_mode_immediate;
+		cranvk_create_offscreen_targets(vkDevice, vkPresent);
 	}
-
+	else
 	{
-		uint32_t surfaceFormatCount;
-		VkSurfaceFormatKHR surfaceFormats[cranvk_max_physical_device_property_count];
+		{
+			uint32_t surfaceFormatCount;
+			VkSurfaceFormatKHR surfaceFormats[cranvk_max_physical_device_property_count];
 
-		cranvk_check(vkGetPhysicalDeviceSurfaceFormatsKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceFormatCount, NULL));
-		cranvk_assert(surfaceFormatCount > 0);
-		surfaceFormatCount = surfaceFormatCount < cranvk_max_physical_device_property_count ? surfaceFormatCount : cranvk_max_physical_device_property_count;
-		cranvk_check(vkGetPhysicalDeviceSurfaceFormatsKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceFormatCount, surfaceFormats));
+			cranvk_check(vkGetPhysicalDeviceSurfaceFormatsKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceFormatCount, NULL));
+			cranvk_assert(surfaceFormatCount > 0);
+			surfaceFormatCount = surfaceFormatCount < cranvk_max_physical_device_property_count ? surfaceFormatCount : cranvk_max_physical_device_property_count;
+			cranvk_check(vkGetPhysicalDeviceSurfaceFormatsKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceFormatCount, surfaceFormats));
 
-		if (1 == surfaceFormatCount && VK_FORMAT_UNDEFINED == surfaceFormats[0].format)
-		{
-			vkPresent->surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
-			vkPresent->surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-		}
-		else
-		{
-			vkPresent->surfaceFormat = surfaceFormats[0];
-			for (uint32_t i = 0; i < surfaceFormatCount; i++)
+			if (1 == surfaceFormatCount && VK_FORMAT_UNDEFINED == surfaceFormats[0].format)
+			{
+				vkPresent->surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
+				vkPresent->surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+			}
+			else
 			{
-				if (VK_FORMAT_R8G8B8A8_UNORM == surfaceFormats[i].format && VK_COLORSPACE_SRGB_NONLINEAR_KHR == surfaceFormats[i].colorSpace)
+				vkPresent->surfaceFormat = surfaceFormats[0];
+				for (uint32_t i = 0; i < surfaceFormatCount; i++)
 				{
-					vkPresent->surfaceFormat = surfaceFormats[i];
-					break;
+					if (VK_FORMAT_R8G8B8A8_UNORM == surfaceFormats[i].format && VK_COLORSPACE_SRGB_NONLINEAR_KHR == surfaceFormats[i].colorSpace)
+					{
+						vkPresent->surfaceFormat = surfaceFormats[i];
+						break;
+					}
 				}
 			}
 		}
-	}
 
-	{
-		VkSurfaceCapabilitiesKHR surfaceCapabilities;
-		cranvk_check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceCapabilities));
+		{
+			VkSurfaceCapabilitiesKHR surfaceCapabilities;
+			cranvk_check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceCapabilities));
 
-		cranvk_assert(surfaceCapabilities.currentExtent.width != UINT32_MAX);
-		vkPresent->surfaceExtents = surfaceCapabilities.currentExtent;
-	}
+			cranvk_assert(surfaceCapabilities.currentExtent.width != UINT32_MAX);
+			vkPresent->surfaceExtents = surfaceCapabilities.currentExtent;
+		}
 
-	vkPresent->presentMode = VK_PRESENT_MODE_FIFO_KHR;
-	{
-		uint32_t presentModeCount;
-		VkPresentModeKHR presentModes[cranvk_max_physical_device_property_count];
+		vkPresent->presentMode = VK_PRESENT_MODE_FIFO_KHR;
+		vkPresent->presentModeId = crang_present_mode_fifo;
+		{
+			uint32_t presentModeCount;
+			VkPresentModeKHR presentModes[cranvk_max_physical_device_property_count];
 
-		cranvk_check(vkGetPhysicalDeviceSurfacePresentModesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &presentModeCount, NULL));
-		cranvk_assert(presentModeCount > 0);
-		presentModeCount = presentModeCount < cranvk_max_physical_device_property_count ? presentModeCount : cranvk_max_physical_device_property_count;
-		cranvk_check(vkGetPhysicalDeviceSurfacePresentModesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &presentModeCount, presentModes));
+			cranvk_check(vkGetPhysicalDeviceSurfacePresentModesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &presentModeCount, NULL));
+			cranvk_assert(presentModeCount > 0);
+			presentModeCount = presentModeCount < cranvk_max_physical_device_property_count ? presentModeCount : cranvk_max_physical_device_property_count;
+			cranvk_check(vkGetPhysicalDeviceSurfacePresentModesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &presentModeCount, presentModes));
 
-		for (uint32_t i = 0; i < presentModeCount; i++)
-		{
-			if (VK_PRESENT_MODE_MAILBOX_KHR == presentModes[i])
+			crang_present_mode_e defaultPreference = crang_present_mode_mailbox;
+			crang_present_mode_e* preferences = presentDesc->presentModes.count > 0 ? presentDesc->presentModes.modes : &defaultPreference;
+			uint32_t preferenceCount = presentDesc->presentModes.count > 0 ? presentDesc->presentModes.count : 1;
+
+			bool found = false;
+			for (uint32_t preference = 0; preference < preferenceCount && !found; preference++)
 			{
-				vkPresent->presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-				break;
+				cranvk_assert(preferences[preference] < crang_present_mode_max);
+				VkPresentModeKHR mode = cranvk_present_mode_conversion_table[preferences[preference]];
+				for (uint32_t i = 0; i < presentModeCount; i++)
+				{
+					if (mode == presentModes[i])
+					{
+						vkPresent->presentMode = mode;
+						vkPresent->presentModeId = preferences[preference];
+						found = true;
+						break;
+					}
+				}
 			}
 		}
-	}
 
-	cranvk_create_swapchain(vkDevice, vkSurface, vkPresent, VK_NULL_HANDLE);
+		cranvk_create_swapchain(vkDevice, vkSurface, vkPresent, VK_NULL_HANDLE);
+	}
 
 	{
 		VkCommandBufferAllocateInfo commandBufferAllocateInfo =
 		{
 			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			.commandBufferCount = cranvk_render_buffer_count,
+			.commandBufferCount = vkPresent->swapchainData.imageCount,
 			.commandPool = vkDevice->graphicsCommandPool
 		};
 
-		cranvk_check(vkAllocateCommandBuffers(vkDevice->devices.logicalDevice, &commandBufferAllocateInfo, vkPresent->primaryRenderBuffers));
+		cranvk_check(vkAllocateCommandBuffers(vkDevice->devices.logicalDevice, &commandBufferAllocateInfo, vkPresent->primaryBuffers.buffers));
 	}
 
 	vkPresent->backBufferIndex = 0;
@@ -1392,11 +3876,21 @@ void crang_destroy_present(crang_graphics_device_t* device, crang_present_t* pre
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
 	cranvk_present_t* vkPresent = (cranvk_present_t*)presentCtx;
 
-	vkDeviceWaitIdle(vkDevice->devices.logicalDevice);
+	// The timeline covers our frames, the presentation engine might still be holding on to the present semaphores.
+	cranvk_collect_retired_swapchains(vkDevice, vkPresent, true);
+	if (!vkPresent->headless)
+	{
+		cranvk_check(vkQueueWaitIdle(vkDevice->queues.presentQueue));
+	}
 
 	cranvk_destroy_render_pass(vkDevice, &vkPresent->presentRenderPass);
 
-	for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
+	if (vkPresent->depthEnabled)
+	{
+		cranvk_destroy_depth_buffer(vkDevice, vkPresent);
+	}
+
+	for (uint32_t i = 0; i < vkPresent->swapchainData.imageCount; i++)
 	{
 		vkDestroyImageView(vkDevice->devices.logicalDevice, vkPresent->swapchainData.imageViews[i], cranvk_no_allocator);
 	}
@@ -1406,384 +3900,2150 @@ void crang_destroy_present(crang_graphics_device_t* device, crang_present_t* pre
 		vkDestroyFramebuffer(vkDevice->devices.logicalDevice, vkPresent->framebufferData.framebuffers[i], cranvk_no_allocator);
 	}
 
-	for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
+	for (uint32_t i = 0; i < vkPresent->framesInFlight; i++)
 	{
 		vkDestroySemaphore(vkDevice->devices.logicalDevice, vkPresent->acquireSemaphores[i], cranvk_no_allocator);
 		vkDestroySemaphore(vkDevice->devices.logicalDevice, vkPresent->presentSemaphores[i], cranvk_no_allocator);
 	}
 
-	for (uint32_t i = 0; i < cranvk_render_buffer_count; i++)
+	for (uint32_t i = 0; i < vkPresent->framesInFlight; i++)
+	{
+		for (uint32_t pool = 0; pool < vkPresent->transientDescriptors[i].poolCount; pool++)
+		{
+			vkDestroyDescriptorPool(vkDevice->devices.logicalDevice, vkPresent->transientDescriptors[i].pools[pool], cranvk_no_allocator);
+		}
+	}
+
+	if (vkPresent->headless)
+	{
+		cranvk_destroy_offscreen_targets(vkDevice, vkPresent);
+	}
+	else
+	{
+		vkDestroySwapchainKHR(vkDevice->devices.logicalDevice, vkPresent->swapchainData.swapchain, cranvk_no_allocator);
+	}
+}
+
+void crang_present_stats(crang_present_t* presentCtx, crang_present_stats_t* stats)
+{
+	cranvk_present_t* vkPresent = (cranvk_present_t*)presentCtx;
+	*stats = (crang_present_stats_t)
+	{
+		.lastLatencyMs = vkPresent->latency.lastLatencyMs,
+		.averageLatencyMs = vkPresent->latency.averageLatencyMs,
+		.framesInFlight = vkPresent->framesInFlight,
+		.swapchainImageCount = vkPresent->swapchainData.imageCount,
+		.width = vkPresent->surfaceExtents.width,
+		.height = vkPresent->surfaceExtents.height,
+		.presentMode = vkPresent->presentModeId
+	};
+}
+
+unsigned int crang_present_pop_frame_timings(crang_present_t* presentCtx, crang_frame_timing_t* timings, unsigned int maxCount)
+{
+	cranvk_present_t* vkPresent = (cranvk_present_t*)presentCtx;
+
+	uint32_t count = vkPresent->latency.completedCount < maxCount ? vkPresent->latency.completedCount : maxCount;
+	for (uint32_t i = 0; i < count; i++)
 	{
-		vkDestroyFence(vkDevice->devices.logicalDevice, vkPresent->presentFences[i], cranvk_no_allocator);
+		timings[i] = vkPresent->latency.completed[(vkPresent->latency.completedStart + i) % cranvk_max_frame_timing_count];
 	}
 
-	vkDestroySwapchainKHR(vkDevice->devices.logicalDevice, vkPresent->swapchainData.swapchain, cranvk_no_allocator);
+	vkPresent->latency.completedStart = (vkPresent->latency.completedStart + count) % cranvk_max_frame_timing_count;
+	vkPresent->latency.completedCount -= count;
+	return count;
+}
+
+double crang_time_ms(void)
+{
+	return cranvk_time_ms();
 }
 
-void cranvk_resize_present(cranvk_graphics_device_t* vkDevice, cranvk_surface_t* vkSurface, cranvk_present_t* vkPresent)
+bool crang_present_read_frame(crang_graphics_device_t* device, crang_present_t* presentCtx, void* data)
 {
-	vkDeviceWaitIdle(vkDevice->devices.logicalDevice);
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_present_t* vkPresent = (cranvk_present_t*)presentCtx;
+	cranvk_assert(vkPresent->readback);
+
+	if (!vkPresent->offscreen.hasFrame)
+	{
+		return false;
+	}
+
+	cranvk_wait_value(vkDevice, vkPresent->offscreen.lastValue);
+	memcpy(data, vkPresent->offscreen.readbackData[vkPresent->offscreen.lastImage], (size_t)vkPresent->surfaceExtents.width * vkPresent->surfaceExtents.height * 4);
+	return true;
+}
 
+// Doesn't wait on the GPU, the old swapchain is retired until the frames in flight are done with it.
+// Returns false if the surface has no area (minimized windows), the old swapchain is then kept.
+bool cranvk_resize_present(cranvk_graphics_device_t* vkDevice, cranvk_surface_t* vkSurface, cranvk_present_t* vkPresent)
+{
 	VkSurfaceCapabilitiesKHR surfaceCapabilities;
 	cranvk_check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkDevice->devices.physicalDevice, vkSurface->surface, &surfaceCapabilities));
 
 	cranvk_assert(surfaceCapabilities.currentExtent.width != UINT32_MAX);
-	vkPresent->surfaceExtents = surfaceCapabilities.currentExtent;
+	if (surfaceCapabilities.currentExtent.width == 0 || surfaceCapabilities.currentExtent.height == 0)
+	{
+		return false;
+	}
 
+	vkPresent->surfaceExtents = surfaceCapabilities.currentExtent;
 	cranvk_create_swapchain(vkDevice, vkSurface, vkPresent, vkPresent->swapchainData.swapchain);
+	return true;
 }
 
-crang_shader_id_t crang_request_shader_id(crang_graphics_device_t* device, crang_shader_e type)
+unsigned int crang_graph_size(void)
+{
+	return sizeof(cranvk_graph_t);
+}
+
+crang_graph_t* crang_create_graph(void* buffer, crang_present_t* present)
+{
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)buffer;
+	memset(vkGraph, 0, sizeof(cranvk_graph_t));
+	vkGraph->present = (cranvk_present_t*)present;
+	return (crang_graph_t*)vkGraph;
+}
+
+void crang_destroy_graph(crang_graphics_device_t* device, crang_graph_t* graph)
 {
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
 
-	cranvk_assert(vkDevice->shaders.shaderCount < cranvk_max_shader_count);
+	if (!vkGraph->compiled)
+	{
+		return;
+	}
 
-	uint32_t nextSlot = vkDevice->shaders.shaderCount;
-	vkDevice->shaders.shaderCount++;
+	cranvk_wait_value(vkDevice, vkGraph->submitValue);
 
-	vkDevice->shaders.types[nextSlot] = type;
+	for (uint32_t i = 0; i < vkGraph->passes.count; i++)
+	{
+		if (vkGraph->passes.framebuffers[i] != VK_NULL_HANDLE)
+		{
+			vkDestroyFramebuffer(vkDevice->devices.logicalDevice, vkGraph->passes.framebuffers[i], cranvk_no_allocator);
+		}
 
-	return (crang_shader_id_t){ .id = nextSlot };
+		if (vkGraph->passes.renderPasses[i] != VK_NULL_HANDLE)
+		{
+			vkDestroyRenderPass(vkDevice->devices.logicalDevice, vkGraph->passes.renderPasses[i], cranvk_no_allocator);
+		}
+
+		cranvk_release_transient_resources(vkDevice, &vkGraph->passes.singleUseResources[i]);
+	}
+
+	if (vkGraph->passes.count > 0)
+	{
+		vkFreeCommandBuffers(vkDevice->devices.logicalDevice, vkDevice->graphicsCommandPool, vkGraph->passes.count, vkGraph->passes.commandBuffers);
+	}
+
+	for (uint32_t i = 0; i < vkGraph->resources.count; i++)
+	{
+		if (vkGraph->resources.images[i] != VK_NULL_HANDLE)
+		{
+			vkDestroyImageView(vkDevice->devices.logicalDevice, vkGraph->resources.imageViews[i], cranvk_no_allocator);
+			vkDestroyImage(vkDevice->devices.logicalDevice, vkGraph->resources.images[i], cranvk_no_allocator);
+		}
+	}
+
+	for (uint32_t i = 0; i < vkGraph->memorySlots.count; i++)
+	{
+		vkFreeMemory(vkDevice->devices.logicalDevice, vkGraph->memorySlots.memories[i], cranvk_no_allocator);
+	}
 }
 
-crang_shader_input_id_t crang_request_shader_input_id(crang_graphics_device_t* device)
+crang_graph_resource_id_t crang_graph_add_attachment(crang_graph_t* graph, crang_graph_attachment_desc_t* attachmentDesc)
 {
-	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(!vkGraph->compiled);
+	cranvk_assert(vkGraph->resources.count < cranvk_max_graph_resources);
+
+	uint32_t resource = vkGraph->resources.count++;
+	vkGraph->resources.isBuffer[resource] = false;
+	vkGraph->resources.attachmentDescs[resource] = *attachmentDesc;
+	return (crang_graph_resource_id_t) { .id = resource };
+}
 
-	uint32_t nextSlot = vkDevice->shaders.descriptorSets.count;
-	vkDevice->shaders.descriptorSets.count++;
-	cranvk_assert(vkDevice->shaders.descriptorSets.count <= cranvk_max_descriptor_set_count);
+crang_graph_resource_id_t crang_graph_import_buffer(crang_graph_t* graph, crang_buffer_id_t buffer)
+{
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(!vkGraph->compiled);
+	cranvk_assert(vkGraph->resources.count < cranvk_max_graph_resources);
+
+	uint32_t resource = vkGraph->resources.count++;
+	vkGraph->resources.isBuffer[resource] = true;
+	vkGraph->resources.bufferIds[resource] = buffer.id;
+	return (crang_graph_resource_id_t) { .id = resource };
+}
 
-	return (crang_shader_input_id_t) { .id = nextSlot };
+bool cranvk_graph_access_is_write(crang_graph_access_e access)
+{
+	return access == crang_graph_access_attachment || access == crang_graph_access_storage_write;
 }
 
-crang_buffer_id_t crang_request_buffer_id(crang_graphics_device_t* device)
+crang_graph_pass_id_t crang_graph_add_pass(crang_graph_t* graph, crang_graph_pass_desc_t* passDesc)
 {
-	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(!vkGraph->compiled);
+	cranvk_assert(vkGraph->passes.count < cranvk_max_graph_passes);
+	cranvk_assert(passDesc->reads.count <= cranvk_max_graph_pass_uses && passDesc->writes.count <= cranvk_max_graph_pass_uses);
+
+	uint32_t pass = vkGraph->passes.count++;
+	vkGraph->passes.types[pass] = passDesc->type;
+	vkGraph->passes.readCounts[pass] = passDesc->reads.count;
+	vkGraph->passes.writeCounts[pass] = passDesc->writes.count;
+	memcpy(vkGraph->passes.reads[pass], passDesc->reads.uses, sizeof(crang_graph_resource_use_t) * passDesc->reads.count);
+	memcpy(vkGraph->passes.writes[pass], passDesc->writes.uses, sizeof(crang_graph_resource_use_t) * passDesc->writes.count);
+	memcpy(vkGraph->passes.clearColors[pass], passDesc->clearColor, sizeof(passDesc->clearColor));
+	vkGraph->passes.clearDepths[pass] = passDesc->clearDepth;
 
-	cranvk_assert(vkDevice->buffers.bufferCount < cranvk_max_buffer_count);
+#ifdef cranvk_debug_enabled
+	for (uint32_t i = 0; i < passDesc->reads.count + passDesc->writes.count; i++)
+	{
+		bool isWrite = i >= passDesc->reads.count;
+		crang_graph_resource_use_t use = isWrite ? passDesc->writes.uses[i - passDesc->reads.count] : passDesc->reads.uses[i];
+		cranvk_assert(use.resource.id < vkGraph->resources.count);
+		cranvk_assert(cranvk_graph_access_is_write(use.access) == isWrite);
+
+		// Attachments are only rendered to and sampled, buffers are never either.
+		bool isImageAccess = use.access == crang_graph_access_attachment || use.access == crang_graph_access_sampled;
+		cranvk_assert(isImageAccess != vkGraph->resources.isBuffer[use.resource.id]);
+		cranvk_assert(use.access != crang_graph_access_attachment || passDesc->type == crang_graph_pass_raster);
+	}
+#endif // cranvk_debug_enabled
 
-	uint32_t nextSlot = vkDevice->buffers.bufferCount;
-	vkDevice->buffers.bufferCount++;
+	return (crang_graph_pass_id_t) { .id = pass };
+}
 
-	return (crang_buffer_id_t){ .id = nextSlot };
+void crang_graph_mark_output(crang_graph_t* graph, crang_graph_resource_id_t resource)
+{
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(!vkGraph->compiled);
+	vkGraph->resources.isOutput[resource.id] = true;
 }
 
-crang_recording_buffer_id_t crang_request_recording_buffer_id(crang_graphics_device_t* device)
+bool crang_graph_pass_culled(crang_graph_t* graph, crang_graph_pass_id_t pass)
 {
-	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(vkGraph->compiled);
+	return vkGraph->passes.culled[pass.id];
+}
 
-	cranvk_assert(vkDevice->commandBuffers.bufferCount < cranvk_max_command_buffer_count);
+// Reads come first, then writes.
+crang_graph_resource_use_t cranvk_graph_pass_use(cranvk_graph_t* vkGraph, uint32_t pass, uint32_t use)
+{
+	uint32_t readCount = vkGraph->passes.readCounts[pass];
+	return use < readCount ? vkGraph->passes.reads[pass][use] : vkGraph->passes.writes[pass][use - readCount];
+}
 
-	uint32_t nextSlot = vkDevice->commandBuffers.bufferCount;
-	vkDevice->commandBuffers.bufferCount++;
+uint32_t cranvk_graph_pass_use_count(cranvk_graph_t* vkGraph, uint32_t pass)
+{
+	return vkGraph->passes.readCounts[pass] + vkGraph->passes.writeCounts[pass];
+}
 
-	VkCommandBufferAllocateInfo commandBufferAllocateInfo =
+bool cranvk_graph_pass_accesses(cranvk_graph_t* vkGraph, uint32_t pass, uint32_t resource, bool write)
+{
+	uint32_t count = write ? vkGraph->passes.writeCounts[pass] : vkGraph->passes.readCounts[pass];
+	crang_graph_resource_use_t* uses = write ? vkGraph->passes.writes[pass] : vkGraph->passes.reads[pass];
+	for (uint32_t i = 0; i < count; i++)
 	{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
-		.commandBufferCount = 1,
-		.commandPool = vkDevice->graphicsCommandPool
+		if (uses[i].resource.id == resource)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool cranvk_graph_is_depth(cranvk_graph_t* vkGraph, uint32_t resource)
+{
+	return !vkGraph->resources.isBuffer[resource] && vkGraph->resources.attachmentDescs[resource].format == crang_image_format_d32;
+}
+
+void cranvk_graph_use_stages(cranvk_graph_t* vkGraph, uint32_t pass, crang_graph_resource_use_t use, VkPipelineStageFlags* stages, VkAccessFlags* access)
+{
+	bool isCompute = vkGraph->passes.types[pass] == crang_graph_pass_compute;
+	VkPipelineStageFlags shaderStages = isCompute ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+	VkPipelineStageFlags stageConversionTable[crang_graph_access_max] =
+	{
+		[crang_graph_access_attachment] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		[crang_graph_access_sampled] = isCompute ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		[crang_graph_access_storage_read] = shaderStages,
+		[crang_graph_access_storage_write] = shaderStages,
+		[crang_graph_access_indirect] = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		[crang_graph_access_vertex] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
 	};
-	cranvk_check(vkAllocateCommandBuffers(vkDevice->devices.logicalDevice, &commandBufferAllocateInfo, &vkDevice->commandBuffers.recordingBuffers[nextSlot]));
 
-	return (crang_recording_buffer_id_t){ .id = nextSlot };
+	VkAccessFlags accessConversionTable[crang_graph_access_max] =
+	{
+		[crang_graph_access_attachment] = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		[crang_graph_access_sampled] = VK_ACCESS_SHADER_READ_BIT,
+		[crang_graph_access_storage_read] = VK_ACCESS_SHADER_READ_BIT,
+		[crang_graph_access_storage_write] = VK_ACCESS_SHADER_WRITE_BIT,
+		[crang_graph_access_indirect] = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+		[crang_graph_access_vertex] = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+	};
+
+	*stages = stageConversionTable[use.access];
+	*access = accessConversionTable[use.access];
+	if (use.access == crang_graph_access_attachment && cranvk_graph_is_depth(vkGraph, use.resource.id))
+	{
+		*stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		*access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	}
 }
 
-crang_pipeline_id_t crang_create_pipeline(crang_graphics_device_t* device, crang_pipeline_desc_t* pipelineDesc)
+// Tracks the accesses to a physical resource, an imported buffer or an attachment memory slot.
+typedef struct
+{
+	VkPipelineStageFlags writeStages;
+	VkAccessFlags writeAccess;
+	VkPipelineStageFlags readStages;
+} cranvk_graph_hazard_t;
+
+void cranvk_graph_add_access(cranvk_graph_hazard_t* hazard, cranvk_graph_barrier_t* barrier, VkPipelineStageFlags stages, VkAccessFlags access, bool write)
+{
+	// Read after write and write after write, the writes need to be made visible.
+	if (hazard->writeStages != 0)
+	{
+		barrier->srcStages |= hazard->writeStages;
+		barrier->srcAccess |= hazard->writeAccess;
+		barrier->dstStages |= stages;
+		barrier->dstAccess |= access;
+	}
+
+	if (write)
+	{
+		// Write after read, the reads only need to be done.
+		if (hazard->readStages != 0)
+		{
+			barrier->srcStages |= hazard->readStages;
+			barrier->dstStages |= stages;
+		}
+
+		hazard->writeStages = stages;
+		hazard->writeAccess = access & (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		hazard->readStages = 0;
+	}
+	else
+	{
+		hazard->readStages |= stages;
+	}
+}
+
+void cranvk_cmd_graph_barrier(VkCommandBuffer commandBuffer, cranvk_graph_barrier_t* barrier)
+{
+	if (barrier->srcStages == 0)
+	{
+		return;
+	}
+
+	VkMemoryBarrier memoryBarrier =
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = barrier->srcAccess,
+		.dstAccessMask = barrier->dstAccess
+	};
+	vkCmdPipelineBarrier(commandBuffer, barrier->srcStages, barrier->dstStages, 0, 1, &memoryBarrier, 0, NULL, 0, NULL);
+}
+
+void crang_compile_graph(crang_graphics_device_t* device, crang_graph_t* graph)
 {
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(!vkGraph->compiled);
 
-	cranvk_assert(vkDevice->pipelines.pipelineCount < cranvk_max_pipeline_count);
-	crang_pipeline_id_t pipelineId = { .id = vkDevice->pipelines.pipelineCount };
-	vkDevice->pipelines.pipelineCount++;
+	VkDevice logicalDevice = vkDevice->devices.logicalDevice;
+	uint32_t passCount = vkGraph->passes.count;
+	uint32_t resourceCount = vkGraph->resources.count;
+
+	// Order the passes, the writers of a resource run in declaration order and before the passes that only read it.
+	uint32_t sortedPasses[cranvk_max_graph_passes];
+	{
+		bool edges[cranvk_max_graph_passes][cranvk_max_graph_passes] = { 0 };
+		for (uint32_t resource = 0; resource < resourceCount; resource++)
+		{
+			uint32_t previousWriter = UINT32_MAX;
+			for (uint32_t writer = 0; writer < passCount; writer++)
+			{
+				if (!cranvk_graph_pass_accesses(vkGraph, writer, resource, true))
+				{
+					continue;
+				}
 
+				if (previousWriter != UINT32_MAX)
+				{
+					edges[previousWriter][writer] = true;
+				}
+				previousWriter = writer;
 
-	cranvk_present_t* vkPresent = (cranvk_present_t*)pipelineDesc->presentCtx;
-	cranvk_render_pass_t* vkRenderPass = &vkPresent->presentRenderPass;
-	crang_shader_id_t vertShader = pipelineDesc->shaders[crang_shader_vertex];
-	crang_shader_id_t fragShader = pipelineDesc->shaders[crang_shader_fragment];
+				for (uint32_t reader = 0; reader < passCount; reader++)
+				{
+					if (cranvk_graph_pass_accesses(vkGraph, reader, resource, false) && !cranvk_graph_pass_accesses(vkGraph, reader, resource, true))
+					{
+						edges[writer][reader] = true;
+					}
+				}
+			}
+		}
+
+		uint32_t incomingCounts[cranvk_max_graph_passes] = { 0 };
+		for (uint32_t from = 0; from < passCount; from++)
+		{
+			for (uint32_t to = 0; to < passCount; to++)
+			{
+				incomingCounts[to] += edges[from][to] ? 1 : 0;
+			}
+		}
+
+		bool sorted[cranvk_max_graph_passes] = { 0 };
+		for (uint32_t i = 0; i < passCount; i++)
+		{
+			// Take the first ready pass to stay as close as we can to declaration order.
+			uint32_t next = UINT32_MAX;
+			for (uint32_t pass = 0; pass < passCount; pass++)
+			{
+				if (!sorted[pass] && incomingCounts[pass] == 0)
+				{
+					next = pass;
+					break;
+				}
+			}
+			cranvk_assert(next != UINT32_MAX); // The passes depend on each other
+
+			sorted[next] = true;
+			sortedPasses[i] = next;
+			for (uint32_t to = 0; to < passCount; to++)
+			{
+				incomingCounts[to] -= edges[next][to] ? 1 : 0;
+			}
+		}
+	}
+
+	// Cull the passes that don't contribute to an output, walking back from the last pass.
+	{
+		bool needed[cranvk_max_graph_resources];
+		memcpy(needed, vkGraph->resources.isOutput, sizeof(needed));
+
+		for (uint32_t i = passCount; i > 0; i--)
+		{
+			uint32_t pass = sortedPasses[i - 1];
+
+			bool alive = false;
+			for (uint32_t write = 0; write < vkGraph->passes.writeCounts[pass]; write++)
+			{
+				alive |= needed[vkGraph->passes.writes[pass][write].resource.id];
+			}
+
+			vkGraph->passes.culled[pass] = !alive;
+			if (alive)
+			{
+				for (uint32_t read = 0; read < vkGraph->passes.readCounts[pass]; read++)
+				{
+					needed[vkGraph->passes.reads[pass][read].resource.id] = true;
+				}
+			}
+		}
+
+		vkGraph->executionCount = 0;
+		for (uint32_t i = 0; i < passCount; i++)
+		{
+			if (!vkGraph->passes.culled[sortedPasses[i]])
+			{
+				vkGraph->executionOrder[vkGraph->executionCount++] = sortedPasses[i];
+			}
+		}
+	}
+
+	// Lifetimes, in execution order
+	uint32_t firstUses[cranvk_max_graph_resources];
+	uint32_t lastUses[cranvk_max_graph_resources];
+	uint32_t firstWriters[cranvk_max_graph_resources];
+	{
+		memset(firstUses, 0xFF, sizeof(firstUses));
+		memset(lastUses, 0, sizeof(lastUses));
+		memset(firstWriters, 0xFF, sizeof(firstWriters));
+
+		for (uint32_t position = 0; position < vkGraph->executionCount; position++)
+		{
+			uint32_t pass = vkGraph->executionOrder[position];
+			for (uint32_t i = 0; i < cranvk_graph_pass_use_count(vkGraph, pass); i++)
+			{
+				uint32_t resource = cranvk_graph_pass_use(vkGraph, pass, i).resource.id;
+				firstUses[resource] = firstUses[resource] == UINT32_MAX ? position : firstUses[resource];
+				lastUses[resource] = position;
+			}
+
+			for (uint32_t write = 0; write < vkGraph->passes.writeCounts[pass]; write++)
+			{
+				uint32_t resource = vkGraph->passes.writes[pass][write].resource.id;
+				firstWriters[resource] = firstWriters[resource] == UINT32_MAX ? pass : firstWriters[resource];
+			}
+		}
+	}
+
+	VkFormat formatConversionTable[crang_image_format_max] =
+	{
+		[crang_image_format_rgba8] = VK_FORMAT_R8G8B8A8_UNORM,
+		[crang_image_format_rgba16f] = VK_FORMAT_R16G16B16A16_SFLOAT,
+		[crang_image_format_d32] = VK_FORMAT_D32_SFLOAT
+	};
+
+	// Create the images of the attachments used by live passes
+	for (uint32_t resource = 0; resource < resourceCount; resource++)
+	{
+		if (vkGraph->resources.isBuffer[resource])
+		{
+			continue;
+		}
+
+		crang_graph_attachment_desc_t* attachmentDesc = &vkGraph->resources.attachmentDescs[resource];
+		vkGraph->resources.extents[resource] = (VkExtent2D)
+		{
+			.width = attachmentDesc->width != 0 ? attachmentDesc->width : vkGraph->present->surfaceExtents.width,
+			.height = attachmentDesc->height != 0 ? attachmentDesc->height : vkGraph->present->surfaceExtents.height
+		};
+
+		if (firstUses[resource] == UINT32_MAX)
+		{
+			continue;
+		}
+
+		bool isDepth = cranvk_graph_is_depth(vkGraph, resource);
+		VkImageCreateInfo imageCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = formatConversionTable[attachmentDesc->format],
+			.extent = { .width = vkGraph->resources.extents[resource].width, .height = vkGraph->resources.extents[resource].height, .depth = 1 },
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = (isDepth ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) | VK_IMAGE_USAGE_SAMPLED_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+		};
+		cranvk_check(vkCreateImage(logicalDevice, &imageCreate, cranvk_no_allocator, &vkGraph->resources.images[resource]));
+	}
+
+	// Alias the attachments, greedily reusing the first slot whose last user ran before the attachment's first use.
+	// Outputs are read after the graph has run, they get their own slot.
+	{
+		uint32_t slotLastUses[cranvk_max_graph_resources];
+		VkDeviceSize slotSizes[cranvk_max_graph_resources];
+		uint32_t slotTypeBits[cranvk_max_graph_resources];
+		bool slotIsOutput[cranvk_max_graph_resources];
+		uint32_t slotCount = 0;
+
+		for (uint32_t position = 0; position < vkGraph->executionCount; position++)
+		{
+			for (uint32_t resource = 0; resource < resourceCount; resource++)
+			{
+				if (vkGraph->resources.isBuffer[resource] || firstUses[resource] != position)
+				{
+					continue;
+				}
+
+				VkMemoryRequirements memoryRequirements;
+				vkGetImageMemoryRequirements(logicalDevice, vkGraph->resources.images[resource], &memoryRequirements);
+
+				bool isOutput = vkGraph->resources.isOutput[resource];
+				uint32_t slot = UINT32_MAX;
+				for (uint32_t i = 0; i < slotCount && !isOutput; i++)
+				{
+					if (!slotIsOutput[i] && slotLastUses[i] < position && (slotTypeBits[i] & memoryRequirements.memoryTypeBits) != 0)
+					{
+						slot = i;
+						break;
+					}
+				}
+
+				if (slot == UINT32_MAX)
+				{
+					slot = slotCount++;
+					slotSizes[slot] = 0;
+					slotTypeBits[slot] = memoryRequirements.memoryTypeBits;
+					slotIsOutput[slot] = isOutput;
+				}
+
+				// Every image is bound at offset 0, the size covers alignment.
+				slotSizes[slot] = slotSizes[slot] > memoryRequirements.size ? slotSizes[slot] : memoryRequirements.size;
+				slotTypeBits[slot] &= memoryRequirements.memoryTypeBits;
+				slotLastUses[slot] = lastUses[resource];
+				vkGraph->resources.memorySlots[resource] = slot;
+			}
+		}
+
+		for (uint32_t slot = 0; slot < slotCount; slot++)
+		{
+			uint32_t memoryIndex = cranvk_find_memory_index(vkDevice->devices.physicalDevice, slotTypeBits[slot], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+			cranvk_assert(memoryIndex != UINT32_MAX);
+
+			VkMemoryAllocateInfo memoryAllocate =
+			{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				.allocationSize = slotSizes[slot],
+				.memoryTypeIndex = memoryIndex
+			};
+			cranvk_check(vkAllocateMemory(logicalDevice, &memoryAllocate, cranvk_no_allocator, &vkGraph->memorySlots.memories[slot]));
+		}
+		vkGraph->memorySlots.count = slotCount;
+
+		for (uint32_t resource = 0; resource < resourceCount; resource++)
+		{
+			if (vkGraph->resources.images[resource] == VK_NULL_HANDLE)
+			{
+				continue;
+			}
+
+			cranvk_check(vkBindImageMemory(logicalDevice, vkGraph->resources.images[resource], vkGraph->memorySlots.memories[vkGraph->resources.memorySlots[resource]], 0));
+
+			bool isDepth = cranvk_graph_is_depth(vkGraph, resource);
+			VkImageViewCreateInfo imageViewCreate =
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+				.image = vkGraph->resources.images[resource],
+				.viewType = VK_IMAGE_VIEW_TYPE_2D,
+				.format = formatConversionTable[vkGraph->resources.attachmentDescs[resource].format],
+				.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY },
+				.subresourceRange =
+				{
+					.aspectMask = isDepth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				}
+			};
+			cranvk_check(vkCreateImageView(logicalDevice, &imageViewCreate, cranvk_no_allocator, &vkGraph->resources.imageViews[resource]));
+		}
+	}
+
+	// Render passes, attachments are cleared by their first writer and are left ready to be sampled.
+	for (uint32_t pass = 0; pass < passCount; pass++)
+	{
+		if (vkGraph->passes.types[pass] != crang_graph_pass_raster)
+		{
+			continue;
+		}
+
+		VkAttachmentDescription attachments[cranvk_max_graph_attachments];
+		VkAttachmentReference colorReferences[cranvk_max_graph_color_attachments];
+		VkImageView imageViews[cranvk_max_graph_attachments];
+		uint32_t colorCount = 0;
+		uint32_t depthResource = UINT32_MAX;
+		uint32_t extentResource = UINT32_MAX;
+
+		// Colors come first so that attachment indices match color output locations.
+		for (uint32_t depth = 0; depth < 2; depth++)
+		{
+			for (uint32_t write = 0; write < vkGraph->passes.writeCounts[pass]; write++)
+			{
+				crang_graph_resource_use_t use = vkGraph->passes.writes[pass][write];
+				uint32_t resource = use.resource.id;
+				if (use.access != crang_graph_access_attachment || cranvk_graph_is_depth(vkGraph, resource) != (depth == 1))
+				{
+					continue;
+				}
+
+				cranvk_assert(extentResource == UINT32_MAX ||
+					(vkGraph->resources.extents[resource].width == vkGraph->resources.extents[extentResource].width &&
+					 vkGraph->resources.extents[resource].height == vkGraph->resources.extents[extentResource].height));
+				extentResource = resource;
+
+				bool isFirstWriter = firstWriters[resource] == pass;
+				uint32_t attachment = colorCount;
+				cranvk_assert(depth == 1 ? depthResource == UINT32_MAX : colorCount < cranvk_max_graph_color_attachments);
+
+				attachments[attachment] = (VkAttachmentDescription)
+				{
+					.format = formatConversionTable[vkGraph->resources.attachmentDescs[resource].format],
+					.samples = VK_SAMPLE_COUNT_1_BIT,
+					.loadOp = isFirstWriter ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
+					.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+					.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+					.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+					.initialLayout = isFirstWriter ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+				};
+				imageViews[attachment] = vkGraph->resources.imageViews[resource];
+
+				if (depth == 1)
+				{
+					depthResource = resource;
+					vkGraph->passes.clearValues[pass][attachment].depthStencil = (VkClearDepthStencilValue) { .depth = vkGraph->passes.clearDepths[pass] };
+				}
+				else
+				{
+					colorReferences[colorCount] = (VkAttachmentReference) { .attachment = colorCount, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+					memcpy(vkGraph->passes.clearValues[pass][attachment].color.float32, vkGraph->passes.clearColors[pass], sizeof(float) * 4);
+					colorCount++;
+				}
+			}
+		}
+		cranvk_assert(extentResource != UINT32_MAX); // Raster passes need at least one attachment
+
+		VkAttachmentReference depthReference = { .attachment = colorCount, .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass =
+		{
+			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+			.colorAttachmentCount = colorCount,
+			.pColorAttachments = colorReferences,
+			.pDepthStencilAttachment = depthResource != UINT32_MAX ? &depthReference : NULL
+		};
+
+		// The graph's barriers wait on the attachment stages, chain the layout transitions to them.
+		VkPipelineStageFlags attachmentStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		VkAccessFlags attachmentAccess =
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		VkSubpassDependency dependencies[2] =
+		{
+			{
+				.srcSubpass = VK_SUBPASS_EXTERNAL,
+				.dstSubpass = 0,
+				.srcStageMask = attachmentStages,
+				.dstStageMask = attachmentStages,
+				.srcAccessMask = 0,
+				.dstAccessMask = attachmentAccess
+			},
+			{
+				.srcSubpass = 0,
+				.dstSubpass = VK_SUBPASS_EXTERNAL,
+				.srcStageMask = attachmentStages,
+				.dstStageMask = attachmentStages,
+				.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				.dstAccessMask = 0
+			}
+		};
+
+		uint32_t attachmentCount = colorCount + (depthResource != UINT32_MAX ? 1 : 0);
+		VkRenderPassCreateInfo renderPassCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+			.attachmentCount = attachmentCount,
+			.pAttachments = attachments,
+			.subpassCount = 1,
+			.pSubpasses = &subpass,
+			.dependencyCount = 2,
+			.pDependencies = dependencies
+		};
+		cranvk_check(vkCreateRenderPass(logicalDevice, &renderPassCreate, cranvk_no_allocator, &vkGraph->passes.renderPasses[pass]));
+		vkGraph->passes.renderPassIds[pass] = vkDevice->nextRenderPassId++;
+
+		vkGraph->passes.extents[pass] = vkGraph->resources.extents[extentResource];
+		vkGraph->passes.attachmentCounts[pass] = attachmentCount;
+		vkGraph->passes.colorAttachmentCounts[pass] = colorCount;
+		vkGraph->passes.hasDepth[pass] = depthResource != UINT32_MAX;
+
+		if (!vkGraph->passes.culled[pass])
+		{
+			VkFramebufferCreateInfo framebufferCreate =
+			{
+				.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+				.renderPass = vkGraph->passes.renderPasses[pass],
+				.attachmentCount = attachmentCount,
+				.pAttachments = imageViews,
+				.width = vkGraph->passes.extents[pass].width,
+				.height = vkGraph->passes.extents[pass].height,
+				.layers = 1
+			};
+			cranvk_check(vkCreateFramebuffer(logicalDevice, &framebufferCreate, cranvk_no_allocator, &vkGraph->passes.framebuffers[pass]));
+		}
+	}
+
+	// Barriers, hazards are tracked per memory slot so aliased attachments wait on the previous users of their memory.
+	// The second iteration starts where the first one ended which accounts for the previous frame's accesses.
+	{
+		cranvk_graph_hazard_t hazards[cranvk_max_graph_resources * 2] = { 0 };
+		for (uint32_t iteration = 0; iteration < 2; iteration++)
+		{
+			for (uint32_t position = 0; position < vkGraph->executionCount; position++)
+			{
+				uint32_t pass = vkGraph->executionOrder[position];
+				vkGraph->passes.barriers[pass] = (cranvk_graph_barrier_t) { 0 };
+
+				for (uint32_t i = 0; i < cranvk_graph_pass_use_count(vkGraph, pass); i++)
+				{
+					crang_graph_resource_use_t use = cranvk_graph_pass_use(vkGraph, pass, i);
+					uint32_t resource = use.resource.id;
+					uint32_t hazard = vkGraph->resources.isBuffer[resource] ? resource : cranvk_max_graph_resources + vkGraph->resources.memorySlots[resource];
+
+					VkPipelineStageFlags stages;
+					VkAccessFlags access;
+					cranvk_graph_use_stages(vkGraph, pass, use, &stages, &access);
+					cranvk_graph_add_access(&hazards[hazard], &vkGraph->passes.barriers[pass], stages, access, cranvk_graph_access_is_write(use.access));
+				}
+			}
+
+			// The present's render pass samples the outputs.
+			vkGraph->outputBarrier = (cranvk_graph_barrier_t) { 0 };
+			for (uint32_t resource = 0; resource < resourceCount; resource++)
+			{
+				if (!vkGraph->resources.isOutput[resource] || firstUses[resource] == UINT32_MAX)
+				{
+					continue;
+				}
+
+				uint32_t hazard = vkGraph->resources.isBuffer[resource] ? resource : cranvk_max_graph_resources + vkGraph->resources.memorySlots[resource];
+				cranvk_graph_add_access(&hazards[hazard], &vkGraph->outputBarrier, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, false);
+			}
+		}
+	}
+
+	if (passCount > 0)
+	{
+		VkCommandBufferAllocateInfo commandBufferAllocateInfo =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+			.commandBufferCount = passCount,
+			.commandPool = vkDevice->graphicsCommandPool
+		};
+		cranvk_check(vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, vkGraph->passes.commandBuffers));
+	}
+
+	vkGraph->compiled = true;
+}
+
+crang_shader_id_t crang_request_shader_id(crang_graphics_device_t* device, crang_shader_e type)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	cranvk_assert(vkDevice->shaders.shaderCount < vkDevice->capacities.shaderCount);
+
+	uint32_t nextSlot = vkDevice->shaders.shaderCount;
+	vkDevice->shaders.shaderCount++;
+
+	vkDevice->shaders.types[nextSlot] = type;
+
+	return (crang_shader_id_t){ .id = nextSlot };
+}
+
+crang_shader_input_id_t crang_request_shader_input_id(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	return (crang_shader_input_id_t) { .id = cranvk_allocate_handle(&vkDevice->shaders.descriptorSets.pool) };
+}
+
+crang_buffer_id_t crang_request_buffer_id(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	return (crang_buffer_id_t){ .id = cranvk_allocate_handle(&vkDevice->buffers.pool) };
+}
+
+crang_recording_buffer_id_t crang_request_recording_buffer_id(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	cranvk_assert(vkDevice->commandBuffers.bufferCount < vkDevice->capacities.recordingBufferCount);
+
+	uint32_t nextSlot = vkDevice->commandBuffers.bufferCount;
+	vkDevice->commandBuffers.bufferCount++;
+
+	VkCommandBufferAllocateInfo commandBufferAllocateInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+		.commandBufferCount = 1,
+		.commandPool = vkDevice->graphicsCommandPool
+	};
+	cranvk_check(vkAllocateCommandBuffers(vkDevice->devices.logicalDevice, &commandBufferAllocateInfo, &vkDevice->commandBuffers.recordingBuffers[nextSlot]));
+	cranvk_check(vkAllocateCommandBuffers(vkDevice->devices.logicalDevice, &commandBufferAllocateInfo, &vkDevice->commandBuffers.computeBuffers[nextSlot]));
+
+	return (crang_recording_buffer_id_t){ .id = nextSlot };
+}
+
+void cranvk_store_push_constant_ranges(cranvk_graphics_device_t* vkDevice, crang_pipeline_id_t pipelineId, crang_push_constant_range_t* ranges, uint32_t rangeCount)
+{
+	VkShaderStageFlagBits shaderStageConversionTable[crang_shader_max] =
+	{
+		[crang_shader_vertex] = VK_SHADER_STAGE_VERTEX_BIT,
+		[crang_shader_fragment] = VK_SHADER_STAGE_FRAGMENT_BIT,
+		[crang_shader_compute] = VK_SHADER_STAGE_COMPUTE_BIT
+	};
+
+	cranvk_assert(rangeCount <= cranvk_max_push_constant_ranges);
+	for (uint32_t i = 0; i < rangeCount; i++)
+	{
+		cranvk_assert(ranges[i].offset % 4 == 0 && ranges[i].size % 4 == 0);
+		cranvk_assert(ranges[i].offset + ranges[i].size <= cranvk_max_push_constant_size);
+
+		vkDevice->pipelines.pushConstantRanges[pipelineId.id][i] = (VkPushConstantRange)
+		{
+			.stageFlags = shaderStageConversionTable[ranges[i].stage],
+			.offset = ranges[i].offset,
+			.size = ranges[i].size
+		};
+	}
+	vkDevice->pipelines.pushConstantRangeCounts[pipelineId.id] = rangeCount;
+}
+
+// Pipelines with the same set layouts and push constants share their layout.
+VkPipelineLayout cranvk_request_pipeline_layout(cranvk_graphics_device_t* vkDevice, VkDescriptorSetLayout const* setLayouts, uint32_t setLayoutCount, crang_push_constant_range_t* ranges, uint32_t rangeCount)
+{
+	VkShaderStageFlagBits shaderStageConversionTable[crang_shader_max] =
+	{
+		[crang_shader_vertex] = VK_SHADER_STAGE_VERTEX_BIT,
+		[crang_shader_fragment] = VK_SHADER_STAGE_FRAGMENT_BIT,
+		[crang_shader_compute] = VK_SHADER_STAGE_COMPUTE_BIT
+	};
+
+	// Zeroed so that the unused entries and the padding hash and compare the same.
+	cranvk_pipeline_layout_key_t key;
+	memset(&key, 0, sizeof(cranvk_pipeline_layout_key_t));
+
+	cranvk_assert(setLayoutCount <= cranvk_max_pipeline_set_layouts);
+	memcpy(key.setLayouts, setLayouts, sizeof(VkDescriptorSetLayout) * setLayoutCount);
+	key.setLayoutCount = setLayoutCount;
+
+	// Vulkan allows a stage in at most one range, a stage that needs several blocks takes a single range covering them.
+	VkShaderStageFlags rangeStages = 0;
+	cranvk_assert(rangeCount <= cranvk_max_push_constant_ranges);
+	for (uint32_t i = 0; i < rangeCount; i++)
+	{
+		cranvk_assert((rangeStages & shaderStageConversionTable[ranges[i].stage]) == 0);
+		rangeStages |= shaderStageConversionTable[ranges[i].stage];
+
+		key.pushConstantRanges[i].stageFlags = shaderStageConversionTable[ranges[i].stage];
+		key.pushConstantRanges[i].offset = ranges[i].offset;
+		key.pushConstantRanges[i].size = ranges[i].size;
+	}
+	key.pushConstantRangeCount = rangeCount;
+
+	uint64_t hash = cranvk_hash(cranvk_hash_seed, &key, sizeof(cranvk_pipeline_layout_key_t));
+	for (uint32_t i = 0; i < vkDevice->pipelineLayouts.layoutCount; i++)
+	{
+		if (vkDevice->pipelineLayouts.hashes[i] == hash && memcmp(&vkDevice->pipelineLayouts.keys[i], &key, sizeof(cranvk_pipeline_layout_key_t)) == 0)
+		{
+			return vkDevice->pipelineLayouts.layouts[i];
+		}
+	}
+
+	cranvk_assert(vkDevice->pipelineLayouts.layoutCount < vkDevice->capacities.pipelineLayoutCount);
+	uint32_t layoutIndex = vkDevice->pipelineLayouts.layoutCount++;
+	vkDevice->pipelineLayouts.keys[layoutIndex] = key;
+	vkDevice->pipelineLayouts.hashes[layoutIndex] = hash;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = setLayoutCount,
+		.pSetLayouts = setLayouts,
+		.pushConstantRangeCount = rangeCount,
+		.pPushConstantRanges = key.pushConstantRanges
+	};
+
+	cranvk_check(vkCreatePipelineLayout(vkDevice->devices.logicalDevice, &pipelineLayoutCreate, cranvk_no_allocator, &vkDevice->pipelineLayouts.layouts[layoutIndex]));
+	return vkDevice->pipelineLayouts.layouts[layoutIndex];
+}
+
+// Open addressing on the job's hash, returns the slot holding an identical pipeline or the empty slot to insert it in.
+uint32_t* cranvk_find_pipeline_slot(cranvk_graphics_device_t* vkDevice, cranvk_pipeline_job_t const* job, uint64_t hash)
+{
+	uint32_t slot = (uint32_t)hash & (vkDevice->pipelines.lookupSize - 1);
+	while (true)
+	{
+		uint32_t* entry = &vkDevice->pipelines.lookup[slot];
+		if (*entry == 0)
+		{
+			return entry;
+		}
+
+		uint32_t pipelineIndex = *entry - 1;
+		if (vkDevice->pipelines.hashes[pipelineIndex] == hash && memcmp(&vkDevice->pipelines.jobs[pipelineIndex], job, sizeof(cranvk_pipeline_job_t)) == 0)
+		{
+			return entry;
+		}
+
+		slot = (slot + 1) & (vkDevice->pipelines.lookupSize - 1);
+	}
+}
+
+// Identical pipelines are only created once, returns false with the existing ID if there already was one.
+bool cranvk_add_pipeline(cranvk_graphics_device_t* vkDevice, cranvk_pipeline_job_t const* job, crang_pipeline_id_t* pipelineId)
+{
+	uint64_t hash = cranvk_hash(cranvk_hash_seed, job, sizeof(cranvk_pipeline_job_t));
+	uint32_t* slot = cranvk_find_pipeline_slot(vkDevice, job, hash);
+	if (*slot != 0)
+	{
+		*pipelineId = (crang_pipeline_id_t) { .id = *slot - 1 };
+		return false;
+	}
+
+	cranvk_assert(vkDevice->pipelines.pipelineCount < vkDevice->capacities.pipelineCount);
+	*pipelineId = (crang_pipeline_id_t) { .id = vkDevice->pipelines.pipelineCount };
+	vkDevice->pipelines.pipelineCount++;
+
+	*slot = pipelineId->id + 1;
+	vkDevice->pipelines.hashes[pipelineId->id] = hash;
+	memcpy(&vkDevice->pipelines.jobs[pipelineId->id], job, sizeof(cranvk_pipeline_job_t));
+	vkDevice->pipelines.layouts[pipelineId->id] = job->layout;
+	vkDevice->pipelines.bindPoints[pipelineId->id] = job->bindPoint;
+	return true;
+}
+
+void cranvk_store_specialization(cranvk_pipeline_job_t* job, crang_shader_e stage, crang_specialization_t const* specialization)
+{
+	cranvk_assert(specialization->count <= cranvk_max_specialization_constants);
+	cranvk_assert(specialization->dataSize <= cranvk_max_specialization_data_size);
+	for (uint32_t i = 0; i < specialization->count; i++)
+	{
+		cranvk_assert(specialization->constants[i].offset + specialization->constants[i].size <= specialization->dataSize);
+		job->specializationEntries[stage][i] = (VkSpecializationMapEntry)
+		{
+			.constantID = specialization->constants[i].constantId,
+			.offset = specialization->constants[i].offset,
+			.size = specialization->constants[i].size
+		};
+	}
+	job->specializationEntryCounts[stage] = specialization->count;
+
+	if (specialization->dataSize > 0)
+	{
+		memcpy(job->specializationData[stage], specialization->data, specialization->dataSize);
+	}
+	job->specializationDataSizes[stage] = specialization->dataSize;
+}
+
+// The job owns the specialization data, the returned info points into it.
+VkSpecializationInfo const* cranvk_get_specialization(cranvk_pipeline_job_t const* job, crang_shader_e stage, VkSpecializationInfo* info)
+{
+	if (job->specializationEntryCounts[stage] == 0)
+	{
+		return NULL;
+	}
+
+	*info = (VkSpecializationInfo)
+	{
+		.mapEntryCount = job->specializationEntryCounts[stage],
+		.pMapEntries = job->specializationEntries[stage],
+		.dataSize = job->specializationDataSizes[stage],
+		.pData = job->specializationData[stage]
+	};
+	return info;
+}
+
+// Fills in the job that describes the pipeline and stores its per pipeline state on the calling thread if it's new.
+// The compilation is left to cranvk_compile_graphics_pipeline, returns false with the existing ID for duplicates.
+bool cranvk_prepare_graphics_pipeline(cranvk_graphics_device_t* vkDevice, crang_pipeline_desc_t* pipelineDesc, crang_pipeline_id_t* pipelineId)
+{
+	// Zeroed so that the unused entries and the padding hash and compare the same.
+	cranvk_pipeline_job_t job;
+	memset(&job, 0, sizeof(cranvk_pipeline_job_t));
+	job.bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+	cranvk_present_t* vkPresent = (cranvk_present_t*)pipelineDesc->presentCtx;
+	VkRenderPass renderPass = vkPresent->presentRenderPass.renderPass;
+	uint32_t renderPassId = vkPresent->presentRenderPass.renderPassId;
+	uint32_t colorAttachmentCount = 1;
+	bool hasDepthAttachment = vkPresent->depthEnabled;
+	if (pipelineDesc->graph != NULL)
+	{
+		cranvk_graph_t* vkGraph = (cranvk_graph_t*)pipelineDesc->graph;
+		uint32_t pass = pipelineDesc->graphPass.id;
+		cranvk_assert(vkGraph->compiled && vkGraph->passes.types[pass] == crang_graph_pass_raster);
+
+		renderPass = vkGraph->passes.renderPasses[pass];
+		renderPassId = vkGraph->passes.renderPassIds[pass];
+		colorAttachmentCount = vkGraph->passes.colorAttachmentCounts[pass];
+		hasDepthAttachment = vkGraph->passes.hasDepth[pass];
+	}
+	cranvk_assert(pipelineDesc->depthMode == crang_depth_mode_none || hasDepthAttachment);
+	bool isPrepass = pipelineDesc->depthMode == crang_depth_mode_prepass;
+
+	crang_shader_id_t vertShader = pipelineDesc->shaders[crang_shader_vertex];
+	crang_shader_id_t fragShader = pipelineDesc->shaders[crang_shader_fragment];
+
+	// Prepass pipelines don't have a fragment stage, nor its set.
+	VkDescriptorSetLayout descriptorSetLayouts[cranvk_max_pipeline_set_layouts] =
+	{
+		[crang_shader_vertex] = vkDevice->shaders.descriptorSetLayouts[vertShader.id],
+		[crang_shader_fragment] = isPrepass ? VK_NULL_HANDLE : vkDevice->shaders.descriptorSetLayouts[fragShader.id]
+	};
+	uint32_t setLayoutCount = isPrepass ? 1 : cranvk_graphics_shader_count;
+
+	uint32_t bindlessSetIndex = cranvk_no_bindless_set;
+	if (pipelineDesc->bindless)
+	{
+		cranvk_assert(vkDevice->bindless.supported);
+		bindlessSetIndex = setLayoutCount;
+		descriptorSetLayouts[setLayoutCount++] = vkDevice->bindless.layout;
+	}
+	job.layout = cranvk_request_pipeline_layout(vkDevice, descriptorSetLayouts, setLayoutCount, pipelineDesc->pushConstants.ranges, pipelineDesc->pushConstants.count);
+
+	cranvk_assert(pipelineDesc->vertexInputs.count <= cranvk_max_vertex_inputs);
+	for (uint32_t i = 0; i < pipelineDesc->vertexInputs.count; i++)
+	{
+		job.inputBindings[i] = (VkVertexInputBindingDescription)
+		{
+			.binding = pipelineDesc->vertexInputs.inputs[i].binding,
+			.stride = pipelineDesc->vertexInputs.inputs[i].stride,
+			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX // TODO: We probably want a parameter for this
+		};
+	}
+	job.inputBindingCount = pipelineDesc->vertexInputs.count;
+
+	VkFormat vkFormatConversionTable[crang_vertex_format_max] =
+	{
+		[crang_vertex_format_f32_1] = VK_FORMAT_R32_SFLOAT,
+		[crang_vertex_format_f32_2] = VK_FORMAT_R32G32_SFLOAT,
+		[crang_vertex_format_f32_3] = VK_FORMAT_R32G32B32_SFLOAT,
+	};
+
+	cranvk_assert(pipelineDesc->vertexAttributes.count <= cranvk_max_vertex_attributes);
+	for (uint32_t i = 0; i < pipelineDesc->vertexAttributes.count; i++)
+	{
+		job.inputAttributes[i] = (VkVertexInputAttributeDescription)
+		{
+			.binding = pipelineDesc->vertexAttributes.attribs[i].binding,
+			.location = pipelineDesc->vertexAttributes.attribs[i].location,
+			.offset = pipelineDesc->vertexAttributes.attribs[i].offset,
+			.format = vkFormatConversionTable[pipelineDesc->vertexAttributes.attribs[i].format]
+		};
+	}
+	job.inputAttributeCount = pipelineDesc->vertexAttributes.count;
+
+	VkCompareOp depthCompareConversionTable[] =
+	{
+		[crang_depth_mode_none] = VK_COMPARE_OP_ALWAYS,
+		[crang_depth_mode_test_write] = VK_COMPARE_OP_LESS_OR_EQUAL,
+		[crang_depth_mode_prepass] = VK_COMPARE_OP_LESS,
+		[crang_depth_mode_equal] = VK_COMPARE_OP_EQUAL
+	};
+
+	// Also what binding a dynamic pipeline resets the dynamic state to.
+	job.state = (cranvk_dynamic_state_t)
+	{
+		.cullMode = cranvk_cull_mode_conversion_table[pipelineDesc->cullMode],
+		.frontFace = cranvk_front_face_conversion_table[pipelineDesc->frontFace],
+		.topology = cranvk_topology_conversion_table[pipelineDesc->topology],
+		.depthTestEnable = pipelineDesc->depthMode != crang_depth_mode_none ? VK_TRUE : VK_FALSE,
+		.depthWriteEnable = pipelineDesc->depthMode == crang_depth_mode_test_write || isPrepass ? VK_TRUE : VK_FALSE,
+		.depthCompareOp = depthCompareConversionTable[pipelineDesc->depthMode]
+	};
+	cranvk_assert(!pipelineDesc->dynamicState || vkDevice->extendedDynamicState.supported);
+
+	cranvk_assert(vkDevice->shaders.types[vertShader.id] == crang_shader_vertex);
+	cranvk_assert(isPrepass || vkDevice->shaders.types[fragShader.id] == crang_shader_fragment);
+	job.vertexShader = vkDevice->shaders.shaders[vertShader.id];
+	job.fragmentShader = isPrepass ? VK_NULL_HANDLE : vkDevice->shaders.shaders[fragShader.id];
+	cranvk_store_specialization(&job, crang_shader_vertex, &pipelineDesc->specializations[crang_shader_vertex]);
+	if (!isPrepass)
+	{
+		cranvk_store_specialization(&job, crang_shader_fragment, &pipelineDesc->specializations[crang_shader_fragment]);
+	}
+	job.renderPass = renderPass;
+	job.renderPassId = renderPassId;
+	job.colorAttachmentCount = colorAttachmentCount;
+	job.isPrepass = isPrepass;
+	job.dynamicState = pipelineDesc->dynamicState;
+
+	if (!cranvk_add_pipeline(vkDevice, &job, pipelineId))
+	{
+		return false;
+	}
+
+	cranvk_store_push_constant_ranges(vkDevice, *pipelineId, pipelineDesc->pushConstants.ranges, pipelineDesc->pushConstants.count);
+	vkDevice->pipelines.bindlessSetIndices[pipelineId->id] = bindlessSetIndex;
+	vkDevice->pipelines.hasDynamicState[pipelineId->id] = pipelineDesc->dynamicState;
+	vkDevice->pipelines.dynamicStates[pipelineId->id] = job.state;
+	return true;
+}
+
+// Only reads the job, safe to call from the pipeline compiler's workers.
+VkPipeline cranvk_compile_graphics_pipeline(cranvk_graphics_device_t* vkDevice, cranvk_pipeline_job_t const* job)
+{
+	cranvk_dynamic_state_t const* state = &job->state;
+
+	VkPipelineVertexInputStateCreateInfo vertexInputCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = job->inputBindingCount,
+		.pVertexBindingDescriptions = job->inputBindings,
+		.vertexAttributeDescriptionCount = job->inputAttributeCount,
+		.pVertexAttributeDescriptions = job->inputAttributes
+	};
+
+	// Input Assembly
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = state->topology
+	};
+
+	// Rasterization
+	VkPipelineRasterizationStateCreateInfo rasterizationCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.rasterizerDiscardEnable = VK_FALSE,
+		.depthBiasEnable = VK_FALSE,
+		.depthClampEnable = VK_FALSE,
+		.frontFace = state->frontFace,
+		.lineWidth = 1.0f,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = state->cullMode
+	};
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachment =
+	{
+		.blendEnable = VK_TRUE,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.alphaBlendOp = VK_BLEND_OP_ADD,
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+	};
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachments[cranvk_max_graph_color_attachments];
+	for (uint32_t i = 0; i < job->colorAttachmentCount; i++)
+	{
+		colorBlendAttachments[i] = colorBlendAttachment;
+		colorBlendAttachments[i].colorWriteMask = job->isPrepass ? 0 : colorBlendAttachment.colorWriteMask;
+	}
+
+	VkPipelineColorBlendStateCreateInfo colorBlendCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.attachmentCount = job->colorAttachmentCount,
+		.pAttachments = colorBlendAttachments
+	};
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = state->depthTestEnable,
+		.depthWriteEnable = state->depthWriteEnable,
+		.depthCompareOp = state->depthCompareOp,
+		.depthBoundsTestEnable = VK_FALSE,
+		.minDepthBounds = 0.0f,
+		.maxDepthBounds = 1.0f,
+		.stencilTestEnable = VK_FALSE
+		/*.front, .back */
+	};
+
+	VkPipelineMultisampleStateCreateInfo multisampleCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+	};
+
+	VkSpecializationInfo vertexSpecialization;
+	VkPipelineShaderStageCreateInfo vertexStage =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.pName = "main",
+		.module = job->vertexShader,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.pSpecializationInfo = cranvk_get_specialization(job, crang_shader_vertex, &vertexSpecialization)
+	};
+
+	VkSpecializationInfo fragmentSpecialization;
+	VkPipelineShaderStageCreateInfo fragStage =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.pName = "main",
+		.module = job->fragmentShader,
+		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pSpecializationInfo = cranvk_get_specialization(job, crang_shader_fragment, &fragmentSpecialization)
+	};
+
+	VkPipelineShaderStageCreateInfo shaderStages[cranvk_graphics_shader_count] = { vertexStage, fragStage };
+
+	// Viewport and scissor are set when recording, resizes don't need new pipelines.
+	VkPipelineViewportStateCreateInfo viewportStateCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.pViewports = NULL,
+		.scissorCount = 1,
+		.pScissors = NULL
+	};
+
+	// The extended states come last so they can be left out.
+	VkDynamicState dynamicStates[] =
+	{
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR,
+		VK_DYNAMIC_STATE_CULL_MODE_EXT,
+		VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+		VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+		VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+		VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+		VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT
+	};
+
+	VkPipelineDynamicStateCreateInfo dynamicStateCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = job->dynamicState ? sizeof(dynamicStates) / sizeof(dynamicStates[0]) : 2,
+		.pDynamicStates = dynamicStates
+	};
+
+	VkGraphicsPipelineCreateInfo graphicsPipelineCreate =
+	{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.layout = job->layout,
+		.renderPass = job->renderPass,
+		.pVertexInputState = &vertexInputCreate,
+		.pInputAssemblyState = &inputAssemblyCreate,
+		.pRasterizationState = &rasterizationCreate,
+		.pColorBlendState = &colorBlendCreate,
+		.pDepthStencilState = &depthStencilCreate,
+		.pMultisampleState = &multisampleCreate,
+
+		.pDynamicState = &dynamicStateCreate,
+		.pViewportState = &viewportStateCreate,
+		.stageCount = job->isPrepass ? 1 : cranvk_graphics_shader_count, // Prepass pipelines only have a vertex stage
+		.pStages = shaderStages
+	};
+
+	// The pipeline cache is internally synchronized, workers share it.
+	VkPipeline pipeline;
+	cranvk_check(vkCreateGraphicsPipelines(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, 1, &graphicsPipelineCreate, cranvk_no_allocator, &pipeline));
+	return pipeline;
+}
+
+crang_pipeline_id_t crang_create_pipeline(crang_graphics_device_t* device, crang_pipeline_desc_t* pipelineDesc)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	crang_pipeline_id_t pipelineId;
+	if (cranvk_prepare_graphics_pipeline(vkDevice, pipelineDesc, &pipelineId))
+	{
+		vkDevice->pipelines.pipelines[pipelineId.id] = cranvk_compile_graphics_pipeline(vkDevice, &vkDevice->pipelines.jobs[pipelineId.id]);
+	}
+	return pipelineId;
+}
+
+cranvk_thread_entry(cranvk_pipeline_compiler_worker)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)data;
+
+	cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+	while (true)
+	{
+		while (vkDevice->pipelineCompiler.queueCount == 0 && !vkDevice->pipelineCompiler.shutdown)
+		{
+			cranvk_condition_wait(&vkDevice->pipelineCompiler.jobAvailable, &vkDevice->pipelineCompiler.mutex);
+		}
+
+		// Shutting down still drains the queue, every pipeline has to exist to be destroyed.
+		if (vkDevice->pipelineCompiler.queueCount == 0)
+		{
+			break;
+		}
+
+		crang_pipeline_id_t pipelineId = { .id = vkDevice->pipelineCompiler.queue[vkDevice->pipelineCompiler.queueStart] };
+		vkDevice->pipelineCompiler.queueStart = (vkDevice->pipelineCompiler.queueStart + 1) % vkDevice->capacities.pipelineCount;
+		vkDevice->pipelineCompiler.queueCount--;
+		cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+
+		// Jobs aren't written to after being queued.
+		VkPipeline pipeline = cranvk_compile_graphics_pipeline(vkDevice, &vkDevice->pipelines.jobs[pipelineId.id]);
+
+		cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+		vkDevice->pipelines.pipelines[pipelineId.id] = pipeline;
+		vkDevice->pipelines.pending[pipelineId.id] = false;
+		vkDevice->pipelineCompiler.pendingCount--;
+		cranvk_condition_broadcast(&vkDevice->pipelineCompiler.jobDone);
+	}
+	cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+
+	return 0;
+}
+
+crang_pipeline_id_t crang_create_pipeline_async(crang_graphics_device_t* device, crang_pipeline_desc_t* pipelineDesc)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	// One core is left to the calling thread.
+	if (vkDevice->pipelineCompiler.threadCount == 0)
+	{
+		uint32_t processorCount = cranvk_processor_count();
+		uint32_t threadCount = processorCount > 1 ? processorCount - 1 : 1;
+		threadCount = threadCount < cranvk_max_pipeline_compile_threads ? threadCount : cranvk_max_pipeline_compile_threads;
+		for (uint32_t i = 0; i < threadCount; i++)
+		{
+			cranvk_thread_create(&vkDevice->pipelineCompiler.threads[i], cranvk_pipeline_compiler_worker, vkDevice);
+		}
+		vkDevice->pipelineCompiler.threadCount = threadCount;
+	}
+
+	crang_pipeline_id_t pipelineId;
+	if (!cranvk_prepare_graphics_pipeline(vkDevice, pipelineDesc, &pipelineId))
+	{
+		return pipelineId;
+	}
+
+	// Shader input, push constant and bindless commands use the pipeline's layout whichever pipeline is bound.
+	// Layouts are shared, a fallback with another layout doesn't use the same inputs and binding waits instead.
+	bool hasFallback = pipelineDesc->hasFallback;
+	if (hasFallback)
+	{
+		uint32_t fallbackIndex = pipelineDesc->fallback.id;
+		cranvk_assert(fallbackIndex < vkDevice->pipelines.pipelineCount);
+		hasFallback =
+			vkDevice->pipelines.layouts[fallbackIndex] == vkDevice->pipelines.layouts[pipelineId.id] &&
+			vkDevice->pipelines.bindPoints[fallbackIndex] == vkDevice->pipelines.bindPoints[pipelineId.id];
+		cranvk_assert(hasFallback);
+	}
+
+	vkDevice->pipelines.async[pipelineId.id] = true;
+	vkDevice->pipelines.hasFallback[pipelineId.id] = hasFallback;
+	vkDevice->pipelines.fallbacks[pipelineId.id] = pipelineDesc->fallback;
+
+	cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+	vkDevice->pipelines.pending[pipelineId.id] = true;
+	vkDevice->pipelineCompiler.pendingCount++;
+
+	uint32_t queueEnd = (vkDevice->pipelineCompiler.queueStart + vkDevice->pipelineCompiler.queueCount) % vkDevice->capacities.pipelineCount;
+	vkDevice->pipelineCompiler.queue[queueEnd] = pipelineId.id;
+	vkDevice->pipelineCompiler.queueCount++;
+	cranvk_condition_broadcast(&vkDevice->pipelineCompiler.jobAvailable);
+	cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+
+	return pipelineId;
+}
+
+bool crang_pipeline_ready(crang_graphics_device_t* device, crang_pipeline_id_t pipelineId)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	if (!vkDevice->pipelines.async[pipelineId.id])
+	{
+		return true;
+	}
+
+	cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+	bool ready = !vkDevice->pipelines.pending[pipelineId.id];
+	cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+	return ready;
+}
+
+void crang_wait_pipelines(crang_graphics_device_t* device)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+	while (vkDevice->pipelineCompiler.pendingCount > 0)
+	{
+		cranvk_condition_wait(&vkDevice->pipelineCompiler.jobDone, &vkDevice->pipelineCompiler.mutex);
+	}
+	cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+}
+
+// Pipelines still compiling are swapped for their fallback, or waited on without one.
+crang_pipeline_id_t cranvk_resolve_pipeline(cranvk_graphics_device_t* vkDevice, crang_pipeline_id_t pipelineId)
+{
+	if (!vkDevice->pipelines.async[pipelineId.id])
+	{
+		return pipelineId;
+	}
+
+	cranvk_mutex_lock(&vkDevice->pipelineCompiler.mutex);
+	bool useFallback = vkDevice->pipelines.pending[pipelineId.id] && vkDevice->pipelines.hasFallback[pipelineId.id];
+	while (!useFallback && vkDevice->pipelines.pending[pipelineId.id])
+	{
+		cranvk_condition_wait(&vkDevice->pipelineCompiler.jobDone, &vkDevice->pipelineCompiler.mutex);
+	}
+	cranvk_mutex_unlock(&vkDevice->pipelineCompiler.mutex);
+
+	return useFallback ? cranvk_resolve_pipeline(vkDevice, vkDevice->pipelines.fallbacks[pipelineId.id]) : pipelineId;
+}
+
+crang_pipeline_id_t crang_create_compute_pipeline(crang_graphics_device_t* device, crang_compute_pipeline_desc_t* pipelineDesc)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+
+	crang_shader_id_t computeShader = pipelineDesc->shader;
+	cranvk_assert(vkDevice->shaders.types[computeShader.id] == crang_shader_compute);
+
+	VkDescriptorSetLayout descriptorSetLayouts[2] = { vkDevice->shaders.descriptorSetLayouts[computeShader.id] };
+	uint32_t setLayoutCount = 1;
+
+	uint32_t bindlessSetIndex = cranvk_no_bindless_set;
+	if (pipelineDesc->bindless)
+	{
+		cranvk_assert(vkDevice->bindless.supported);
+		bindlessSetIndex = setLayoutCount;
+		descriptorSetLayouts[setLayoutCount++] = vkDevice->bindless.layout;
+	}
+
+	// Compute pipelines only fill in the stage and the layout of their job.
+	cranvk_pipeline_job_t job;
+	memset(&job, 0, sizeof(cranvk_pipeline_job_t));
+	job.bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+	job.layout = cranvk_request_pipeline_layout(vkDevice, descriptorSetLayouts, setLayoutCount, pipelineDesc->pushConstants.ranges, pipelineDesc->pushConstants.count);
+	job.computeShader = vkDevice->shaders.shaders[computeShader.id];
+	cranvk_store_specialization(&job, crang_shader_compute, &pipelineDesc->specialization);
+
+	crang_pipeline_id_t pipelineId;
+	if (!cranvk_add_pipeline(vkDevice, &job, &pipelineId))
+	{
+		return pipelineId;
+	}
+
+	cranvk_store_push_constant_ranges(vkDevice, pipelineId, pipelineDesc->pushConstants.ranges, pipelineDesc->pushConstants.count);
+	vkDevice->pipelines.bindlessSetIndices[pipelineId.id] = bindlessSetIndex;
+
+	{
+		VkSpecializationInfo specialization;
+		VkComputePipelineCreateInfo computePipelineCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.layout = job.layout,
+			.stage =
+			{
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.pName = "main",
+				.module = job.computeShader,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.pSpecializationInfo = cranvk_get_specialization(&job, crang_shader_compute, &specialization)
+			}
+		};
+
+		cranvk_check(vkCreateComputePipelines(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, 1, &computePipelineCreate, cranvk_no_allocator, &vkDevice->pipelines.pipelines[pipelineId.id]));
+	}
+
+	return pipelineId;
+}
+
+void crang_render(crang_render_desc_t* renderDesc)
+{
+	cranvk_present_t* vkPresent = (cranvk_present_t*)renderDesc->presentCtx;
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)renderDesc->graphicsDevice;
+	cranvk_render_pass_t* vkRenderPass = &vkPresent->presentRenderPass;
+	cranvk_surface_t* vkSurface = (cranvk_surface_t*)renderDesc->surface;
+
+	// Start the frame late enough that its present lands on the next deadline, input sampled before this is fresher.
+	if (vkPresent->pacing.targetFrameMs > 0.0 && vkPresent->pacing.nextPresentMs > 0.0)
+	{
+		cranvk_sleep_until_ms(vkPresent->pacing.nextPresentMs - vkPresent->pacing.cpuWorkMs);
+	}
+
+	uint32_t currentBackBuffer = vkPresent->backBufferIndex;
+	double frameStartMs = cranvk_time_ms();
+
+	// Check on the frames that are still in flight
+	uint64_t completedValue = cranvk_completed_value(vkDevice);
+	for (uint32_t i = 0; i < vkPresent->framesInFlight; i++)
+	{
+		if (vkPresent->latency.pending[i] && (i == currentBackBuffer || vkPresent->frameValues[i] <= completedValue))
+		{
+			if (i == currentBackBuffer)
+			{
+				cranvk_wait_value(vkDevice, vkPresent->frameValues[i]);
+			}
+
+			crang_frame_timing_t* timing = &vkPresent->latency.inFlight[i];
+			timing->gpuDoneMs = cranvk_time_ms();
+
+			float latencyMs = (float)(timing->gpuDoneMs - timing->cpuStartMs);
+			vkPresent->latency.lastLatencyMs = latencyMs;
+			vkPresent->latency.averageLatencyMs = vkPresent->latency.averageLatencyMs == 0.0f ? latencyMs : vkPresent->latency.averageLatencyMs * 0.9f + latencyMs * 0.1f;
+			vkPresent->latency.pending[i] = false;
+
+			// Frames can complete out of order here, the ring is ordered by completion. Drop the oldest when full.
+			if (vkPresent->latency.completedCount == cranvk_max_frame_timing_count)
+			{
+				vkPresent->latency.completedStart = (vkPresent->latency.completedStart + 1) % cranvk_max_frame_timing_count;
+				vkPresent->latency.completedCount--;
+			}
+			uint32_t slot = (vkPresent->latency.completedStart + vkPresent->latency.completedCount) % cranvk_max_frame_timing_count;
+			vkPresent->latency.completed[slot] = *timing;
+			vkPresent->latency.completedCount++;
+		}
+	}
+
+	cranvk_wait_value(vkDevice, vkPresent->frameValues[currentBackBuffer]);
+	cranvk_collect_retired_swapchains(vkDevice, vkPresent, false);
+	cranvk_collect_deferred_destroys(vkDevice, false);
+
+	// Headless presents cycle through their images, the image values below keep them from being reused too early.
+	uint32_t imageIndex = 0;
+	if (vkPresent->headless)
+	{
+		imageIndex = (uint32_t)(vkPresent->frameCount % vkPresent->swapchainData.imageCount);
+	}
+	else
+	{
+		// An out of date swapchain is replaced and we acquire from the new one right away, suboptimal images are still rendered to.
+		VkResult result = vkAcquireNextImageKHR(vkDevice->devices.logicalDevice, vkPresent->swapchainData.swapchain, UINT64_MAX, vkPresent->acquireSemaphores[currentBackBuffer], VK_NULL_HANDLE, &imageIndex);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			if (!cranvk_resize_present(vkDevice, vkSurface, vkPresent))
+			{
+				return;
+			}
+
+			result = vkAcquireNextImageKHR(vkDevice->devices.logicalDevice, vkPresent->swapchainData.swapchain, UINT64_MAX, vkPresent->acquireSemaphores[currentBackBuffer], VK_NULL_HANDLE, &imageIndex);
+		}
+
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			return;
+		}
+	}
+
+	// With more frames in flight than images, the image might still be used by a frame from another slot.
+	cranvk_wait_value(vkDevice, vkPresent->swapchainData.imageValues[imageIndex]);
+
+	// The depth prepass is executed first, in the same render pass.
+	uint32_t* renderBufferIds = vkDevice->commandBuffers.renderIds;
+	uint32_t renderBufferCount = 0;
+	{
+		cranvk_assert(renderDesc->depthPrepass.count + renderDesc->recordedBuffers.count <= vkDevice->capacities.recordingBufferCount);
+		for (uint32_t i = 0; i < renderDesc->depthPrepass.count; i++)
+		{
+			renderBufferIds[renderBufferCount++] = renderDesc->depthPrepass.buffers[i].id;
+		}
+
+		for (uint32_t i = 0; i < renderDesc->recordedBuffers.count; i++)
+		{
+			renderBufferIds[renderBufferCount++] = renderDesc->recordedBuffers.buffers[i].id;
+		}
+	}
+
+	VkFramebuffer framebuffer = cranvk_get_framebuffer(vkDevice, vkPresent, vkRenderPass->framebufferIndices[imageIndex]);
+	uint64_t primaryKey = cranvk_hash_seed;
+	{
+		primaryKey = cranvk_hash(primaryKey, renderDesc->clearColor, sizeof(renderDesc->clearColor));
+		primaryKey = cranvk_hash(primaryKey, &framebuffer, sizeof(VkFramebuffer));
+		primaryKey = cranvk_hash(primaryKey, &renderBufferCount, sizeof(uint32_t));
+		for (uint32_t i = 0; i < renderBufferCount; i++)
+		{
+			uint32_t recordedBufferId = renderBufferIds[i];
+			primaryKey = cranvk_hash(primaryKey, &recordedBufferId, sizeof(uint32_t));
+			primaryKey = cranvk_hash(primaryKey, &vkDevice->commandBuffers.recordVersions[recordedBufferId], sizeof(uint32_t));
+		}
+
+		primaryKey = cranvk_hash(primaryKey, &renderDesc->graph, sizeof(crang_graph_t*));
+		if (renderDesc->graph != NULL)
+		{
+			cranvk_graph_t* vkGraph = (cranvk_graph_t*)renderDesc->graph;
+			primaryKey = cranvk_hash(primaryKey, vkGraph->passes.recordVersions, sizeof(uint32_t) * vkGraph->passes.count);
+		}
+	}
+
+	// The image's previous frame is done, the primary buffer can be resubmitted or reset.
+	VkCommandBuffer currentCommands = vkPresent->primaryBuffers.buffers[imageIndex];
+	if (!vkPresent->primaryBuffers.valid[imageIndex] || vkPresent->primaryBuffers.keys[imageIndex] != primaryKey)
+	{
+		vkPresent->primaryBuffers.keys[imageIndex] = primaryKey;
+		vkPresent->primaryBuffers.valid[imageIndex] = true;
+
+		cranvk_check(vkResetCommandBuffer(currentCommands, 0));
+
+		VkCommandBufferBeginInfo beginBufferInfo =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+		};
+		cranvk_check(vkBeginCommandBuffer(currentCommands, &beginBufferInfo));
+
+		// Compute work can't live in the render pass, run it before we start rendering.
+		{
+			VkCommandBuffer* computeBuffers = vkDevice->commandBuffers.renderBuffers;
+			uint32_t computeBufferCount = 0;
+			for (uint32_t i = 0; i < renderBufferCount; i++)
+			{
+				uint32_t recordedBufferId = renderBufferIds[i];
+				if (vkDevice->commandBuffers.hasComputeCommands[recordedBufferId])
+				{
+					computeBuffers[computeBufferCount] = vkDevice->commandBuffers.computeBuffers[recordedBufferId];
+					computeBufferCount++;
+				}
+			}
+
+			if (computeBufferCount > 0)
+			{
+				VkPipelineStageFlags graphicsReadStages =
+					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+				VkPipelineStageFlags computeWriteStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+				// The previous frame's graphics work might still be reading what we're about to write.
+				vkCmdPipelineBarrier(currentCommands, graphicsReadStages, computeWriteStages, 0, 0, NULL, 0, NULL, 0, NULL);
+
+				vkCmdExecuteCommands(currentCommands, computeBufferCount, computeBuffers);
+
+				VkMemoryBarrier computeToGraphics =
+				{
+					.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+				};
+				vkCmdPipelineBarrier(currentCommands, computeWriteStages, graphicsReadStages, 0, 1, &computeToGraphics, 0, NULL, 0, NULL);
+			}
+		}
+
+		// The graph renders to its own attachments, the present's render pass samples its outputs.
+		if (renderDesc->graph != NULL)
+		{
+			cranvk_graph_t* vkGraph = (cranvk_graph_t*)renderDesc->graph;
+			cranvk_assert(vkGraph->compiled);
+
+			for (uint32_t i = 0; i < vkGraph->executionCount; i++)
+			{
+				uint32_t pass = vkGraph->executionOrder[i];
+				cranvk_cmd_graph_barrier(currentCommands, &vkGraph->passes.barriers[pass]);
+
+				// Passes that were never recorded still clear their attachments.
+				bool recorded = vkGraph->passes.recordVersions[pass] > 0;
+				if (vkGraph->passes.types[pass] == crang_graph_pass_raster)
+				{
+					VkRenderPassBeginInfo passBeginInfo =
+					{
+						.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+						.renderPass = vkGraph->passes.renderPasses[pass],
+						.framebuffer = vkGraph->passes.framebuffers[pass],
+						.renderArea = { .extent = vkGraph->passes.extents[pass] },
+						.clearValueCount = vkGraph->passes.attachmentCounts[pass],
+						.pClearValues = vkGraph->passes.clearValues[pass]
+					};
+					vkCmdBeginRenderPass(currentCommands, &passBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+					if (recorded)
+					{
+						vkCmdExecuteCommands(currentCommands, 1, &vkGraph->passes.commandBuffers[pass]);
+					}
+					vkCmdEndRenderPass(currentCommands);
+				}
+				else if (recorded)
+				{
+					vkCmdExecuteCommands(currentCommands, 1, &vkGraph->passes.commandBuffers[pass]);
+				}
+			}
 
-	{
-		VkDescriptorSetLayout descriptorSetLayouts[crang_shader_max] =
+			cranvk_cmd_graph_barrier(currentCommands, &vkGraph->outputBarrier);
+		}
+
+		VkClearColorValue clearColor = { .float32 = { renderDesc->clearColor[0], renderDesc->clearColor[1], renderDesc->clearColor[2], 1.0f } };
+		VkClearValue clearValues[2] =
 		{
-			[crang_shader_vertex] = vkDevice->shaders.descriptorSetLayouts[vertShader.id],
-			[crang_shader_fragment] = vkDevice->shaders.descriptorSetLayouts[fragShader.id]
+			{ .color = clearColor },
+			{ .depthStencil = { .depth = 1.0f, .stencil = 0 } }
 		};
 
-		VkPipelineLayoutCreateInfo pipelineLayoutCreate =
+		VkRenderPassBeginInfo renderPassBeginInfo =
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-			.setLayoutCount = crang_shader_max,
-			.pSetLayouts = descriptorSetLayouts
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+			.renderPass = vkRenderPass->renderPass,
+			.framebuffer = framebuffer,
+			.renderArea = { .extent = vkPresent->surfaceExtents },
+			.clearValueCount = vkPresent->depthEnabled ? 2 : 1,
+			.pClearValues = clearValues
 		};
+		vkCmdBeginRenderPass(currentCommands, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-		cranvk_check(vkCreatePipelineLayout(vkDevice->devices.logicalDevice, &pipelineLayoutCreate, cranvk_no_allocator, &vkDevice->pipelines.layouts[pipelineId.id]));
-	}
-
-	{
-		VkVertexInputBindingDescription inputBindings[cranvk_max_vertex_inputs];
-		for (uint32_t i = 0; i < pipelineDesc->vertexInputs.count; i++)
+		// The compute buffers have been executed, their scratch can be reused.
+		VkCommandBuffer* recordedBuffers = vkDevice->commandBuffers.renderBuffers;
+		for (uint32_t i = 0; i < renderBufferCount; i++)
 		{
-			inputBindings[i] = (VkVertexInputBindingDescription)
-			{
-				.binding = pipelineDesc->vertexInputs.inputs[i].binding,
-				.stride = pipelineDesc->vertexInputs.inputs[i].stride,
-				.inputRate = VK_VERTEX_INPUT_RATE_VERTEX // TODO: We probably want a parameter for this
-			};
+			recordedBuffers[i] = vkDevice->commandBuffers.recordingBuffers[renderBufferIds[i]];
 		}
 
-		VkFormat vkFormatConversionTable[crang_vertex_format_max] =
+		if (renderBufferCount > 0)
 		{
-			[crang_vertex_format_f32_1] = VK_FORMAT_R32_SFLOAT,
-			[crang_vertex_format_f32_2] = VK_FORMAT_R32G32_SFLOAT,
-			[crang_vertex_format_f32_3] = VK_FORMAT_R32G32B32_SFLOAT,
-		};
+			vkCmdExecuteCommands(currentCommands, renderBufferCount, recordedBuffers);
+		}
+
+		vkCmdEndRenderPass(currentCommands);
 
-		VkVertexInputAttributeDescription inputAttributes[cranvk_max_vertex_attributes];
-		for (uint32_t i = 0; i < pipelineDesc->vertexAttributes.count; i++)
+		// The render pass leaves the image in transfer src, its dependency covers the copy.
+		if (vkPresent->readback)
 		{
-			inputAttributes[i] = (VkVertexInputAttributeDescription)
+			VkBufferImageCopy region =
 			{
-				.binding = pipelineDesc->vertexAttributes.attribs[i].binding,
-				.location = pipelineDesc->vertexAttributes.attribs[i].location,
-				.offset = pipelineDesc->vertexAttributes.attribs[i].offset,
-				.format = vkFormatConversionTable[pipelineDesc->vertexAttributes.attribs[i].format]
+				.bufferOffset = 0,
+				.bufferRowLength = 0,
+				.bufferImageHeight = 0,
+				.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+				.imageOffset = { 0, 0, 0 },
+				.imageExtent = { .width = vkPresent->surfaceExtents.width, .height = vkPresent->surfaceExtents.height, .depth = 1 }
 			};
+			vkCmdCopyImageToBuffer(currentCommands, vkPresent->offscreen.images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, vkPresent->offscreen.readbackBuffers[imageIndex], 1, &region);
+
+			VkBufferMemoryBarrier transferToHost =
+			{
+				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.buffer = vkPresent->offscreen.readbackBuffers[imageIndex],
+				.offset = 0,
+				.size = VK_WHOLE_SIZE
+			};
+			vkCmdPipelineBarrier(currentCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &transferToHost, 0, NULL);
 		}
 
-		VkPipelineVertexInputStateCreateInfo vertexInputCreate =
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-			.vertexBindingDescriptionCount = pipelineDesc->vertexInputs.count,
-			.pVertexBindingDescriptions = inputBindings,
-			.vertexAttributeDescriptionCount = pipelineDesc->vertexAttributes.count,
-			.pVertexAttributeDescriptions = inputAttributes
-		};
+		vkEndCommandBuffer(currentCommands);
+	}
 
-		// Input Assembly
-		VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreate =
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-			.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
-		};
+	VkSemaphore* acquire = &vkPresent->acquireSemaphores[currentBackBuffer];
+	VkSemaphore* finished = &vkPresent->presentSemaphores[currentBackBuffer];
 
-		// Rasterization
-		VkPipelineRasterizationStateCreateInfo rasterizationCreate =
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-			.rasterizerDiscardEnable = VK_FALSE,
-			.depthBiasEnable = VK_FALSE,
-			.depthClampEnable = VK_FALSE,
-			.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-			.lineWidth = 1.0f,
-			.polygonMode = VK_POLYGON_MODE_FILL,
-			.cullMode = VK_CULL_MODE_BACK_BIT
-		};
+	// The timeline goes first, headless frames only signal it. Binary semaphores ignore their value.
+	uint64_t frameValue = ++vkDevice->timeline.submittedValue;
+	VkSemaphore signalSemaphores[2] = { vkDevice->timeline.semaphore, *finished };
+	uint64_t signalValues[2] = { frameValue, 0 };
+	VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.signalSemaphoreValueCount = vkPresent->headless ? 1 : 2,
+		.pSignalSemaphoreValues = signalValues
+	};
 
-		VkPipelineColorBlendAttachmentState colorBlendAttachment =
-		{
-			.blendEnable = VK_TRUE,
-			.colorBlendOp = VK_BLEND_OP_ADD,
-			.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-			.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-			.alphaBlendOp = VK_BLEND_OP_ADD,
-			.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-			.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-			.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
-		};
+	// The render pass' external dependency waits on color output, the image's transition chains after the acquire.
+	VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkSubmitInfo submitInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &timelineSubmitInfo,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &currentCommands,
+		.waitSemaphoreCount = vkPresent->headless ? 0 : 1,
+		.pWaitSemaphores = acquire,
+		.signalSemaphoreCount = vkPresent->headless ? 1 : 2,
+		.pSignalSemaphores = signalSemaphores,
+		.pWaitDstStageMask = &dstStageMask
+	};
 
-		VkPipelineColorBlendStateCreateInfo colorBlendCreate =
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-			.attachmentCount = 1,
-			.pAttachments = &colorBlendAttachment
-		};
+	cranvk_check(vkQueueSubmit(vkDevice->queues.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+	vkPresent->frameValues[currentBackBuffer] = frameValue;
+	vkPresent->swapchainData.imageValues[imageIndex] = frameValue;
+	vkPresent->latency.inFlight[currentBackBuffer] = (crang_frame_timing_t)
+	{
+		.frame = vkPresent->frameCount,
+		.cpuStartMs = frameStartMs,
+		.submitMs = cranvk_time_ms()
+	};
+	vkPresent->latency.pending[currentBackBuffer] = true;
 
-		VkPipelineDepthStencilStateCreateInfo depthStencilCreate =
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-			.depthTestEnable = VK_FALSE,
-			.depthWriteEnable = VK_FALSE,
-			.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
-			.depthBoundsTestEnable = VK_FALSE,
-			.minDepthBounds = 0.0f,
-			.maxDepthBounds = 1.0f,
-			.stencilTestEnable = VK_FALSE
-			/*.front, .back */
-		};
+	// Destroys recorded in what we submitted wait on this frame.
+	for (uint32_t i = 0; i < renderBufferCount; i++)
+	{
+		vkDevice->commandBuffers.submitValues[renderBufferIds[i]] = frameValue;
+		cranvk_queue_destroys(vkDevice, &vkDevice->commandBuffers.singleUseResources[renderBufferIds[i]], frameValue);
+	}
 
-		VkPipelineMultisampleStateCreateInfo multisampleCreate =
+	if (renderDesc->graph != NULL)
+	{
+		cranvk_graph_t* vkGraph = (cranvk_graph_t*)renderDesc->graph;
+		vkGraph->submitValue = frameValue;
+		for (uint32_t i = 0; i < vkGraph->passes.count; i++)
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-			.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
-		};
+			cranvk_queue_destroys(vkDevice, &vkGraph->passes.singleUseResources[i], frameValue);
+		}
+	}
 
-		cranvk_assert(vkDevice->shaders.types[vertShader.id] == crang_shader_vertex);
-		VkPipelineShaderStageCreateInfo vertexStage =
+	VkResult presentResult = VK_SUCCESS;
+	if (vkPresent->headless)
+	{
+		vkPresent->offscreen.lastImage = imageIndex;
+		vkPresent->offscreen.lastValue = frameValue;
+		vkPresent->offscreen.hasFrame = true;
+	}
+	else
+	{
+		VkPresentInfoKHR presentInfo =
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			.pName = "main",
-			.module = vkDevice->shaders.shaders[vertShader.id],
-			.stage = VK_SHADER_STAGE_VERTEX_BIT
+			.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+			.waitSemaphoreCount = 1,
+			.pWaitSemaphores = finished,
+			.swapchainCount = 1,
+			.pSwapchains = &vkPresent->swapchainData.swapchain,
+			.pImageIndices = &imageIndex
 		};
 
-		cranvk_assert(vkDevice->shaders.types[fragShader.id] == crang_shader_fragment);
-		VkPipelineShaderStageCreateInfo fragStage =
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			.pName = "main",
-			.module = vkDevice->shaders.shaders[fragShader.id],
-			.stage = VK_SHADER_STAGE_FRAGMENT_BIT
-		};
+		presentResult = vkQueuePresentKHR(vkDevice->queues.presentQueue, &presentInfo);
+	}
 
-		VkPipelineShaderStageCreateInfo shaderStages[crang_shader_max] = { vertexStage, fragStage };
+	double presentMs = cranvk_time_ms();
+	vkPresent->latency.inFlight[currentBackBuffer].presentMs = presentMs;
 
-		VkRect2D scissor =
-		{
-			{.x = 0,.y = 0 },
-			.extent = vkPresent->surfaceExtents
-		};
+	if (vkPresent->pacing.targetFrameMs > 0.0)
+	{
+		double cpuWorkMs = presentMs - frameStartMs;
+		vkPresent->pacing.cpuWorkMs = vkPresent->pacing.cpuWorkMs == 0.0 ? cpuWorkMs : vkPresent->pacing.cpuWorkMs * 0.9 + cpuWorkMs * 0.1;
 
-		// TODO: What about resizing?
-		VkViewport viewport =
+		// Keep the deadlines on a fixed cadence, a frame that's more than an interval late starts a new one instead of bunching up frames to catch up.
+		vkPresent->pacing.nextPresentMs += vkPresent->pacing.targetFrameMs;
+		if (vkPresent->pacing.nextPresentMs < presentMs)
 		{
-			.x = 0,
-			.y = 0,
-			.width = (float)vkPresent->surfaceExtents.width,
-			.height = (float)vkPresent->surfaceExtents.height,
-			.minDepth = 0.0f,
-			.maxDepth = 1.0f
-		};
+			vkPresent->pacing.nextPresentMs = presentMs + vkPresent->pacing.targetFrameMs;
+		}
+	}
+
+	vkPresent->backBufferIndex = (vkPresent->backBufferIndex + 1) % vkPresent->framesInFlight;
+	vkPresent->frameCount++;
+
+	// After counting the frame, it's one of the frames the old swapchain has to wait for.
+	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+	{
+		cranvk_resize_present(vkDevice, vkSurface, vkPresent);
+	}
+}
 
-		VkPipelineViewportStateCreateInfo viewportStateCreate =
+VkCommandBuffer cranvk_get_compute_commands(cranvk_execution_ctx_t* context)
+{
+	// Raster graph passes have nowhere to put compute work.
+	cranvk_assert(context->computeCommandBuffer != VK_NULL_HANDLE);
+	if (!context->computeCommandsBegun)
+	{
+		VkCommandBufferInheritanceInfo inheritanceInfo =
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-			.viewportCount = 1,
-			.pViewports = &viewport,
-			.scissorCount = 1,
-			.pScissors = &scissor
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+			.renderPass = VK_NULL_HANDLE,
+			.framebuffer = VK_NULL_HANDLE
 		};
 
-		VkGraphicsPipelineCreateInfo graphicsPipelineCreate =
+		VkCommandBufferBeginInfo beginBufferInfo =
 		{
-			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-			.layout = vkDevice->pipelines.layouts[pipelineId.id],
-			.renderPass = vkRenderPass->renderPass,
-			.pVertexInputState = &vertexInputCreate,
-			.pInputAssemblyState = &inputAssemblyCreate,
-			.pRasterizationState = &rasterizationCreate,
-			.pColorBlendState = &colorBlendCreate,
-			.pDepthStencilState = &depthStencilCreate,
-			.pMultisampleState = &multisampleCreate,
-
-			.pDynamicState = NULL,
-			.pViewportState = &viewportStateCreate,
-			.stageCount = crang_shader_max, // TODO: This isn't correct but it works for now
-			.pStages = shaderStages
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+			.pInheritanceInfo = &inheritanceInfo,
 		};
+		cranvk_check(vkBeginCommandBuffer(context->computeCommandBuffer, &beginBufferInfo));
+		context->computeCommandsBegun = true;
+	}
 
-		cranvk_check(vkCreateGraphicsPipelines(vkDevice->devices.logicalDevice, vkDevice->pipelineCache, 1, &graphicsPipelineCreate, cranvk_no_allocator, &vkDevice->pipelines.pipelines[pipelineId.id]));
+	return context->computeCommandBuffer;
+}
+
+#define cranvk_write_access_mask (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT)
+
+// Batches a barrier for the next command, a null buffer or a full batch waits on all memory instead.
+void cranvk_batch_barrier(cranvk_execution_ctx_t* context, VkBuffer buffer, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess)
+{
+	context->barriers.srcStages |= srcStages;
+	context->barriers.dstStages |= dstStages;
+	if (buffer == VK_NULL_HANDLE || context->barriers.bufferCount == cranvk_max_batched_barrier_count)
+	{
+		context->barriers.srcAccess |= srcAccess;
+		context->barriers.dstAccess |= dstAccess;
+		return;
 	}
 
-	return pipelineId;
+	context->barriers.buffers[context->barriers.bufferCount++] = (VkBufferMemoryBarrier)
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = srcAccess,
+		.dstAccessMask = dstAccess,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE
+	};
 }
 
-void crang_render(crang_render_desc_t* renderDesc)
+// Records every barrier batched since the last command as a single vkCmdPipelineBarrier.
+void cranvk_flush_barriers(cranvk_execution_ctx_t* context)
 {
-	cranvk_present_t* vkPresent = (cranvk_present_t*)renderDesc->presentCtx;
-	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)renderDesc->graphicsDevice;
-	cranvk_render_pass_t* vkRenderPass = &vkPresent->presentRenderPass;
-	cranvk_surface_t* vkSurface = (cranvk_surface_t*)renderDesc->surface;
+	if (context->barriers.srcStages == 0)
+	{
+		return;
+	}
 
-	// Start the frame
-	uint32_t currentBackBuffer = vkPresent->backBufferIndex;
+	VkMemoryBarrier memoryBarrier =
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = context->barriers.srcAccess,
+		.dstAccessMask = context->barriers.dstAccess
+	};
 
-	cranvk_check(vkWaitForFences(vkDevice->devices.logicalDevice, 1, &vkPresent->presentFences[currentBackBuffer], VK_TRUE, UINT64_MAX));
-	cranvk_check(vkResetFences(vkDevice->devices.logicalDevice, 1, &vkPresent->presentFences[currentBackBuffer]));
+	// Waits on reads only need the execution dependency.
+	uint32_t memoryBarrierCount = context->barriers.srcAccess != 0 ? 1 : 0;
+	vkCmdPipelineBarrier(
+		cranvk_get_compute_commands(context), context->barriers.srcStages, context->barriers.dstStages, 0,
+		memoryBarrierCount, &memoryBarrier, context->barriers.bufferCount, context->barriers.buffers, 0, NULL);
+
+	context->barriers.srcStages = 0;
+	context->barriers.dstStages = 0;
+	context->barriers.srcAccess = 0;
+	context->barriers.dstAccess = 0;
+	context->barriers.bufferCount = 0;
+}
 
-	uint32_t imageIndex = 0;
-	VkResult result = vkAcquireNextImageKHR(vkDevice->devices.logicalDevice, vkPresent->swapchainData.swapchain, UINT64_MAX, vkPresent->acquireSemaphores[currentBackBuffer], VK_NULL_HANDLE, &imageIndex);
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+// Batches what an access has to wait on from the previous accesses in state.
+// Writes wait on the last write and the reads since, reads only wait on the last write.
+void cranvk_wait_buffer_access(cranvk_execution_ctx_t* context, cranvk_buffer_access_t* state, VkBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	VkPipelineStageFlags waitStages = 0;
+	if ((access & cranvk_write_access_mask) != 0)
 	{
-		cranvk_resize_present(vkDevice, vkSurface, vkPresent);
-		return;
+		if ((stages & ~state->syncedStages) != 0 || (access & ~state->syncedAccess) != 0)
+		{
+			waitStages = state->writeStages | state->readStages;
+		}
+	}
+	else if ((stages & ~state->visibleStages) != 0 || (access & ~state->visibleAccess) != 0)
+	{
+		waitStages = state->writeStages;
 	}
 
-	VkCommandBuffer currentCommands = vkPresent->primaryRenderBuffers[currentBackBuffer];
+	if (waitStages != 0)
 	{
-		cranvk_check(vkResetCommandBuffer(currentCommands, 0));
+		cranvk_batch_barrier(context, buffer, waitStages, state->writeAccess, stages, access);
+	}
 
-		VkCommandBufferBeginInfo beginBufferInfo =
+	state->visibleStages |= stages;
+	state->visibleAccess |= access;
+	if ((access & cranvk_write_access_mask) != 0)
+	{
+		state->syncedStages |= stages;
+		state->syncedAccess |= access;
+	}
+}
+
+void cranvk_record_buffer_access(cranvk_buffer_access_t* state, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	VkAccessFlags writeAccess = access & cranvk_write_access_mask;
+	if (writeAccess != 0)
+	{
+		*state = (cranvk_buffer_access_t)
 		{
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+			.writeStages = stages,
+			.writeAccess = writeAccess,
+			.readStages = (access & ~cranvk_write_access_mask) != 0 ? stages : 0
 		};
-		cranvk_check(vkBeginCommandBuffer(currentCommands, &beginBufferInfo));
+	}
+	else
+	{
+		state->readStages |= stages;
+		state->syncedStages = 0;
+		state->syncedAccess = 0;
+	}
+}
 
-		VkClearColorValue clearColor = { .float32 = { renderDesc->clearColor[0], renderDesc->clearColor[1], renderDesc->clearColor[2], 1.0f } };
-		VkClearValue clearValue =
+// Forgets the tracked buffers, untracked now stands in for them.
+void cranvk_untrack_buffers(cranvk_execution_ctx_t* context)
+{
+	cranvk_buffer_access_t* untracked = &context->bufferAccesses.untracked;
+	for (uint32_t i = 0; i < context->bufferAccesses.count; i++)
+	{
+		cranvk_buffer_access_t* state = &context->bufferAccesses.accesses[i];
+		if (state->writeStages != 0)
 		{
-			.color = clearColor
-		};
+			untracked->visibleStages &= state->visibleStages;
+			untracked->visibleAccess &= state->visibleAccess;
+		}
+		untracked->syncedStages &= state->syncedStages;
+		untracked->syncedAccess &= state->syncedAccess;
+		untracked->writeStages |= state->writeStages;
+		untracked->writeAccess |= state->writeAccess;
+		untracked->readStages |= state->readStages;
+	}
+	context->bufferAccesses.count = 0;
+}
 
-		uint32_t framebufferIndex = vkRenderPass->framebufferIndices[currentBackBuffer];
-		VkRenderPassBeginInfo renderPassBeginInfo =
+// Tracks an access of buffer by the next command, cranvk_flush_barriers then records what it waits on.
+void cranvk_access_buffer(cranvk_execution_ctx_t* context, VkBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	// Dispatches might have used any buffer.
+	cranvk_wait_buffer_access(context, &context->bufferAccesses.untracked, VK_NULL_HANDLE, stages, access);
+
+	uint32_t index = 0;
+	for (; index < context->bufferAccesses.count; index++)
+	{
+		if (context->bufferAccesses.buffers[index] == buffer)
 		{
-			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-			.renderPass = vkRenderPass->renderPass,
-			.framebuffer = vkPresent->framebufferData.framebuffers[framebufferIndex],
-			.renderArea = { .extent = vkPresent->surfaceExtents },
-			.clearValueCount = 1,
-			.pClearValues = &clearValue
-		};
-		vkCmdBeginRenderPass(currentCommands, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			break;
+		}
+	}
 
-		for (uint32_t i = 0; i < renderDesc->recordedBuffers.count; i++)
+	if (index == context->bufferAccesses.count)
+	{
+		if (context->bufferAccesses.count == cranvk_max_tracked_buffer_count)
 		{
-			VkCommandBuffer recordedBuffer = vkDevice->commandBuffers.recordingBuffers[i];
-			vkCmdExecuteCommands(currentCommands, 1, &recordedBuffer);
+			cranvk_untrack_buffers(context);
+			index = 0;
 		}
 
-		vkCmdEndRenderPass(currentCommands);
-		vkEndCommandBuffer(currentCommands);
+		context->bufferAccesses.buffers[index] = buffer;
+		context->bufferAccesses.accesses[index] = (cranvk_buffer_access_t) { 0 };
+		context->bufferAccesses.count++;
 	}
 
-	VkSemaphore* acquire = &vkPresent->acquireSemaphores[currentBackBuffer];
-	VkSemaphore* finished = &vkPresent->presentSemaphores[currentBackBuffer];
+	cranvk_buffer_access_t* state = &context->bufferAccesses.accesses[index];
+	cranvk_wait_buffer_access(context, state, buffer, stages, access);
+	cranvk_record_buffer_access(state, stages, access);
+}
 
-	VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	VkSubmitInfo submitInfo =
+// For commands that access buffers through descriptors, they wait on every buffer.
+// What came before is then ordered before this access, waiting on untracked is enough from now on.
+void cranvk_access_untracked_buffers(cranvk_execution_ctx_t* context, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	for (uint32_t i = 0; i < context->bufferAccesses.count; i++)
 	{
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &currentCommands,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = acquire,
-		.signalSemaphoreCount = 1,
-		.pSignalSemaphores = finished,
-		.pWaitDstStageMask = &dstStageMask
-	};
+		cranvk_wait_buffer_access(context, &context->bufferAccesses.accesses[i], context->bufferAccesses.buffers[i], stages, access);
+	}
+	context->bufferAccesses.count = 0;
+
+	cranvk_wait_buffer_access(context, &context->bufferAccesses.untracked, VK_NULL_HANDLE, stages, access);
+	cranvk_record_buffer_access(&context->bufferAccesses.untracked, stages, access);
+}
 
-	cranvk_check(vkQueueSubmit(vkDevice->queues.graphicsQueue, 1, &submitInfo, vkPresent->presentFences[currentBackBuffer]));
+// Waits on everything recorded so far with one memory barrier, for work that doesn't go through the context.
+void cranvk_wait_all_buffer_accesses(cranvk_execution_ctx_t* context, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess)
+{
+	cranvk_untrack_buffers(context);
+	cranvk_wait_buffer_access(context, &context->bufferAccesses.untracked, VK_NULL_HANDLE, dstStages, dstAccess);
+	cranvk_wait_buffer_access(context, &context->bufferAccesses.readbacks, VK_NULL_HANDLE, dstStages, dstAccess);
+	cranvk_flush_barriers(context);
+}
 
-	VkPresentInfoKHR presentInfo =
+// The buffer's handle is released with it, it can't show up in our barriers anymore.
+void cranvk_forget_buffer(cranvk_execution_ctx_t* context, VkBuffer buffer)
+{
+	for (uint32_t i = 0; i < context->bufferAccesses.count; i++)
 	{
-		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = finished,
-		.swapchainCount = 1,
-		.pSwapchains = &vkPresent->swapchainData.swapchain,
-		.pImageIndices = &imageIndex
-	};
+		if (context->bufferAccesses.buffers[i] == buffer)
+		{
+			uint32_t last = --context->bufferAccesses.count;
+			context->bufferAccesses.buffers[i] = context->bufferAccesses.buffers[last];
+			context->bufferAccesses.accesses[i] = context->bufferAccesses.accesses[last];
+			return;
+		}
+	}
+}
 
-	VkResult presentResult = vkQueuePresentKHR(vkDevice->queues.presentQueue, &presentInfo);
-	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+// Sources are copied into the device, modules are only shared when the bytes match and a hash collision can't alias them.
+VkShaderModule cranvk_request_shader_module(cranvk_graphics_device_t* vkDevice, void const* source, uint32_t sourceSize, uint64_t sourceHash)
+{
+	uint64_t hash = sourceHash != 0 ? sourceHash : cranvk_hash(cranvk_hash_seed, source, sourceSize);
+	for (uint32_t i = 0; i < vkDevice->shaderModules.moduleCount; i++)
 	{
-		cranvk_resize_present(vkDevice, vkSurface, vkPresent);
+		if (vkDevice->shaderModules.hashes[i] == hash && vkDevice->shaderModules.sizes[i] == sourceSize
+			&& memcmp(vkDevice->shaderModules.sources + vkDevice->shaderModules.sourceOffsets[i], source, sourceSize) == 0)
+		{
+			return vkDevice->shaderModules.modules[i];
+		}
 	}
 
-	vkPresent->backBufferIndex = (vkPresent->backBufferIndex + 1) % cranvk_render_buffer_count;
+	cranvk_assert(vkDevice->shaderModules.moduleCount < vkDevice->capacities.shaderCount);
+	cranvk_assert(vkDevice->shaderModules.sourceSize + sourceSize <= vkDevice->capacities.shaderSourceSize);
+	uint32_t moduleIndex = vkDevice->shaderModules.moduleCount++;
+	vkDevice->shaderModules.hashes[moduleIndex] = hash;
+	vkDevice->shaderModules.sizes[moduleIndex] = sourceSize;
+	vkDevice->shaderModules.sourceOffsets[moduleIndex] = vkDevice->shaderModules.sourceSize;
+	memcpy(vkDevice->shaderModules.sources + vkDevice->shaderModules.sourceSize, source, sourceSize);
+	vkDevice->shaderModules.sourceSize += sourceSize;
+
+	VkShaderModuleCreateInfo createShader =
+	{
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pCode = (const uint32_t*)source,
+		.codeSize = sourceSize
+	};
+	cranvk_check(vkCreateShaderModule(vkDevice->devices.logicalDevice, &createShader, cranvk_no_allocator, &vkDevice->shaderModules.modules[moduleIndex]));
+	return vkDevice->shaderModules.modules[moduleIndex];
 }
 
 void cranvk_create_shader(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* ctx, void* commandData)
@@ -1791,34 +6051,31 @@ void cranvk_create_shader(cranvk_graphics_device_t* vkDevice, cranvk_execution_c
 	cranvk_unused(ctx);
 
 	crang_cmd_create_shader_t* createShaderData = (crang_cmd_create_shader_t*)commandData;
-
-	{
-		VkShaderModuleCreateInfo createShader =
-		{
-			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-			.pCode = (const uint32_t*)createShaderData->source,
-			.codeSize = createShaderData->sourceSize
-		};
-
-		VkShaderModule* shader = &vkDevice->shaders.shaders[createShaderData->shaderId.id];
-		cranvk_check(vkCreateShaderModule(vkDevice->devices.logicalDevice, &createShader, cranvk_no_allocator, shader));
-	}
+	vkDevice->shaders.shaders[createShaderData->shaderId.id] = cranvk_request_shader_module(vkDevice, createShaderData->source, createShaderData->sourceSize, createShaderData->sourceHash);
 
 	{
 		VkShaderStageFlagBits shaderStageConversionTable[] =
 		{
 			[crang_shader_vertex] = VK_SHADER_STAGE_VERTEX_BIT,
-			[crang_shader_fragment] = VK_SHADER_STAGE_FRAGMENT_BIT
+			[crang_shader_fragment] = VK_SHADER_STAGE_FRAGMENT_BIT,
+			[crang_shader_compute] = VK_SHADER_STAGE_COMPUTE_BIT
 		};
 
 		VkDescriptorType descriptorTypeConversionTable[] =
 		{
-			[crang_shader_input_type_uniform_buffer] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+			[crang_shader_input_type_uniform_buffer] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			[crang_shader_input_type_storage_buffer] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			[crang_shader_input_type_uniform_buffer_dynamic] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+			[crang_shader_input_type_sampled_image] = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
 		};
 
 		VkDescriptorSetLayoutBinding layoutBindings[cranvk_max_shader_inputs];
 		for (uint32_t i = 0; i < createShaderData->shaderInputs.count; i++)
 		{
+			uint32_t binding = createShaderData->shaderInputs.inputs[i].binding;
+			cranvk_assert(binding < cranvk_max_shader_inputs);
+			vkDevice->shaders.inputTypes[createShaderData->shaderId.id][binding] = createShaderData->shaderInputs.inputs[i].type;
+
 			layoutBindings[i] = (VkDescriptorSetLayoutBinding)
 			{
 				.stageFlags = shaderStageConversionTable[vkDevice->shaders.types[createShaderData->shaderId.id]],
@@ -1837,12 +6094,128 @@ void cranvk_create_shader(cranvk_graphics_device_t* vkDevice, cranvk_execution_c
 
 		VkDescriptorSetLayout* layout = &vkDevice->shaders.descriptorSetLayouts[createShaderData->shaderId.id];
 		cranvk_check(vkCreateDescriptorSetLayout(vkDevice->devices.logicalDevice, &createLayout, cranvk_no_allocator, layout));
+
+		bool hasImageInputs = false;
+		for (uint32_t i = 0; i < createShaderData->shaderInputs.count; i++)
+		{
+			hasImageInputs |= createShaderData->shaderInputs.inputs[i].type == crang_shader_input_type_sampled_image;
+		}
+
+		// One template entry per input, reading a tightly packed array of VkDescriptorBufferInfo.
+		// Image inputs don't fit that layout, those shaders are only updated through binds.
+		vkDevice->shaders.inputCounts[createShaderData->shaderId.id] = createShaderData->shaderInputs.count;
+		vkDevice->shaders.updateTemplates[createShaderData->shaderId.id] = VK_NULL_HANDLE;
+		if (createShaderData->shaderInputs.count > 0 && !hasImageInputs)
+		{
+			VkDescriptorUpdateTemplateEntry templateEntries[cranvk_max_shader_inputs];
+			for (uint32_t i = 0; i < createShaderData->shaderInputs.count; i++)
+			{
+				templateEntries[i] = (VkDescriptorUpdateTemplateEntry)
+				{
+					.dstBinding = layoutBindings[i].binding,
+					.dstArrayElement = 0,
+					.descriptorCount = 1,
+					.descriptorType = layoutBindings[i].descriptorType,
+					.offset = sizeof(VkDescriptorBufferInfo) * i,
+					.stride = sizeof(VkDescriptorBufferInfo)
+				};
+			}
+
+			VkDescriptorUpdateTemplateCreateInfo templateCreate =
+			{
+				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+				.descriptorUpdateEntryCount = createShaderData->shaderInputs.count,
+				.pDescriptorUpdateEntries = templateEntries,
+				.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+				.descriptorSetLayout = *layout
+			};
+
+			cranvk_check(vkCreateDescriptorUpdateTemplate(
+				vkDevice->devices.logicalDevice, &templateCreate, cranvk_no_allocator,
+				&vkDevice->shaders.updateTemplates[createShaderData->shaderId.id]));
+		}
+	}
+}
+
+VkDescriptorSet cranvk_allocate_transient_descriptor_set(cranvk_graphics_device_t* vkDevice, cranvk_present_t* vkPresent, VkDescriptorSetLayout layout)
+{
+	uint32_t frame = vkPresent->backBufferIndex;
+
+	// Reset the frame's pools the first time we allocate from them since it was last rendered.
+	if (vkPresent->transientDescriptors[frame].resetFrame != vkPresent->frameCount)
+	{
+		cranvk_wait_value(vkDevice, vkPresent->frameValues[frame]);
+		for (uint32_t i = 0; i < vkPresent->transientDescriptors[frame].poolCount; i++)
+		{
+			cranvk_check(vkResetDescriptorPool(vkDevice->devices.logicalDevice, vkPresent->transientDescriptors[frame].pools[i], 0));
+		}
+
+		vkPresent->transientDescriptors[frame].activePool = 0;
+		vkPresent->transientDescriptors[frame].resetFrame = vkPresent->frameCount;
+	}
+
+	while (true)
+	{
+		uint32_t activePool = vkPresent->transientDescriptors[frame].activePool;
+		if (activePool == vkPresent->transientDescriptors[frame].poolCount)
+		{
+			cranvk_assert(activePool < cranvk_max_transient_descriptor_pool_count);
+
+			VkDescriptorPoolSize descriptorPoolSizes[4] =
+			{
+				{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,.descriptorCount = cranvk_transient_descriptor_set_count },
+				{ .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,.descriptorCount = cranvk_transient_descriptor_set_count },
+				{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,.descriptorCount = cranvk_transient_descriptor_set_count },
+				{ .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,.descriptorCount = cranvk_transient_descriptor_set_count }
+			};
+
+			VkDescriptorPoolCreateInfo descriptorPoolCreate =
+			{
+				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+				.maxSets = cranvk_transient_descriptor_set_count,
+				.poolSizeCount = 4,
+				.pPoolSizes = descriptorPoolSizes
+			};
+
+			cranvk_check(vkCreateDescriptorPool(vkDevice->devices.logicalDevice, &descriptorPoolCreate, cranvk_no_allocator, &vkPresent->transientDescriptors[frame].pools[activePool]));
+			vkPresent->transientDescriptors[frame].poolCount++;
+		}
+
+		VkDescriptorSetAllocateInfo descriptorSetAlloc =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = vkPresent->transientDescriptors[frame].pools[activePool],
+			.descriptorSetCount = 1,
+			.pSetLayouts = &layout
+		};
+
+		VkDescriptorSet descriptorSet;
+		VkResult result = vkAllocateDescriptorSets(vkDevice->devices.logicalDevice, &descriptorSetAlloc, &descriptorSet);
+		if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+		{
+			vkPresent->transientDescriptors[frame].activePool++;
+			continue;
+		}
+
+		cranvk_check(result);
+		return descriptorSet;
 	}
 }
 
 void cranvk_create_shader_input(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* ctx, void* commandData)
 {
 	crang_cmd_create_shader_input_t* shaderInput = (crang_cmd_create_shader_input_t*)commandData;
+	uint32_t shaderInputIndex = cranvk_shader_input_index(vkDevice, shaderInput->shaderInputId);
+	vkDevice->shaders.descriptorSets.shaderIds[shaderInputIndex] = shaderInput->shaderId.id;
+	vkDevice->shaders.descriptorSets.transient[shaderInputIndex] = shaderInput->lifetime == crang_shader_input_lifetime_frame;
+
+	if (shaderInput->lifetime == crang_shader_input_lifetime_frame)
+	{
+		cranvk_assert(ctx->present != NULL);
+		vkDevice->shaders.descriptorSets.sets[shaderInputIndex] = cranvk_allocate_transient_descriptor_set(
+			vkDevice, ctx->present, vkDevice->shaders.descriptorSetLayouts[shaderInput->shaderId.id]);
+		return;
+	}
 
 	VkDescriptorSetAllocateInfo descriptorSetAlloc =
 	{
@@ -1853,31 +6226,85 @@ void cranvk_create_shader_input(cranvk_graphics_device_t* vkDevice, cranvk_execu
 	};
 	cranvk_check(vkAllocateDescriptorSets(
 		vkDevice->devices.logicalDevice, &descriptorSetAlloc,
-		&vkDevice->shaders.descriptorSets.sets[shaderInput->shaderInputId.id]));
+		&vkDevice->shaders.descriptorSets.sets[shaderInputIndex]));
+}
+
+void cranvk_flush_descriptor_writes(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context)
+{
+	if (context->descriptorWrites.count > 0)
+	{
+		vkUpdateDescriptorSets(vkDevice->devices.logicalDevice, context->descriptorWrites.count, context->descriptorWrites.writes, 0, NULL);
+		context->descriptorWrites.count = 0;
+	}
+}
+
+void cranvk_update_shader_input(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_update_shader_input_t* updateInput = (crang_cmd_update_shader_input_t*)commandData;
+
+	uint32_t shaderId = vkDevice->shaders.descriptorSets.shaderIds[cranvk_shader_input_index(vkDevice, updateInput->shaderInputId)];
+	cranvk_assert(updateInput->count == vkDevice->shaders.inputCounts[shaderId]);
+	cranvk_assert(vkDevice->shaders.updateTemplates[shaderId] != VK_NULL_HANDLE);
+
+	VkDescriptorBufferInfo bufferInfos[cranvk_max_shader_inputs];
+	for (uint32_t i = 0; i < updateInput->count; i++)
+	{
+		bufferInfos[i] = (VkDescriptorBufferInfo)
+		{
+			.buffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, updateInput->buffers[i].bufferId)],
+			.offset = updateInput->buffers[i].offset,
+			.range = updateInput->buffers[i].size
+		};
+	}
+
+	// Keep the writes in stream order.
+	cranvk_flush_descriptor_writes(vkDevice, context);
+	vkUpdateDescriptorSetWithTemplate(
+		vkDevice->devices.logicalDevice, vkDevice->shaders.descriptorSets.sets[cranvk_shader_input_index(vkDevice, updateInput->shaderInputId)],
+		vkDevice->shaders.updateTemplates[shaderId], bufferInfos);
 }
 
 void cranvk_bind_to_shader_input(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
 {
 	crang_cmd_bind_to_shader_input_t* bindInput = (crang_cmd_bind_to_shader_input_t*)commandData;
 
-	VkDescriptorBufferInfo bufferInfo =
+	VkDescriptorType descriptorTypeConversionTable[] =
+	{
+		[crang_shader_input_type_uniform_buffer] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		[crang_shader_input_type_storage_buffer] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		[crang_shader_input_type_uniform_buffer_dynamic] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		[crang_shader_input_type_sampled_image] = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+	};
+
+	uint32_t shaderId = vkDevice->shaders.descriptorSets.shaderIds[cranvk_shader_input_index(vkDevice, bindInput->shaderInputId)];
+	crang_shader_input_type_e inputType = vkDevice->shaders.inputTypes[shaderId][bindInput->binding];
+	cranvk_assert(inputType != crang_shader_input_type_sampled_image);
+
+	if (context->descriptorWrites.count == cranvk_max_descriptor_writes)
+	{
+		cranvk_flush_descriptor_writes(vkDevice, context);
+	}
+
+	uint32_t writeIndex = context->descriptorWrites.count;
+	context->descriptorWrites.count++;
+
+	VkDescriptorBufferInfo* bufferInfo = &context->descriptorWrites.bufferInfos[writeIndex];
+	*bufferInfo = (VkDescriptorBufferInfo)
 	{
-		.buffer = vkDevice->buffers.buffers[bindInput->buffer.bufferId.id],
+		.buffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, bindInput->buffer.bufferId)],
 		.offset = bindInput->buffer.offset,
 		.range = bindInput->buffer.size
 	};
 
-	VkWriteDescriptorSet writeDescriptorSet =
+	context->descriptorWrites.writes[writeIndex] = (VkWriteDescriptorSet)
 	{
 		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		.dstSet = vkDevice->shaders.descriptorSets.sets[bindInput->shaderInputId.id],
-		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		.dstSet = vkDevice->shaders.descriptorSets.sets[cranvk_shader_input_index(vkDevice, bindInput->shaderInputId)],
+		.descriptorType = descriptorTypeConversionTable[inputType],
 		.dstBinding = bindInput->binding,
 		.descriptorCount = 1,
-		.pBufferInfo = &bufferInfo
+		.pBufferInfo = bufferInfo
 	};
-
-	vkUpdateDescriptorSets(vkDevice->devices.logicalDevice, 1, &writeDescriptorSet, 0, NULL);
 }
 
 
@@ -1890,6 +6317,7 @@ void cranvk_create_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_c
 		[crang_buffer_vertex] = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 		[crang_buffer_index] = VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		[crang_buffer_shader_input] = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		[crang_buffer_storage] = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
 	};
 
 	crang_cmd_create_buffer_t* createBufferData = (crang_cmd_create_buffer_t*)commandData;
@@ -1898,10 +6326,11 @@ void cranvk_create_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_c
 	{
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 		.size = createBufferData->size,
-		.usage = bufferUsages[createBufferData->type] | VK_BUFFER_USAGE_TRANSFER_DST_BIT // buffers created through create buffer can always be transfered to
+		.usage = bufferUsages[createBufferData->type] | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT // buffers created through create buffer can always be transfered to and from
 	};
 
-	VkBuffer* buffer = &vkDevice->buffers.buffers[createBufferData->bufferId.id];
+	uint32_t bufferIndex = cranvk_buffer_index(vkDevice, createBufferData->bufferId);
+	VkBuffer* buffer = &vkDevice->buffers.buffers[bufferIndex];
 	cranvk_check(vkCreateBuffer(vkDevice->devices.logicalDevice, &bufferCreate, cranvk_no_allocator, buffer));
 
 	VkMemoryRequirements memoryRequirements;
@@ -1910,10 +6339,60 @@ void cranvk_create_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_c
 	unsigned int preferredBits = 0;
 	uint32_t memoryIndex = cranvk_find_memory_index(vkDevice->devices.physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, preferredBits);
 
-	cranvk_allocation_t* allocation = &vkDevice->buffers.allocations[createBufferData->bufferId.id];
+	cranvk_allocation_t* allocation = &vkDevice->buffers.allocations[bufferIndex];
 	*allocation = cranvk_allocator_allocate(vkDevice->devices.logicalDevice, &vkDevice->allocator, memoryIndex, createBufferData->size, memoryRequirements.alignment);
 
 	cranvk_check(vkBindBufferMemory(vkDevice->devices.logicalDevice, *buffer, allocation->memory, allocation->offset));
+
+	// Storage buffers are visible to bindless shaders at their slot, if the array reaches it.
+	if (vkDevice->bindless.supported && createBufferData->type == crang_buffer_storage && bufferIndex < vkDevice->bindless.descriptorCount)
+	{
+		VkDescriptorBufferInfo bufferInfo =
+		{
+			.buffer = *buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
+
+		VkWriteDescriptorSet writeDescriptorSet =
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = vkDevice->bindless.set,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.dstBinding = 0,
+			.dstArrayElement = bufferIndex,
+			.descriptorCount = 1,
+			.pBufferInfo = &bufferInfo
+		};
+
+		vkUpdateDescriptorSets(vkDevice->devices.logicalDevice, 1, &writeDescriptorSet, 0, NULL);
+	}
+}
+
+// The value is only known once the commands are submitted, see cranvk_queue_destroys.
+void cranvk_defer_destroy(cranvk_execution_ctx_t* context, cranvk_deferred_e type, uint32_t index)
+{
+	cranvk_transient_resources_t* resources = &context->singleUseResources;
+	cranvk_assert(resources->destroyCount < cranvk_max_recorded_destroy_count);
+	resources->destroys[resources->destroyCount++] = (cranvk_deferred_destroy_t) { .type = type, .index = index };
+}
+
+void cranvk_destroy_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_destroy_buffer_t* destroyBuffer = (crang_cmd_destroy_buffer_t*)commandData;
+	uint32_t bufferIndex = cranvk_retire_handle(&vkDevice->buffers.pool, destroyBuffer->bufferId.id);
+	cranvk_forget_buffer(context, vkDevice->buffers.buffers[bufferIndex]);
+	cranvk_defer_destroy(context, cranvk_deferred_buffer, bufferIndex);
+}
+
+void cranvk_destroy_shader_input(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_destroy_shader_input_t* destroyShaderInput = (crang_cmd_destroy_shader_input_t*)commandData;
+
+	// Pending writes would target the set after it's gone.
+	cranvk_flush_descriptor_writes(vkDevice, context);
+	uint32_t shaderInputIndex = cranvk_retire_handle(&vkDevice->shaders.descriptorSets.pool, destroyShaderInput->shaderInputId.id);
+	cranvk_defer_destroy(context, cranvk_deferred_shader_input, shaderInputIndex);
 }
 
 void cranvk_copy_to_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
@@ -1959,7 +6438,7 @@ void cranvk_copy_to_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_
 		}
 	}
 
-	VkBuffer dstBuffer = vkDevice->buffers.buffers[copyToBufferData->bufferId.id];
+	VkBuffer dstBuffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, copyToBufferData->bufferId)];
 
 	VkBufferCopy copy = 
 	{
@@ -1967,7 +6446,11 @@ void cranvk_copy_to_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_
 		.dstOffset = copyToBufferData->offset,
 		.size = copyToBufferData->size
 	};
-	vkCmdCopyBuffer(context->commandBuffer, srcBuffer, dstBuffer, 1, &copy);
+
+	// The staging buffer's host writes are visible once submitted, only the destination is tracked.
+	cranvk_access_buffer(context, dstBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	cranvk_flush_barriers(context);
+	vkCmdCopyBuffer(cranvk_get_compute_commands(context), srcBuffer, dstBuffer, 1, &copy);
 
 	context->singleUseResources.buffers[context->singleUseResources.bufferCount] = srcBuffer;
 	context->singleUseResources.bufferCount++;
@@ -1978,6 +6461,65 @@ void cranvk_copy_to_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_
 	cranvk_assert(context->singleUseResources.allocationCount <= cranvk_max_single_use_resource_count);
 }
 
+void cranvk_copy_from_buffer(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_copy_from_buffer_t* copyFromBufferData = (crang_cmd_copy_from_buffer_t*)commandData;
+
+	VkBuffer dstBuffer;
+	cranvk_allocation_t allocation;
+	{
+		VkBufferCreateInfo bufferCreate =
+		{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size = copyFromBufferData->size,
+			.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		};
+
+		cranvk_check(vkCreateBuffer(vkDevice->devices.logicalDevice, &bufferCreate, cranvk_no_allocator, &dstBuffer));
+
+		VkMemoryRequirements memoryRequirements;
+		vkGetBufferMemoryRequirements(vkDevice->devices.logicalDevice, dstBuffer, &memoryRequirements);
+
+		unsigned int preferredBits = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		uint32_t memoryIndex = cranvk_find_memory_index(vkDevice->devices.physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, preferredBits);
+
+		allocation = cranvk_allocator_allocate(vkDevice->devices.logicalDevice, &vkDevice->allocator, memoryIndex, copyFromBufferData->size, memoryRequirements.alignment);
+		cranvk_check(vkBindBufferMemory(vkDevice->devices.logicalDevice, dstBuffer, allocation.memory, allocation.offset));
+	}
+
+	VkBuffer srcBuffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, copyFromBufferData->bufferId)];
+
+	VkBufferCopy copy =
+	{
+		.srcOffset = copyFromBufferData->offset,
+		.dstOffset = 0,
+		.size = copyFromBufferData->size
+	};
+
+	// The staging buffer is new, it has nothing to wait on and doesn't take a slot in the tracked buffers.
+	cranvk_access_buffer(context, srcBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	cranvk_record_buffer_access(&context->bufferAccesses.readbacks, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	cranvk_flush_barriers(context);
+	vkCmdCopyBuffer(cranvk_get_compute_commands(context), srcBuffer, dstBuffer, 1, &copy);
+
+	context->singleUseResources.buffers[context->singleUseResources.bufferCount] = dstBuffer;
+	context->singleUseResources.bufferCount++;
+	cranvk_assert(context->singleUseResources.bufferCount <= cranvk_max_single_use_resource_count);
+
+	// The allocation is freed with the rest of the single use resources once it's been read back.
+	context->singleUseResources.allocations[context->singleUseResources.allocationCount] = allocation;
+	context->singleUseResources.allocationCount++;
+	cranvk_assert(context->singleUseResources.allocationCount <= cranvk_max_single_use_resource_count);
+
+	uint32_t readbackIndex = context->readbacks.count;
+	context->readbacks.count++;
+	cranvk_assert(context->readbacks.count <= cranvk_max_single_use_resource_count);
+
+	context->readbacks.allocations[readbackIndex] = allocation;
+	context->readbacks.datas[readbackIndex] = copyFromBufferData->data;
+	context->readbacks.sizes[readbackIndex] = copyFromBufferData->size;
+}
+
 void cranvk_execute_callback(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
 {
 	cranvk_unused(vkDevice);
@@ -1990,7 +6532,23 @@ void cranvk_execute_callback(cranvk_graphics_device_t* vkDevice, cranvk_executio
 void cranvk_bind_pipeline(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
 {
 	crang_cmd_bind_pipeline_t* bindPipelineCmd = (crang_cmd_bind_pipeline_t*)commandData;
-	vkCmdBindPipeline(context->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkDevice->pipelines.pipelines[bindPipelineCmd->pipelineId.id]);
+	crang_pipeline_id_t pipelineId = cranvk_resolve_pipeline(vkDevice, bindPipelineCmd->pipelineId);
+
+	VkPipelineBindPoint bindPoint = vkDevice->pipelines.bindPoints[pipelineId.id];
+	VkCommandBuffer commandBuffer = bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? cranvk_get_compute_commands(context) : context->commandBuffer;
+	vkCmdBindPipeline(commandBuffer, bindPoint, vkDevice->pipelines.pipelines[pipelineId.id]);
+
+	// Dynamic state outlives pipeline binds, start from the pipeline's own values.
+	if (vkDevice->pipelines.hasDynamicState[pipelineId.id])
+	{
+		cranvk_dynamic_state_t* state = &vkDevice->pipelines.dynamicStates[pipelineId.id];
+		vkDevice->extendedDynamicState.setCullMode(commandBuffer, state->cullMode);
+		vkDevice->extendedDynamicState.setFrontFace(commandBuffer, state->frontFace);
+		vkDevice->extendedDynamicState.setPrimitiveTopology(commandBuffer, state->topology);
+		vkDevice->extendedDynamicState.setDepthTestEnable(commandBuffer, state->depthTestEnable);
+		vkDevice->extendedDynamicState.setDepthWriteEnable(commandBuffer, state->depthWriteEnable);
+		vkDevice->extendedDynamicState.setDepthCompareOp(commandBuffer, state->depthCompareOp);
+	}
 }
 
 void cranvk_bind_vertex_inputs(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
@@ -2000,7 +6558,7 @@ void cranvk_bind_vertex_inputs(cranvk_graphics_device_t* vkDevice, cranvk_execut
 	{
 		vkCmdBindVertexBuffers(
 			context->commandBuffer, vertexInputs->bindings[i].binding, 1,
-			&vkDevice->buffers.buffers[vertexInputs->bindings[i].bufferId.id], &(VkDeviceSize){ vertexInputs->bindings[i].offset });
+			&vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, vertexInputs->bindings[i].bufferId)], &(VkDeviceSize){ vertexInputs->bindings[i].offset });
 	}
 }
 
@@ -2014,16 +6572,59 @@ void cranvk_bind_index_input(cranvk_graphics_device_t* vkDevice, cranvk_executio
 
 	crang_cmd_bind_index_input_t* indexInput = (crang_cmd_bind_index_input_t*)commandData;
 	vkCmdBindIndexBuffer(
-		context->commandBuffer, vkDevice->buffers.buffers[indexInput->bufferId.id],
+		context->commandBuffer, vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, indexInput->bufferId)],
 		(VkDeviceSize) { indexInput->offset }, indexTypeConversionTable[indexInput->indexType]);
 }
 
 void cranvk_bind_shader_input(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
 {
 	crang_cmd_bind_shader_input_t* shaderInput = (crang_cmd_bind_shader_input_t*)commandData;
+	cranvk_flush_descriptor_writes(vkDevice, context);
+
+	VkPipelineBindPoint bindPoint = vkDevice->pipelines.bindPoints[shaderInput->pipelineId.id];
+	VkCommandBuffer commandBuffer = bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? cranvk_get_compute_commands(context) : context->commandBuffer;
+	vkCmdBindDescriptorSets(
+		commandBuffer, bindPoint, vkDevice->pipelines.layouts[shaderInput->pipelineId.id],
+		0, 1, &vkDevice->shaders.descriptorSets.sets[cranvk_shader_input_index(vkDevice, shaderInput->shaderInputId)],
+		shaderInput->dynamicOffsets.count, shaderInput->dynamicOffsets.offsets);
+}
+
+void cranvk_push_constants(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_push_constants_t* pushConstants = (crang_cmd_push_constants_t*)commandData;
+	uint32_t pipelineIndex = pushConstants->pipelineId.id;
+
+	// Vulkan wants the stages of every range that overlaps the pushed bytes.
+	VkShaderStageFlags stageFlags = 0;
+	for (uint32_t i = 0; i < vkDevice->pipelines.pushConstantRangeCounts[pipelineIndex]; i++)
+	{
+		VkPushConstantRange* range = &vkDevice->pipelines.pushConstantRanges[pipelineIndex][i];
+		if (pushConstants->offset < range->offset + range->size && range->offset < pushConstants->offset + pushConstants->size)
+		{
+			stageFlags |= range->stageFlags;
+		}
+	}
+	cranvk_assert(stageFlags != 0);
+
+	VkPipelineBindPoint bindPoint = vkDevice->pipelines.bindPoints[pipelineIndex];
+	VkCommandBuffer commandBuffer = bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? cranvk_get_compute_commands(context) : context->commandBuffer;
+	vkCmdPushConstants(
+		commandBuffer, vkDevice->pipelines.layouts[pipelineIndex], stageFlags,
+		pushConstants->offset, pushConstants->size, pushConstants->data);
+}
+
+void cranvk_bind_bindless(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_bind_bindless_t* bindBindless = (crang_cmd_bind_bindless_t*)commandData;
+
+	uint32_t setIndex = vkDevice->pipelines.bindlessSetIndices[bindBindless->pipelineId.id];
+	cranvk_assert(setIndex != cranvk_no_bindless_set);
+
+	VkPipelineBindPoint bindPoint = vkDevice->pipelines.bindPoints[bindBindless->pipelineId.id];
+	VkCommandBuffer commandBuffer = bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? cranvk_get_compute_commands(context) : context->commandBuffer;
 	vkCmdBindDescriptorSets(
-		context->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkDevice->pipelines.layouts[shaderInput->pipelineId.id],
-		0, 1, &vkDevice->shaders.descriptorSets.sets[shaderInput->shaderInputId.id], 0, VK_NULL_HANDLE);
+		commandBuffer, bindPoint, vkDevice->pipelines.layouts[bindBindless->pipelineId.id],
+		setIndex, 1, &vkDevice->bindless.set, 0, VK_NULL_HANDLE);
 }
 
 void cranvk_draw_indexed(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
@@ -2032,6 +6633,207 @@ void cranvk_draw_indexed(cranvk_graphics_device_t* vkDevice, cranvk_execution_ct
 	vkCmdDrawIndexed(context->commandBuffer, drawIndexed->indexCount, drawIndexed->instanceCount, drawIndexed->indexOffset, drawIndexed->vertexOffset, 0);
 }
 
+void cranvk_draw_indexed_indirect(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_draw_indexed_indirect_t* drawIndexed = (crang_cmd_draw_indexed_indirect_t*)commandData;
+	VkBuffer argsBuffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, drawIndexed->bufferId)];
+	if (vkDevice->multiDrawIndirect)
+	{
+		cranvk_assert(drawIndexed->drawCount <= vkDevice->limits.maxDrawIndirectCount);
+		vkCmdDrawIndexedIndirect(context->commandBuffer, argsBuffer, (VkDeviceSize) { drawIndexed->offset }, drawIndexed->drawCount, sizeof(crang_draw_indexed_indirect_t));
+	}
+	else
+	{
+		for (uint32_t i = 0; i < drawIndexed->drawCount; i++)
+		{
+			VkDeviceSize offset = (VkDeviceSize)drawIndexed->offset + (VkDeviceSize)i * sizeof(crang_draw_indexed_indirect_t);
+			vkCmdDrawIndexedIndirect(context->commandBuffer, argsBuffer, offset, 1, sizeof(crang_draw_indexed_indirect_t));
+		}
+	}
+}
+
+void cranvk_dispatch(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	cranvk_unused(vkDevice);
+
+	crang_cmd_dispatch_t* dispatch = (crang_cmd_dispatch_t*)commandData;
+
+	cranvk_access_untracked_buffers(context, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	cranvk_flush_barriers(context);
+	vkCmdDispatch(cranvk_get_compute_commands(context), dispatch->groupCountX, dispatch->groupCountY, dispatch->groupCountZ);
+}
+
+void cranvk_dispatch_indirect(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_dispatch_indirect_t* dispatch = (crang_cmd_dispatch_indirect_t*)commandData;
+
+	VkBuffer argsBuffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, dispatch->bufferId)];
+
+	cranvk_access_buffer(context, argsBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	cranvk_access_untracked_buffers(context, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	cranvk_flush_barriers(context);
+	vkCmdDispatchIndirect(cranvk_get_compute_commands(context), argsBuffer, (VkDeviceSize) { dispatch->offset });
+}
+
+void cranvk_cull(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_cull_t* cull = (crang_cmd_cull_t*)commandData;
+	cranvk_flush_descriptor_writes(vkDevice, context);
+	VkCommandBuffer commandBuffer = cranvk_get_compute_commands(context);
+
+	// Reset the draw arguments
+	{
+		VkBufferCopy copy =
+		{
+			.srcOffset = 0,
+			.dstOffset = 0,
+			.size = sizeof(crang_draw_indexed_indirect_t) * cull->drawGroupCount
+		};
+
+		VkBuffer templateBuffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, cull->drawArgsTemplateBuffer)];
+		VkBuffer argsBuffer = vkDevice->buffers.buffers[cranvk_buffer_index(vkDevice, cull->drawArgsBuffer)];
+
+		cranvk_access_buffer(context, templateBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+		cranvk_access_buffer(context, argsBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		cranvk_flush_barriers(context);
+		vkCmdCopyBuffer(commandBuffer, templateBuffer, argsBuffer, 1, &copy);
+	}
+
+	cranvk_assert(vkDevice->pipelines.bindPoints[cull->pipelineId.id] == VK_PIPELINE_BIND_POINT_COMPUTE);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vkDevice->pipelines.pipelines[cull->pipelineId.id]);
+	vkCmdBindDescriptorSets(
+		commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vkDevice->pipelines.layouts[cull->pipelineId.id],
+		0, 1, &vkDevice->shaders.descriptorSets.sets[cranvk_shader_input_index(vkDevice, cull->shaderInputId)], 0, VK_NULL_HANDLE);
+
+	cranvk_access_untracked_buffers(context, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	cranvk_flush_barriers(context);
+	vkCmdDispatch(commandBuffer, (cull->instanceCount + cranvk_cull_group_size - 1) / cranvk_cull_group_size, 1, 1);
+}
+
+void cranvk_bind_graph_attachment(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_bind_graph_attachment_t* bindAttachment = (crang_cmd_bind_graph_attachment_t*)commandData;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)bindAttachment->graph;
+
+	uint32_t resource = bindAttachment->attachment.id;
+	cranvk_assert(vkGraph->compiled);
+	cranvk_assert(vkGraph->resources.imageViews[resource] != VK_NULL_HANDLE); // Only attachments used by live passes have an image
+
+	uint32_t shaderId = vkDevice->shaders.descriptorSets.shaderIds[cranvk_shader_input_index(vkDevice, bindAttachment->shaderInputId)];
+	cranvk_assert(vkDevice->shaders.inputTypes[shaderId][bindAttachment->binding] == crang_shader_input_type_sampled_image);
+
+	if (context->descriptorWrites.count == cranvk_max_descriptor_writes)
+	{
+		cranvk_flush_descriptor_writes(vkDevice, context);
+	}
+
+	uint32_t writeIndex = context->descriptorWrites.count;
+	context->descriptorWrites.count++;
+
+	VkDescriptorImageInfo* imageInfo = &context->descriptorWrites.imageInfos[writeIndex];
+	*imageInfo = (VkDescriptorImageInfo)
+	{
+		.sampler = vkDevice->linearSampler,
+		.imageView = vkGraph->resources.imageViews[resource],
+		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	};
+
+	context->descriptorWrites.writes[writeIndex] = (VkWriteDescriptorSet)
+	{
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = vkDevice->shaders.descriptorSets.sets[cranvk_shader_input_index(vkDevice, bindAttachment->shaderInputId)],
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.dstBinding = bindAttachment->binding,
+		.descriptorCount = 1,
+		.pImageInfo = imageInfo
+	};
+}
+
+void cranvk_cmd_viewport(VkCommandBuffer commandBuffer, VkExtent2D extents, crang_cmd_set_viewport_t const* setViewport)
+{
+	VkViewport viewport =
+	{
+		.x = setViewport->x,
+		.y = setViewport->y,
+		.width = setViewport->width,
+		.height = setViewport->height,
+		.minDepth = setViewport->minDepth,
+		.maxDepth = setViewport->maxDepth
+	};
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	// Flipped viewports have a negative width or height, the scissor covers the same rectangle clamped to the render area.
+	float left = fminf(setViewport->x, setViewport->x + setViewport->width);
+	float right = fmaxf(setViewport->x, setViewport->x + setViewport->width);
+	float top = fminf(setViewport->y, setViewport->y + setViewport->height);
+	float bottom = fmaxf(setViewport->y, setViewport->y + setViewport->height);
+	left = fminf(fmaxf(floorf(left), 0.0f), (float)extents.width);
+	right = fminf(fmaxf(ceilf(right), left), (float)extents.width);
+	top = fminf(fmaxf(floorf(top), 0.0f), (float)extents.height);
+	bottom = fminf(fmaxf(ceilf(bottom), top), (float)extents.height);
+
+	VkRect2D scissor =
+	{
+		.offset = { .x = (int32_t)left, .y = (int32_t)top },
+		.extent = { .width = (uint32_t)(right - left), .height = (uint32_t)(bottom - top) }
+	};
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+// Secondary buffers don't inherit dynamic state, every render pass buffer starts with the full render area.
+void cranvk_cmd_default_viewport(cranvk_execution_ctx_t* context)
+{
+	crang_cmd_set_viewport_t fullViewport =
+	{
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (float)context->extents.width,
+		.height = (float)context->extents.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f
+	};
+	cranvk_cmd_viewport(context->commandBuffer, context->extents, &fullViewport);
+}
+
+void cranvk_set_viewport(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	cranvk_unused(vkDevice);
+
+	// Only render pass buffers can draw.
+	cranvk_assert(context->extents.width > 0);
+	cranvk_cmd_viewport(context->commandBuffer, context->extents, (crang_cmd_set_viewport_t*)commandData);
+}
+
+void cranvk_set_cull_mode(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_set_cull_mode_t* setCullMode = (crang_cmd_set_cull_mode_t*)commandData;
+	cranvk_assert(vkDevice->extendedDynamicState.supported);
+	vkDevice->extendedDynamicState.setCullMode(context->commandBuffer, cranvk_cull_mode_conversion_table[setCullMode->cullMode]);
+}
+
+void cranvk_set_front_face(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_set_front_face_t* setFrontFace = (crang_cmd_set_front_face_t*)commandData;
+	cranvk_assert(vkDevice->extendedDynamicState.supported);
+	vkDevice->extendedDynamicState.setFrontFace(context->commandBuffer, cranvk_front_face_conversion_table[setFrontFace->frontFace]);
+}
+
+void cranvk_set_topology(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_set_topology_t* setTopology = (crang_cmd_set_topology_t*)commandData;
+	cranvk_assert(vkDevice->extendedDynamicState.supported);
+	vkDevice->extendedDynamicState.setPrimitiveTopology(context->commandBuffer, cranvk_topology_conversion_table[setTopology->topology]);
+}
+
+void cranvk_set_depth_state(cranvk_graphics_device_t* vkDevice, cranvk_execution_ctx_t* context, void* commandData)
+{
+	crang_cmd_set_depth_state_t* setDepthState = (crang_cmd_set_depth_state_t*)commandData;
+	cranvk_assert(vkDevice->extendedDynamicState.supported);
+	vkDevice->extendedDynamicState.setDepthTestEnable(context->commandBuffer, setDepthState->testEnable ? VK_TRUE : VK_FALSE);
+	vkDevice->extendedDynamicState.setDepthWriteEnable(context->commandBuffer, setDepthState->writeEnable ? VK_TRUE : VK_FALSE);
+	vkDevice->extendedDynamicState.setDepthCompareOp(context->commandBuffer, cranvk_compare_conversion_table[setDepthState->compare]);
+}
+
 typedef void(*cranvk_cmd_processor)(cranvk_graphics_device_t*, cranvk_execution_ctx_t*, void*);
 cranvk_cmd_processor cmdProcessors[] =
 {
@@ -2046,8 +6848,61 @@ cranvk_cmd_processor cmdProcessors[] =
 	[crang_cmd_bind_index_input] = &cranvk_bind_index_input,
 	[crang_cmd_bind_shader_input] = &cranvk_bind_shader_input,
 	[crang_cmd_draw_indexed] = &cranvk_draw_indexed,
+	[crang_cmd_dispatch] = &cranvk_dispatch,
+	[crang_cmd_dispatch_indirect] = &cranvk_dispatch_indirect,
+	[crang_cmd_draw_indexed_indirect] = &cranvk_draw_indexed_indirect,
+	[crang_cmd_cull] = &cranvk_cull,
+	[crang_cmd_copy_from_buffer] = &cranvk_copy_from_buffer,
+	[crang_cmd_push_constants] = &cranvk_push_constants,
+	[crang_cmd_bind_bindless] = &cranvk_bind_bindless,
+	[crang_cmd_update_shader_input] = &cranvk_update_shader_input,
+	[crang_cmd_bind_graph_attachment] = &cranvk_bind_graph_attachment,
+	[crang_cmd_set_viewport] = &cranvk_set_viewport,
+	[crang_cmd_set_cull_mode] = &cranvk_set_cull_mode,
+	[crang_cmd_set_front_face] = &cranvk_set_front_face,
+	[crang_cmd_set_topology] = &cranvk_set_topology,
+	[crang_cmd_set_depth_state] = &cranvk_set_depth_state,
+	[crang_cmd_destroy_buffer] = &cranvk_destroy_buffer,
+	[crang_cmd_destroy_shader_input] = &cranvk_destroy_shader_input,
 };
 
+bool crang_shader_pack_find(void const* pack, unsigned int packSize, char const* name, crang_cmd_create_shader_t* createShader)
+{
+	if (packSize < sizeof(crang_shader_pack_header_t))
+	{
+		return false;
+	}
+
+	crang_shader_pack_header_t const* header = (crang_shader_pack_header_t const*)pack;
+	if (header->magic != crang_shader_pack_magic || header->version != crang_shader_pack_version
+		|| header->entryCount > (packSize - sizeof(crang_shader_pack_header_t)) / sizeof(crang_shader_pack_entry_t))
+	{
+		return false;
+	}
+
+	crang_shader_pack_entry_t const* entries = (crang_shader_pack_entry_t const*)(header + 1);
+	for (uint32_t i = 0; i < header->entryCount; i++)
+	{
+		if (strncmp(entries[i].name, name, crang_shader_pack_max_name_size) != 0)
+		{
+			continue;
+		}
+
+		// A truncated pack shouldn't be read past its end, SPIR-V also has to stay 4 byte aligned.
+		if (entries[i].offset > packSize || entries[i].size > packSize - entries[i].offset || entries[i].offset % 4 != 0)
+		{
+			return false;
+		}
+
+		createShader->source = (uint8_t*)pack + entries[i].offset;
+		createShader->sourceSize = entries[i].size;
+		createShader->sourceHash = entries[i].hash;
+		return true;
+	}
+
+	return false;
+}
+
 void crang_execute_commands_immediate(crang_graphics_device_t* device, crang_cmd_buffer_t* cmdBuffer)
 {
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
@@ -2068,33 +6923,145 @@ void crang_execute_commands_immediate(crang_graphics_device_t* device, crang_cmd
 	};
 	cranvk_check(vkBeginCommandBuffer(context.commandBuffer, &beginBufferInfo));
 
+	// There's no render pass when executing immediately, everything goes in the same buffer.
+	context.computeCommandBuffer = context.commandBuffer;
+	context.computeCommandsBegun = true;
+
 	for (uint32_t i = 0; i < cmdBuffer->count; i++)
 	{
 		crang_cmd_e command = cmdBuffer->commandDescs[i];
 		cmdProcessors[command](vkDevice, &context, cmdBuffer->commandDatas[i]);
 	}
+	cranvk_flush_descriptor_writes(vkDevice, &context);
+
+	// Make our writes visible to the host and to whatever is submitted next.
+	cranvk_wait_all_buffer_accesses(
+		&context, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT | VK_ACCESS_HOST_READ_BIT);
 
 	cranvk_check(vkEndCommandBuffer(context.commandBuffer));
+
+	uint64_t value = ++vkDevice->timeline.submittedValue;
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.signalSemaphoreValueCount = 1,
+		.pSignalSemaphoreValues = &value
+	};
+
 	VkSubmitInfo submitInfo =
 	{
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &timelineInfo,
 		.commandBufferCount = 1,
-		.pCommandBuffers = &context.commandBuffer
+		.pCommandBuffers = &context.commandBuffer,
+		.signalSemaphoreCount = 1,
+		.pSignalSemaphores = &vkDevice->timeline.semaphore
 	};
-	cranvk_check(vkQueueSubmit(vkDevice->queues.graphicsQueue, 1, &submitInfo, vkDevice->immediateFence));
-	cranvk_check(vkWaitForFences(vkDevice->devices.logicalDevice, 1, &vkDevice->immediateFence, VK_TRUE, UINT64_MAX));
-	cranvk_check(vkResetFences(vkDevice->devices.logicalDevice, 1, &vkDevice->immediateFence));
+	cranvk_check(vkQueueSubmit(vkDevice->queues.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+	cranvk_wait_value(vkDevice, value);
 
 	vkFreeCommandBuffers(vkDevice->devices.logicalDevice, vkDevice->graphicsCommandPool, 1, &context.commandBuffer);
 
-	for(uint32_t i = 0; i < context.singleUseResources.bufferCount; i++)
+	for (uint32_t i = 0; i < context.readbacks.count; i++)
+	{
+		cranvk_allocation_t* allocation = &context.readbacks.allocations[i];
+
+		void* memory;
+		unsigned int flags = 0;
+		cranvk_check(vkMapMemory(vkDevice->devices.logicalDevice, allocation->memory, allocation->offset, context.readbacks.sizes[i], flags, &memory));
+
+		VkMappedMemoryRange mappedMemory =
+		{
+			.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+			.memory = allocation->memory,
+			.offset = allocation->offset,
+			.size = context.readbacks.sizes[i]
+		};
+		vkInvalidateMappedMemoryRanges(vkDevice->devices.logicalDevice, 1, &mappedMemory);
+		memcpy(context.readbacks.datas[i], memory, context.readbacks.sizes[i]);
+		vkUnmapMemory(vkDevice->devices.logicalDevice, allocation->memory);
+	}
+
+	// Our submission is the last one, our destroys are queued with its value and released right away.
+	// Everything submitted before us is done too, frames in flight no longer hold what we destroyed.
+	cranvk_release_transient_resources(vkDevice, &context.singleUseResources);
+	cranvk_collect_deferred_destroys(vkDevice, false);
+}
+
+void crang_cull_build_camera(float const viewMatrix[16], float const projectionMatrix[16], unsigned int instanceCount, crang_cull_camera_t* cullCamera)
+{
+	float viewProjection[16];
+	for (uint32_t row = 0; row < 4; row++)
+	{
+		for (uint32_t column = 0; column < 4; column++)
+		{
+			float sum = 0.0f;
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				sum += projectionMatrix[row * 4 + i] * viewMatrix[i * 4 + column];
+			}
+			viewProjection[row * 4 + column] = sum;
+		}
+	}
+
+	// Extract the planes from the clip space bounds (Gribb and Hartmann), Vulkan's depth goes from 0 to w.
+	float const* rows[4] = { &viewProjection[0], &viewProjection[4], &viewProjection[8], &viewProjection[12] };
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		cullCamera->frustumPlanes[0][i] = rows[3][i] + rows[0][i]; // left
+		cullCamera->frustumPlanes[1][i] = rows[3][i] - rows[0][i]; // right
+		cullCamera->frustumPlanes[2][i] = rows[3][i] + rows[1][i]; // bottom
+		cullCamera->frustumPlanes[3][i] = rows[3][i] - rows[1][i]; // top
+		cullCamera->frustumPlanes[4][i] = rows[2][i]; // near
+		cullCamera->frustumPlanes[5][i] = rows[3][i] - rows[2][i]; // far
+	}
+
+	// Normalize them so that the distance to the plane can be compared to the sphere's radius
+	for (uint32_t plane = 0; plane < 6; plane++)
+	{
+		float* p = cullCamera->frustumPlanes[plane];
+		float length = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			p[i] /= length;
+		}
+	}
+
+	cullCamera->instanceCount = instanceCount;
+}
+
+void crang_cull_instances_cpu(crang_cull_camera_t const* cullCamera, crang_cull_instance_t const* instances, crang_draw_indexed_indirect_t* drawArgs, unsigned int drawGroupCount, unsigned int* visibleInstances)
+{
+	for (uint32_t i = 0; i < drawGroupCount; i++)
 	{
-		vkDestroyBuffer(vkDevice->devices.logicalDevice, context.singleUseResources.buffers[i], cranvk_no_allocator);
+		drawArgs[i].instanceCount = 0;
 	}
 
-	for(uint32_t i = 0; i < context.singleUseResources.allocationCount; i++)
+	// Mirrors cull.comp
+	for (uint32_t instanceIndex = 0; instanceIndex < cullCamera->instanceCount; instanceIndex++)
 	{
-		cranvk_allocator_free(&vkDevice->allocator, context.singleUseResources.allocations[i]);
+		crang_cull_instance_t const* instance = &instances[instanceIndex];
+
+		bool visible = true;
+		for (uint32_t plane = 0; plane < 6; plane++)
+		{
+			float const* p = cullCamera->frustumPlanes[plane];
+			float distance = p[0] * instance->center[0] + p[1] * instance->center[1] + p[2] * instance->center[2] + p[3];
+			if (distance < -instance->radius)
+			{
+				visible = false;
+				break;
+			}
+		}
+
+		if (visible)
+		{
+			cranvk_assert(instance->drawGroup < drawGroupCount);
+			crang_draw_indexed_indirect_t* groupArgs = &drawArgs[instance->drawGroup];
+			visibleInstances[groupArgs->firstInstance + groupArgs->instanceCount] = instanceIndex;
+			groupArgs->instanceCount++;
+		}
 	}
 }
 
@@ -2103,8 +7070,16 @@ void crang_record_commands(crang_graphics_device_t* device, crang_present_t* pre
 	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
 	cranvk_present_t* vkPresent = (cranvk_present_t*)present;
 
+	// The buffer might still be executing, swapchain recreation doesn't wait for the GPU anymore.
+	// Once it's done, the staging of its previous recording can go.
+	cranvk_wait_value(vkDevice, vkDevice->commandBuffers.submitValues[recordingBuffer.id]);
+	cranvk_release_transient_resources(vkDevice, &vkDevice->commandBuffers.singleUseResources[recordingBuffer.id]);
+
 	cranvk_execution_ctx_t context = { 0 };
 	context.commandBuffer = vkDevice->commandBuffers.recordingBuffers[recordingBuffer.id];
+	context.computeCommandBuffer = vkDevice->commandBuffers.computeBuffers[recordingBuffer.id];
+	context.present = vkPresent;
+	context.extents = vkPresent->surfaceExtents;
 	
 	VkCommandBufferInheritanceInfo inheritanceInfo =
 	{
@@ -2124,15 +7099,89 @@ void crang_record_commands(crang_graphics_device_t* device, crang_present_t* pre
 		.pInheritanceInfo = &inheritanceInfo,
 	};
 	cranvk_check(vkBeginCommandBuffer(context.commandBuffer, &beginBufferInfo));
+	cranvk_cmd_default_viewport(&context);
 
 	for (uint32_t i = 0; i < cmdBuffer->count; i++)
 	{
 		crang_cmd_e command = cmdBuffer->commandDescs[i];
 		cmdProcessors[command](vkDevice, &context, cmdBuffer->commandDatas[i]);
 	}
+	cranvk_flush_descriptor_writes(vkDevice, &context);
 
 	cranvk_check(vkEndCommandBuffer(context.commandBuffer));
+
+	// crang_render waits on the compute work before rendering, no need to wait on our pending writes here.
+	if (context.computeCommandsBegun)
+	{
+		cranvk_check(vkEndCommandBuffer(context.computeCommandBuffer));
+	}
+	vkDevice->commandBuffers.hasComputeCommands[recordingBuffer.id] = context.computeCommandsBegun;
+	vkDevice->commandBuffers.recordVersions[recordingBuffer.id]++;
+
 	memcpy(&vkDevice->commandBuffers.singleUseResources[recordingBuffer.id], &context.singleUseResources, sizeof(cranvk_transient_resources_t));
 }
 
+void crang_graph_record_pass(crang_graphics_device_t* device, crang_graph_t* graph, crang_graph_pass_id_t pass, crang_cmd_buffer_t* cmdBuffer)
+{
+	cranvk_graphics_device_t* vkDevice = (cranvk_graphics_device_t*)device;
+	cranvk_graph_t* vkGraph = (cranvk_graph_t*)graph;
+	cranvk_assert(vkGraph->compiled);
+
+	// Same as recording buffers, the pass might still be executing.
+	cranvk_wait_value(vkDevice, vkGraph->submitValue);
+	cranvk_release_transient_resources(vkDevice, &vkGraph->passes.singleUseResources[pass.id]);
+
+	cranvk_execution_ctx_t context = { 0 };
+	context.commandBuffer = vkGraph->passes.commandBuffers[pass.id];
+	context.present = vkGraph->present;
+
+	VkCommandBufferInheritanceInfo inheritanceInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass = VK_NULL_HANDLE,
+		.subpass = 0,
+		.framebuffer = VK_NULL_HANDLE
+	};
+
+	VkCommandBufferBeginInfo beginBufferInfo =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+		.pInheritanceInfo = &inheritanceInfo,
+	};
+
+	// Raster passes leave the compute buffer null, compute passes record everything in their only buffer.
+	if (vkGraph->passes.types[pass.id] == crang_graph_pass_raster)
+	{
+		inheritanceInfo.renderPass = vkGraph->passes.renderPasses[pass.id];
+		inheritanceInfo.framebuffer = vkGraph->passes.framebuffers[pass.id];
+		beginBufferInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		context.extents = vkGraph->passes.extents[pass.id];
+	}
+	else
+	{
+		context.computeCommandBuffer = context.commandBuffer;
+		context.computeCommandsBegun = true;
+	}
+	cranvk_check(vkBeginCommandBuffer(context.commandBuffer, &beginBufferInfo));
+
+	if (context.extents.width > 0)
+	{
+		cranvk_cmd_default_viewport(&context);
+	}
+
+	for (uint32_t i = 0; i < cmdBuffer->count; i++)
+	{
+		crang_cmd_e command = cmdBuffer->commandDescs[i];
+		cmdProcessors[command](vkDevice, &context, cmdBuffer->commandDatas[i]);
+	}
+	cranvk_flush_descriptor_writes(vkDevice, &context);
+
+	// The graph's barriers cover the writes that are still pending.
+	cranvk_check(vkEndCommandBuffer(context.commandBuffer));
+	vkGraph->passes.recordVersions[pass.id]++;
+
+	memcpy(&vkGraph->passes.singleUseResources[pass.id], &context.singleUseResources, sizeof(cranvk_transient_resources_t));
+}
+
 #endif // CRANBERRY_GFX_BACKEND_IMPLEMENTATION
@@ -1,11 +1,28 @@
 #define _CRT_SECURE_NO_WARNINGS
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L // mmap
+#endif // _WIN32
 
 #define CRANBERRY_GFX_BACKEND_IMPLEMENTATION
 #include "cranberry_gfx_backend.h"
 
 #include <malloc.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+// Without Win32 we render to a headless present, time a fixed number of frames and write out the last one.
+#define headless_width 1280
+#define headless_height 720
+#define headless_frame_count 1000
+
+#ifdef _WIN32
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
     switch(msg)
@@ -21,9 +38,369 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     }
     return 0;
 }
+#endif // _WIN32
+
+typedef struct
+{
+	void* data;
+	unsigned int size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif // _WIN32
+} mapped_file_t;
+
+// Read only mapping of a whole file, data is NULL if it couldn't be mapped.
+static mapped_file_t map_file(char const* path)
+{
+	mapped_file_t mapped = { 0 };
+#ifdef _WIN32
+	mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapped.file == INVALID_HANDLE_VALUE)
+	{
+		mapped.file = NULL;
+		return mapped;
+	}
+
+	mapped.size = GetFileSize(mapped.file, NULL);
+	mapped.mapping = mapped.size > 0 ? CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	mapped.data = mapped.mapping != NULL ? MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+	{
+		return mapped;
+	}
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		void* data = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED)
+		{
+			mapped.data = data;
+			mapped.size = (unsigned int)fileStat.st_size;
+		}
+	}
+	// The mapping keeps the file alive.
+	close(file);
+#endif // _WIN32
+	return mapped;
+}
+
+static void unmap_file(mapped_file_t mapped)
+{
+#ifdef _WIN32
+	if (mapped.data != NULL)
+	{
+		UnmapViewOfFile(mapped.data);
+	}
+	if (mapped.mapping != NULL)
+	{
+		CloseHandle(mapped.mapping);
+	}
+	if (mapped.file != NULL)
+	{
+		CloseHandle(mapped.file);
+	}
+#else
+	if (mapped.data != NULL)
+	{
+		munmap(mapped.data, mapped.size);
+	}
+#endif // _WIN32
+}
+
+#define pipeline_cache_path "pipeline.cache"
+#define pipeline_cache_temp_path "pipeline.cache.tmp"
+
+// Returns whether a cache was loaded, a missing or rejected one means this is a cold start.
+static bool load_pipeline_cache(crang_graphics_device_t* graphicsDevice)
+{
+	FILE* file = fopen(pipeline_cache_path, "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	bool loaded = false;
+	void* data = size > 0 ? malloc((size_t)size) : NULL;
+	if (data != NULL && fread(data, (size_t)size, 1, file) == 1)
+	{
+		loaded = crang_load_pipeline_cache(graphicsDevice, data, (unsigned int)size);
+		if (!loaded)
+		{
+			printf("Pipeline cache rejected, it was written by another device or driver or is corrupted.\n");
+		}
+	}
+
+	free(data);
+	fclose(file);
+	return loaded;
+}
+
+// Writes to a temporary file first and renames it over the old cache, a crash mid write leaves the old cache intact.
+static void save_pipeline_cache(crang_graphics_device_t* graphicsDevice)
+{
+	crang_wait_pipelines(graphicsDevice);
+	unsigned int size = crang_pipeline_cache_size(graphicsDevice);
+	void* data = malloc(size);
+	size = crang_save_pipeline_cache(graphicsDevice, data, size);
+
+	FILE* file = size > 0 ? fopen(pipeline_cache_temp_path, "wb") : NULL;
+	if (file != NULL)
+	{
+		bool written = fwrite(data, size, 1, file) == 1;
+		written = fclose(file) == 0 && written;
+
+		if (written)
+		{
+#ifdef _WIN32
+			// rename refuses to replace an existing file on Windows.
+			written = MoveFileExA(pipeline_cache_temp_path, pipeline_cache_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+			written = rename(pipeline_cache_temp_path, pipeline_cache_path) == 0;
+#endif // _WIN32
+		}
+
+		if (!written)
+		{
+			remove(pipeline_cache_temp_path);
+		}
+	}
+
+	free(data);
+}
+
+static int compare_uint(void const* left, void const* right)
+{
+	unsigned int l = *(unsigned int const*)left;
+	unsigned int r = *(unsigned int const*)right;
+	return (l > r) - (l < r);
+}
+
+// Runs the GPU culling on a deterministic set of instances and compares it against the CPU reference.
+static void validate_culling(crang_graphics_device_t* graphicsDevice, mapped_file_t shaderPack, float const viewMatrix[16], float const projectionMatrix[16])
+{
+	#define cull_instance_count 1024
+	#define cull_draw_group_count 2
+
+	crang_shader_input_t cullShaderInputs[] =
+	{
+		[0] = {.type = crang_shader_input_type_uniform_buffer, .binding = 0},
+		[1] = {.type = crang_shader_input_type_storage_buffer, .binding = 1},
+		[2] = {.type = crang_shader_input_type_storage_buffer, .binding = 2},
+		[3] = {.type = crang_shader_input_type_storage_buffer, .binding = 3}
+	};
+
+	crang_shader_id_t cullShader = crang_request_shader_id(graphicsDevice, crang_shader_compute);
+	crang_cmd_create_shader_t createCullShader =
+	{
+		.shaderId = cullShader,
+		.shaderInputs = { .inputs = cullShaderInputs, .count = 4 }
+	};
+
+	if (!crang_shader_pack_find(shaderPack.data, shaderPack.size, "cull.cspv", &createCullShader))
+	{
+		printf("Culling validation skipped, cull.cspv is missing from the shader pack.\n");
+		return;
+	}
+
+	static crang_cull_instance_t instances[cull_instance_count];
+	unsigned int seed = 12345;
+	for (unsigned int i = 0; i < cull_instance_count; i++)
+	{
+		float values[4];
+		for (unsigned int v = 0; v < 4; v++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			values[v] = (float)(seed >> 8) / (float)(1 << 24);
+		}
+
+		instances[i] = (crang_cull_instance_t)
+		{
+			.center = { values[0] * 80.0f - 40.0f, values[1] * 40.0f - 20.0f, values[2] * 120.0f - 10.0f },
+			.radius = values[3] * 2.0f,
+			.drawGroup = i % cull_draw_group_count
+		};
+	}
+
+	crang_draw_indexed_indirect_t drawArgsTemplate[cull_draw_group_count];
+	for (unsigned int i = 0; i < cull_draw_group_count; i++)
+	{
+		drawArgsTemplate[i] = (crang_draw_indexed_indirect_t) { .indexCount = 36, .firstInstance = i * cull_instance_count };
+	}
+
+	crang_cull_camera_t cullCamera;
+	crang_cull_build_camera(viewMatrix, projectionMatrix, cull_instance_count, &cullCamera);
+
+	crang_shader_input_id_t cullInputs = crang_request_shader_input_id(graphicsDevice);
+	crang_buffer_id_t cameraBuffer = crang_request_buffer_id(graphicsDevice);
+	crang_buffer_id_t instanceBuffer = crang_request_buffer_id(graphicsDevice);
+	crang_buffer_id_t drawArgsBuffer = crang_request_buffer_id(graphicsDevice);
+	crang_buffer_id_t drawArgsTemplateBuffer = crang_request_buffer_id(graphicsDevice);
+	crang_buffer_id_t visibleBuffer = crang_request_buffer_id(graphicsDevice);
+
+	unsigned int visibleSize = sizeof(unsigned int) * cull_instance_count * cull_draw_group_count;
+	crang_execute_commands_immediate(graphicsDevice,
+		&(crang_cmd_buffer_t)
+		{
+			.commandDescs = (crang_cmd_e[])
+			{
+				[0] = crang_cmd_create_shader,
+				[1] = crang_cmd_create_shader_input,
+				[2] = crang_cmd_create_buffer,
+				[3] = crang_cmd_create_buffer,
+				[4] = crang_cmd_create_buffer,
+				[5] = crang_cmd_create_buffer,
+				[6] = crang_cmd_create_buffer,
+				[7] = crang_cmd_copy_to_buffer,
+				[8] = crang_cmd_copy_to_buffer,
+				[9] = crang_cmd_copy_to_buffer,
+				[10] = crang_cmd_bind_to_shader_input,
+				[11] = crang_cmd_bind_to_shader_input,
+				[12] = crang_cmd_bind_to_shader_input,
+				[13] = crang_cmd_bind_to_shader_input
+			},
+			.commandDatas = (void*[])
+			{
+				[0] = &createCullShader,
+				[1] = &(crang_cmd_create_shader_input_t)
+				{
+					.shaderId = cullShader,
+					.shaderInputId = cullInputs
+				},
+				[2] = &(crang_cmd_create_buffer_t) { .bufferId = cameraBuffer, .size = sizeof(crang_cull_camera_t), .type = crang_buffer_shader_input },
+				[3] = &(crang_cmd_create_buffer_t) { .bufferId = instanceBuffer, .size = sizeof(instances), .type = crang_buffer_storage },
+				[4] = &(crang_cmd_create_buffer_t) { .bufferId = drawArgsBuffer, .size = sizeof(drawArgsTemplate), .type = crang_buffer_storage },
+				[5] = &(crang_cmd_create_buffer_t) { .bufferId = drawArgsTemplateBuffer, .size = sizeof(drawArgsTemplate), .type = crang_buffer_storage },
+				[6] = &(crang_cmd_create_buffer_t) { .bufferId = visibleBuffer, .size = visibleSize, .type = crang_buffer_storage },
+				[7] = &(crang_cmd_copy_to_buffer_t) { .bufferId = cameraBuffer, .data = &cullCamera, .size = sizeof(crang_cull_camera_t) },
+				[8] = &(crang_cmd_copy_to_buffer_t) { .bufferId = instanceBuffer, .data = instances, .size = sizeof(instances) },
+				[9] = &(crang_cmd_copy_to_buffer_t) { .bufferId = drawArgsTemplateBuffer, .data = drawArgsTemplate, .size = sizeof(drawArgsTemplate) },
+				[10] = &(crang_cmd_bind_to_shader_input_t)
+				{
+					.shaderInputId = cullInputs,
+					.binding = 0,
+					.buffer = {.bufferId = cameraBuffer, .size = sizeof(crang_cull_camera_t) }
+				},
+				[11] = &(crang_cmd_bind_to_shader_input_t)
+				{
+					.shaderInputId = cullInputs,
+					.binding = 1,
+					.buffer = {.bufferId = instanceBuffer, .size = sizeof(instances) }
+				},
+				[12] = &(crang_cmd_bind_to_shader_input_t)
+				{
+					.shaderInputId = cullInputs,
+					.binding = 2,
+					.buffer = {.bufferId = drawArgsBuffer, .size = sizeof(drawArgsTemplate) }
+				},
+				[13] = &(crang_cmd_bind_to_shader_input_t)
+				{
+					.shaderInputId = cullInputs,
+					.binding = 3,
+					.buffer = {.bufferId = visibleBuffer, .size = visibleSize }
+				}
+			},
+			.count = 14
+		});
+
+	crang_pipeline_id_t cullPipeline = crang_create_compute_pipeline(graphicsDevice, &(crang_compute_pipeline_desc_t)
+	{
+		.shader = cullShader
+	});
+
+	crang_draw_indexed_indirect_t gpuDrawArgs[cull_draw_group_count];
+	static unsigned int gpuVisible[cull_instance_count * cull_draw_group_count];
+	crang_execute_commands_immediate(graphicsDevice,
+		&(crang_cmd_buffer_t)
+		{
+			.commandDescs = (crang_cmd_e[])
+			{
+				[0] = crang_cmd_cull,
+				[1] = crang_cmd_copy_from_buffer,
+				[2] = crang_cmd_copy_from_buffer
+			},
+			.commandDatas = (void*[])
+			{
+				[0] = &(crang_cmd_cull_t)
+				{
+					.pipelineId = cullPipeline,
+					.shaderInputId = cullInputs,
+					.drawArgsBuffer = drawArgsBuffer,
+					.drawArgsTemplateBuffer = drawArgsTemplateBuffer,
+					.drawGroupCount = cull_draw_group_count,
+					.instanceCount = cull_instance_count
+				},
+				[1] = &(crang_cmd_copy_from_buffer_t) { .bufferId = drawArgsBuffer, .data = gpuDrawArgs, .size = sizeof(gpuDrawArgs) },
+				[2] = &(crang_cmd_copy_from_buffer_t) { .bufferId = visibleBuffer, .data = gpuVisible, .size = visibleSize }
+			},
+			.count = 3
+		});
+
+	crang_draw_indexed_indirect_t cpuDrawArgs[cull_draw_group_count];
+	memcpy(cpuDrawArgs, drawArgsTemplate, sizeof(drawArgsTemplate));
+	static unsigned int cpuVisible[cull_instance_count * cull_draw_group_count];
+	crang_cull_instances_cpu(&cullCamera, instances, cpuDrawArgs, cull_draw_group_count, cpuVisible);
+
+	// The GPU appends atomically, compare each group's visible set regardless of order.
+	bool matches = true;
+	unsigned int visibleCount = 0;
+	for (unsigned int i = 0; i < cull_draw_group_count; i++)
+	{
+		if (gpuDrawArgs[i].instanceCount != cpuDrawArgs[i].instanceCount)
+		{
+			matches = false;
+			continue;
+		}
+
+		unsigned int count = cpuDrawArgs[i].instanceCount;
+		unsigned int first = cpuDrawArgs[i].firstInstance;
+		qsort(&gpuVisible[first], count, sizeof(unsigned int), &compare_uint);
+		qsort(&cpuVisible[first], count, sizeof(unsigned int), &compare_uint);
+		matches = matches && memcmp(&gpuVisible[first], &cpuVisible[first], sizeof(unsigned int) * count) == 0;
+		visibleCount += count;
+	}
+
+	printf("Culling validation %s, %u of %u instances visible.\n", matches ? "passed" : "FAILED", visibleCount, cull_instance_count);
+
+	// Only needed for the validation, give the slots back.
+	crang_execute_commands_immediate(graphicsDevice,
+		&(crang_cmd_buffer_t)
+		{
+			.commandDescs = (crang_cmd_e[])
+			{
+				[0] = crang_cmd_destroy_shader_input,
+				[1] = crang_cmd_destroy_buffer,
+				[2] = crang_cmd_destroy_buffer,
+				[3] = crang_cmd_destroy_buffer,
+				[4] = crang_cmd_destroy_buffer,
+				[5] = crang_cmd_destroy_buffer
+			},
+			.commandDatas = (void*[])
+			{
+				[0] = &(crang_cmd_destroy_shader_input_t) { .shaderInputId = cullInputs },
+				[1] = &(crang_cmd_destroy_buffer_t) { .bufferId = cameraBuffer },
+				[2] = &(crang_cmd_destroy_buffer_t) { .bufferId = instanceBuffer },
+				[3] = &(crang_cmd_destroy_buffer_t) { .bufferId = drawArgsBuffer },
+				[4] = &(crang_cmd_destroy_buffer_t) { .bufferId = drawArgsTemplateBuffer },
+				[5] = &(crang_cmd_destroy_buffer_t) { .bufferId = visibleBuffer }
+			},
+			.count = 6
+		});
+
+	#undef cull_instance_count
+	#undef cull_draw_group_count
+}
 
 int main()
 {
+#ifdef _WIN32
 	HINSTANCE instance = GetModuleHandle(NULL);
 
 	WNDCLASS wc = { 0 };
@@ -46,9 +423,24 @@ int main()
 		);
 	ShowWindow(hwnd, SW_SHOWNORMAL);
 
-	unsigned int ctxSize = crang_ctx_size();
 	unsigned int surfaceSize = crang_win32_surface_size();
-	unsigned int graphicsDeviceSize = crang_graphics_device_size();
+#else
+	unsigned int surfaceSize = 0;
+#endif // _WIN32
+
+	// The demo only needs a handful of everything, the memory blocks keep their default.
+	crang_device_capacities_t capacities =
+	{
+		.shaderCount = 16,
+		.shaderInputCount = 16,
+		.bufferCount = 16,
+		.pipelineCount = 16,
+		.pipelineLayoutCount = 16,
+		.recordingBufferCount = 4
+	};
+
+	unsigned int ctxSize = crang_ctx_size();
+	unsigned int graphicsDeviceSize = crang_graphics_device_size(&capacities);
 	unsigned int presentCtxSize = crang_present_size();
 
 	void* graphicsMemory = malloc(ctxSize + surfaceSize + graphicsDeviceSize + presentCtxSize);
@@ -57,74 +449,81 @@ int main()
 	crang_ctx_t* ctx = crang_create_ctx(buffer);
 	buffer += ctxSize;
 
+#ifdef _WIN32
 	crang_surface_t* surface = crang_win32_create_surface(buffer, ctx, instance, hwnd);
+#else
+	crang_surface_t* surface = NULL;
+#endif // _WIN32
 	buffer += surfaceSize;
 
-	crang_graphics_device_t* graphicsDevice = crang_create_graphics_device(buffer, ctx, surface);
+	crang_graphics_device_t* graphicsDevice = crang_create_graphics_device(buffer, ctx, surface, &capacities);
 	buffer += graphicsDeviceSize;
+	if (graphicsDevice == NULL)
+	{
+		printf("No suitable device, Vulkan 1.1 and VK_KHR_timeline_semaphore are required.\n");
+		return 1;
+	}
 
-	crang_present_t* presentCtx = crang_create_present(buffer, graphicsDevice, surface);
+	// Run twice to compare, the first run compiles from scratch and saves the cache that the second run loads.
+	bool warmPipelineCache = load_pipeline_cache(graphicsDevice);
+	double pipelineCreationMs = 0.0;
+
+	crang_present_t* presentCtx = crang_create_present(buffer, graphicsDevice, surface, &(crang_present_desc_t)
+	{
+		.framesInFlight = 2,
+		.swapchainImageCount = 2,
+		.presentModes =
+		{
+			.modes = (crang_present_mode_e[]) { crang_present_mode_mailbox, crang_present_mode_fifo_relaxed },
+			.count = 2
+		},
+#ifndef _WIN32
+		.headless =
+		{
+			.enabled = true,
+			.width = headless_width,
+			.height = headless_height,
+			.readback = true
+		}
+#endif // _WIN32
+	});
 	buffer += presentCtxSize;
 
 	crang_shader_id_t vertShader = crang_request_shader_id(graphicsDevice, crang_shader_vertex);
 	crang_shader_id_t fragShader = crang_request_shader_id(graphicsDevice, crang_shader_fragment);
 
-
+	// Every shader comes from the one mapped pack, modules are created straight from the mapping.
+	mapped_file_t shaderPack = map_file("../../../Shaders/SPIR-V/shaders.crsp");
 	{
-		FILE* file = fopen("../../../Shaders/SPIR-V/default.vspv", "rb");
-		fseek(file, 0, SEEK_END);
-		long fileSize = ftell(file);
-		fseek(file, 0, SEEK_SET);
-
-		void* vertSource = malloc(fileSize);
-		unsigned int vertSize = fileSize;
-		fread(vertSource, fileSize, 1, file);
-		fclose(file);
-
-		crang_execute_commands_immediate(graphicsDevice,
-			&(crang_cmd_buffer_t)
+		crang_cmd_create_shader_t createVertShader =
+		{
+			.shaderId = vertShader,
+			.shaderInputs =
 			{
-				.commandDescs = (crang_cmd_e[])
+				.inputs = (crang_shader_input_t[])
 				{
-					[0] = crang_cmd_create_shader,
-					[1] = crang_cmd_callback
+					[0] = {.type = crang_shader_input_type_uniform_buffer, .binding = 0}
 				},
-				.commandDatas = (void*[])
-				{
-					[0] = &(crang_cmd_create_shader_t)
-					{
-						.shaderId = vertShader,
-						.source = vertSource,
-						.sourceSize = vertSize,
-						.shaderInputs =
-						{
-							.inputs = (crang_shader_input_t[])
-							{
-								[0] = {.type = crang_shader_input_type_uniform_buffer, .binding = 0}
-							},
-							.count = 1,
-						}
-					},
-					[1] = &(crang_cmd_callback_t)
-					{
-						.callback = &free,
-						.data = vertSource
-					}
-				},
-				.count = 2
-			});
-	}
+				.count = 1,
+			}
+		};
 
-	{
-		FILE* file = fopen("../../../Shaders/SPIR-V/default.fspv", "rb");
-		fseek(file, 0, SEEK_END);
-		long fileSize = ftell(file);
-		fseek(file, 0, SEEK_SET);
+		crang_cmd_create_shader_t createFragShader =
+		{
+			.shaderId = fragShader,
+			.shaderInputs =
+			{
+				.count = 0,
+			}
+		};
 
-		void* fragSource = malloc(fileSize);
-		unsigned int fragSize = fileSize;
-		fread(fragSource, fileSize, 1, file);
-		fclose(file);
+		bool found = crang_shader_pack_find(shaderPack.data, shaderPack.size, "default.vspv", &createVertShader);
+		found = crang_shader_pack_find(shaderPack.data, shaderPack.size, "default.fspv", &createFragShader) && found;
+		if (!found)
+		{
+			printf("Shaders are missing, build Shaders/SPIR-V/shaders.crsp with CompileShaders.bat.\n");
+			return 1;
+		}
 
 		crang_execute_commands_immediate(graphicsDevice,
 			&(crang_cmd_buffer_t)
@@ -132,25 +531,12 @@ int main()
 				.commandDescs = (crang_cmd_e[])
 				{
 					[0] = crang_cmd_create_shader,
-					[1] = crang_cmd_callback
+					[1] = crang_cmd_create_shader
 				},
 				.commandDatas = (void*[])
 				{
-					[0] = &(crang_cmd_create_shader_t)
-					{
-						.shaderId = fragShader,
-						.source = fragSource,
-						.sourceSize = fragSize,
-						.shaderInputs =
-						{
-							.count = 0,
-						}
-					},
-					[1] = &(crang_cmd_callback_t)
-					{
-						.callback = &free,
-						.data = fragSource
-					}
+					[0] = &createVertShader,
+					[1] = &createFragShader
 				},
 				.count = 2
 			});
@@ -250,6 +636,10 @@ int main()
 		[14] = 1.0f,
 	}, sizeof(float) * 16);
 
+	validate_culling(graphicsDevice, shaderPack, camera.viewMatrix, camera.projectionMatrix);
+	// Modules don't reference their source once created.
+	unmap_file(shaderPack);
+
 	crang_buffer_id_t vertInputBuffer = crang_request_buffer_id(graphicsDevice);
 	crang_shader_input_id_t vertInputs = crang_request_shader_input_id(graphicsDevice);
 	{
@@ -299,7 +689,9 @@ int main()
 			});
 	}
 
-	crang_pipeline_id_t pipeline = crang_create_pipeline(graphicsDevice, &(crang_pipeline_desc_t)
+	double pipelineStartMs = crang_time_ms();
+	// Compiles on the device's worker threads, recording a bind to it waits for it to be ready.
+	crang_pipeline_id_t pipeline = crang_create_pipeline_async(graphicsDevice, &(crang_pipeline_desc_t)
 	{
 		.presentCtx = presentCtx,
 		.shaders = 
@@ -326,55 +718,71 @@ int main()
 			.count = 1
 		}
 	});
+	crang_wait_pipelines(graphicsDevice);
+	pipelineCreationMs += crang_time_ms() - pipelineStartMs;
+	printf("Pipeline creation took %.3fms with a %s pipeline cache\n", pipelineCreationMs, warmPipelineCache ? "warm" : "cold");
 
-	crang_recording_buffer_id_t rectangleDraw = crang_request_recording_buffer_id(graphicsDevice);
-	crang_record_commands(graphicsDevice, presentCtx, rectangleDraw, 
-		&(crang_cmd_buffer_t)
+	// Kept around to re-record when the window is resized, the recorded viewport covers the size it was recorded at.
+	crang_cmd_buffer_t rectangleCommands =
+	{
+		.commandDescs = (crang_cmd_e[])
 		{
-			.commandDescs = (crang_cmd_e[])
+			[0] = crang_cmd_bind_pipeline,
+			[1] = crang_cmd_bind_shader_input,
+			[2] = crang_cmd_bind_vertex_inputs,
+			[3] = crang_cmd_bind_index_input,
+			[4] = crang_cmd_draw_indexed,
+		},
+		.commandDatas = (void*[])
+		{
+			[0] = &(crang_cmd_bind_pipeline_t)
 			{
-				[0] = crang_cmd_bind_pipeline,
-				[1] = crang_cmd_bind_shader_input,
-				[2] = crang_cmd_bind_vertex_inputs,
-				[3] = crang_cmd_bind_index_input,
-				[4] = crang_cmd_draw_indexed,
+				.pipelineId = pipeline
 			},
-			.commandDatas = (void*[])
+			[1] = &(crang_cmd_bind_shader_input_t)
 			{
-				[0] = &(crang_cmd_bind_pipeline_t)
-				{
-					.pipelineId = pipeline
-				},
-				[1] = &(crang_cmd_bind_shader_input_t)
-				{
-					.pipelineId = pipeline,
-					.shaderInputId = vertInputs
-				},
-				[2] = &(crang_cmd_bind_vertex_inputs_t)
-				{
-					.bindings = (crang_vertex_input_binding_t[])
-					{
-						[0] = { .bufferId = vertexBuffer, .binding = 0, .offset = 0 }
-					},
-					.count = 1
-				},
-				[3] = &(crang_cmd_bind_index_input_t)
+				.pipelineId = pipeline,
+				.shaderInputId = vertInputs
+			},
+			[2] = &(crang_cmd_bind_vertex_inputs_t)
+			{
+				.bindings = (crang_vertex_input_binding_t[])
 				{
-					.bufferId = indexBuffer,
-					.offset = 0,
-					.indexType = crang_index_type_u32
+					[0] = { .bufferId = vertexBuffer, .binding = 0, .offset = 0 }
 				},
-				[4] = &(crang_cmd_draw_indexed_t)
-				{
-					.indexCount = 36,
-					.instanceCount = 1,
-				}
+				.count = 1
 			},
-			.count = 5
-		});
+			[3] = &(crang_cmd_bind_index_input_t)
+			{
+				.bufferId = indexBuffer,
+				.offset = 0,
+				.indexType = crang_index_type_u32
+			},
+			[4] = &(crang_cmd_draw_indexed_t)
+			{
+				.indexCount = 36,
+				.instanceCount = 1,
+			}
+		},
+		.count = 5
+	};
+
+	crang_recording_buffer_id_t rectangleDraw = crang_request_recording_buffer_id(graphicsDevice);
+	crang_record_commands(graphicsDevice, presentCtx, rectangleDraw, &rectangleCommands);
+
+	crang_present_stats_t recordedStats;
+	crang_present_stats(presentCtx, &recordedStats);
+
+	unsigned int frameCount = 0;
+	double worstFrameLatencyMs = 0.0;
+#ifndef _WIN32
+	struct timespec benchmarkStart;
+	timespec_get(&benchmarkStart, TIME_UTC);
+#endif // _WIN32
 
 	while (true)
 	{
+#ifdef _WIN32
 		bool done = false;
 
 		MSG msg;
@@ -395,6 +803,12 @@ int main()
 		{
 			break;
 		}
+#else
+		if (frameCount == headless_frame_count)
+		{
+			break;
+		}
+#endif // _WIN32
 
 		crang_render(&(crang_render_desc_t)
 		{
@@ -411,11 +825,63 @@ int main()
 				.count = 1
 			}
 		});
+
+		crang_present_stats_t stats;
+		crang_present_stats(presentCtx, &stats);
+		if (stats.width != recordedStats.width || stats.height != recordedStats.height)
+		{
+			crang_record_commands(graphicsDevice, presentCtx, rectangleDraw, &rectangleCommands);
+			recordedStats = stats;
+		}
+
+		crang_frame_timing_t timings[8];
+		unsigned int timingCount = crang_present_pop_frame_timings(presentCtx, timings, 8);
+		for (unsigned int i = 0; i < timingCount; i++)
+		{
+			double frameLatencyMs = timings[i].gpuDoneMs - timings[i].cpuStartMs;
+			worstFrameLatencyMs = frameLatencyMs > worstFrameLatencyMs ? frameLatencyMs : worstFrameLatencyMs;
+		}
+
+		frameCount++;
+		if (frameCount % 600 == 0)
+		{
+			printf("Latency %.2fms (average %.2fms, worst %.2fms), %u frames in flight, %u swapchain images\n",
+				stats.lastLatencyMs, stats.averageLatencyMs, worstFrameLatencyMs, stats.framesInFlight, stats.swapchainImageCount);
+			worstFrameLatencyMs = 0.0;
+		}
+	}
+
+#ifndef _WIN32
+	{
+		// Reading the last frame waits for it, the timing includes the whole queue draining.
+		static unsigned char pixels[headless_width * headless_height * 4];
+		bool hasFrame = crang_present_read_frame(graphicsDevice, presentCtx, pixels);
+
+		struct timespec benchmarkEnd;
+		timespec_get(&benchmarkEnd, TIME_UTC);
+		double elapsedMs = (double)(benchmarkEnd.tv_sec - benchmarkStart.tv_sec) * 1000.0 + (double)(benchmarkEnd.tv_nsec - benchmarkStart.tv_nsec) / 1000000.0;
+		printf("Rendered %u frames at %ux%u in %.2fms, %.3fms per frame\n", frameCount, headless_width, headless_height, elapsedMs, elapsedMs / frameCount);
+
+		FILE* file = hasFrame ? fopen("headless.ppm", "wb") : NULL;
+		if (file != NULL)
+		{
+			fprintf(file, "P6\n%u %u\n255\n", headless_width, headless_height);
+			for (unsigned int i = 0; i < headless_width * headless_height; i++)
+			{
+				fwrite(&pixels[i * 4], 3, 1, file);
+			}
+			fclose(file);
+		}
 	}
+#endif // _WIN32
+
+	save_pipeline_cache(graphicsDevice);
 
 	crang_destroy_present(graphicsDevice, presentCtx);
 	crang_destroy_graphics_device(ctx, graphicsDevice);
+#ifdef _WIN32
 	crang_win32_destroy_surface(ctx, surface);
+#endif // _WIN32
 	crang_destroy_ctx(ctx);
 	free(graphicsMemory);
 }